@@ -0,0 +1,792 @@
+/*
+	One benchmark for every IPC transport of this directory, plus pipes and
+	Unix sockets, so they can be compared on the same machine:
+
+	pipe       two pipe()s
+	unix       socketpair(AF_UNIX, SOCK_STREAM)
+	posix_mq   two mq_open() queues
+	sysv_msg   two msgget() queues
+	posix_shm  shm_open() + mmap(), one buffer per direction
+	sysv_shm   shmget() + shmat(), the same buffers
+
+	For each message size, from 8 B to 1 MB, a parent and a forked child
+	run two tests:
+	ping-pong  the parent sends a message, the child sends it back; every
+	           round trip is timed, p50 and p99 are reported
+	throughput the parent sends messages one way as fast as it can, the
+	           child reads them all and answers with one byte; GB/s is
+	           payload over that time
+
+	Both queues cap a message (msgsize_max, msgmax, 8 KB by default), a
+	larger one goes as several pieces, as an application would send it.
+	The shm buffers hand a message over through a full flag and futex();
+	the sides wait in futex() only when the other side is not ready.
+	A child that fails or dies is a transfer error in the parent, never a
+	hang: each process closes the stream ends it does not use, and the
+	other waits look for the child's exit every PEER_WAIT_MS.
+
+	Output is CSV on stdout:
+	transport,size,round_trips,p50_us,p99_us,messages,gbps
+
+	usage : ipcBench [--cpus PARENT,CHILD] [--transport NAME] [--max-size BYTES]
+	build : gcc -O2 ipcBench.c -o ipcBench -lrt
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <limits.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define MIN_SIZE	8
+#define MAX_SIZE	(1 << 20)
+#define MAX_SIZES	8			/* 8, 64 ... 262144, --max-size */
+#define PING_BYTES	(16 << 20)		/* per size, bounds the round trips */
+#define STREAM_BYTES	(256 << 20)		/* per size, bounds the messages */
+#define MIN_COUNT	100
+#define MAX_PINGS	20000
+#define MAX_MESSAGES	200000
+#define SHM_SPIN	2000			/* polls before futex(), SMP only */
+#define PEER_WAIT_MS	100			/* a blocked parent looks for a dead child */
+#define CACHE_LINE	64
+
+/* one direction of the shm transports */
+typedef struct shmchannel
+{
+	_Atomic uint32_t full;
+	_Atomic uint32_t waiting;
+	char pad[CACHE_LINE - 2 * sizeof(uint32_t)];
+	char data[];
+}SHMCHANNEL;
+
+/* the two directions of one transport, 0 parent to child, 1 back */
+typedef struct link
+{
+	int fd[2][2];				/* pipe, unix: read and write end */
+	mqd_t mq[2];
+	char mq_name[2][32];
+	long mq_chunk;
+	int msqid[2];
+	long msg_chunk;
+	char *msg_buf;				/* mtype + one piece */
+	SHMCHANNEL *chan[2];
+	size_t chan_bytes;
+	char shm_name[32];
+	int shmid;
+	void *shm_base;
+	size_t shm_bytes;
+}LINK;
+
+typedef struct transport
+{
+	const char *name;
+	int (*open)(LINK *l, size_t max);
+	int (*send)(LINK *l, int dir, const char *buf, size_t len);
+	int (*recv)(LINK *l, int dir, char *buf, size_t len);
+	void (*split)(LINK *l, int owner);	/* after fork(), NULL when all is shared */
+	void (*close)(LINK *l, int owner);
+}TRANSPORT;
+
+static int shm_spin;
+static pid_t peer;				/* the child, in the parent; 0 in the child */
+static int *orphan_msqid;			/* the queues of the running sysv_msg test */
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* the child's exit, 0 while it runs; it stays a zombie for the waitpid() of run() */
+static int peer_exit(siginfo_t *info)
+{
+	memset(info, 0, sizeof(*info));
+	return 0 != peer && 0 == waitid(P_PID, peer, info, WEXITED | WNOHANG | WNOWAIT) && 0 != info->si_pid;
+}
+
+/* errno ESRCH when it is gone, for the transfer error */
+static int peer_gone(void)
+{
+	siginfo_t info;
+
+	if (!peer_exit(&info))
+		return 0;
+	errno = ESRCH;
+	return 1;
+}
+
+/* CLOCK_REALTIME PEER_WAIT_MS from now, for the mq_timed*() calls */
+static struct timespec *peer_deadline(struct timespec *ts)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_nsec += PEER_WAIT_MS * 1000000L;
+	if (1000000000L <= ts->tv_nsec)
+	{
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+	return ts;
+}
+
+static long proc_value(const char *path, long fallback)
+{
+	FILE *f;
+	long value;
+
+	f = fopen(path, "r");
+	if (NULL == f)
+		return fallback;
+	if (1 != fscanf(f, "%ld", &value))
+		value = fallback;
+	fclose(f);
+	return value;
+}
+
+/* --- byte streams: pipe, unix --- */
+
+static int stream_send(LINK *l, int dir, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (0 < len)
+	{
+		n = write(l->fd[dir][1], buf, len);
+		if (-1 == n && EINTR == errno)
+			continue;
+		if (0 >= n)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int stream_recv(LINK *l, int dir, char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (0 < len)
+	{
+		n = read(l->fd[dir][0], buf, len);
+		if (-1 == n && EINTR == errno)
+			continue;
+		if (0 == n)
+			errno = EPIPE;			/* the other side is gone */
+		if (0 >= n)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void stream_drop(int *fd)
+{
+	if (-1 != *fd)
+		close(*fd);
+	*fd = -1;
+}
+
+/*
+	the parent writes direction 0 and reads direction 1; once the other
+	process holds no copy, its exit is EOF or EPIPE here instead of a hang
+*/
+static void pipe_split(LINK *l, int owner)
+{
+	stream_drop(&l->fd[0][owner ? 0 : 1]);
+	stream_drop(&l->fd[1][owner ? 1 : 0]);
+}
+
+static void pipe_close(LINK *l, int owner)
+{
+	int dir;
+
+	(void)owner;
+	for (dir = 0; dir < 2; dir++)
+	{
+		stream_drop(&l->fd[dir][0]);
+		stream_drop(&l->fd[dir][1]);
+	}
+}
+
+static int pipe_open(LINK *l, size_t max)
+{
+	int dir;
+
+	for (dir = 0; dir < 2; dir++)
+	{
+		if (-1 == pipe(l->fd[dir]))
+			return -1;
+		/* the default 64 KB would cut every large message into pieces */
+		fcntl(l->fd[dir][1], F_SETPIPE_SZ, (int)(max < 1048576 ? max : 1048576));
+	}
+	return 0;
+}
+
+static int unix_open(LINK *l, size_t max)
+{
+	int sv[2];
+	int bytes = (int)max;
+
+	if (-1 == socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+		return -1;
+	setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &bytes, sizeof(bytes));
+	setsockopt(sv[1], SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes));
+	/* direction 0 writes sv[0] and reads sv[1], direction 1 the other way */
+	l->fd[0][1] = sv[0];
+	l->fd[0][0] = sv[1];
+	l->fd[1][1] = sv[1];
+	l->fd[1][0] = sv[0];
+	return 0;
+}
+
+/* the parent keeps sv[0], the child sv[1] */
+static void unix_split(LINK *l, int owner)
+{
+	stream_drop(&l->fd[0][owner ? 0 : 1]);
+}
+
+static void unix_close(LINK *l, int owner)
+{
+	(void)owner;
+	stream_drop(&l->fd[0][0]);
+	stream_drop(&l->fd[0][1]);
+}
+
+/* --- POSIX message queues --- */
+
+static int mq_bench_open(LINK *l, size_t max)
+{
+	struct mq_attr attr;
+	int dir;
+
+	(void)max;
+	memset(&attr, 0, sizeof(attr));
+	attr.mq_maxmsg = proc_value("/proc/sys/fs/mqueue/msg_max", 10);
+	attr.mq_msgsize = proc_value("/proc/sys/fs/mqueue/msgsize_max", 8192);
+	l->mq_chunk = attr.mq_msgsize;
+	for (dir = 0; dir < 2; dir++)
+	{
+		snprintf(l->mq_name[dir], sizeof(l->mq_name[dir]), "/ipcbench.%ld.%d", (long)getpid(), dir);
+		l->mq[dir] = mq_open(l->mq_name[dir], O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, &attr);
+		if ((mqd_t)-1 == l->mq[dir])
+			return -1;
+	}
+	l->msg_buf = malloc(l->mq_chunk);
+	return NULL == l->msg_buf ? -1 : 0;
+}
+
+static int mq_bench_send(LINK *l, int dir, const char *buf, size_t len)
+{
+	struct timespec ts;
+	size_t piece;
+
+	do
+	{
+		piece = len < (size_t)l->mq_chunk ? len : (size_t)l->mq_chunk;
+		while (-1 == mq_timedsend(l->mq[dir], buf, piece, 0, peer_deadline(&ts)))
+			if (ETIMEDOUT != errno || peer_gone())
+				return -1;
+		buf += piece;
+		len -= piece;
+	} while (0 < len);
+	return 0;
+}
+
+/* mq_receive() that gives up once the child is gone */
+static ssize_t mq_bench_receive(mqd_t mq, char *buf, size_t len)
+{
+	struct timespec ts;
+	ssize_t n;
+
+	while (-1 == (n = mq_timedreceive(mq, buf, len, NULL, peer_deadline(&ts))))
+		if (ETIMEDOUT != errno || peer_gone())
+			return -1;
+	return n;
+}
+
+static int mq_bench_recv(LINK *l, int dir, char *buf, size_t len)
+{
+	ssize_t n;
+
+	do
+	{
+		/* mq_receive() wants room for a whole mq_msgsize */
+		if (len >= (size_t)l->mq_chunk)
+			n = mq_bench_receive(l->mq[dir], buf, l->mq_chunk);
+		else
+		{
+			n = mq_bench_receive(l->mq[dir], l->msg_buf, l->mq_chunk);
+			if (0 < n)
+				memcpy(buf, l->msg_buf, n);
+		}
+		if (0 >= n)
+			return -1;
+		buf += n;
+		len -= n;
+	} while (0 < len);
+	return 0;
+}
+
+static void mq_bench_close(LINK *l, int owner)
+{
+	int dir;
+
+	for (dir = 0; dir < 2; dir++)
+	{
+		mq_close(l->mq[dir]);
+		if (owner)
+			mq_unlink(l->mq_name[dir]);
+	}
+	free(l->msg_buf);
+}
+
+/* --- System V message queues --- */
+
+/*
+	SIGCHLD: msgrcv() has no timeout, so a child that did not finish takes
+	the queues with it and the parent's msgrcv() fails with EIDRM
+*/
+static void msg_orphaned(int sig)
+{
+	siginfo_t info;
+	int dir, saved = errno;
+
+	(void)sig;
+	if (NULL != orphan_msqid && peer_exit(&info) &&
+		!(CLD_EXITED == info.si_code && EXIT_SUCCESS == info.si_status))
+		for (dir = 0; dir < 2; dir++)
+			msgctl(orphan_msqid[dir], IPC_RMID, NULL);
+	errno = saved;
+}
+
+static int msg_bench_open(LINK *l, size_t max)
+{
+	struct sigaction sa;
+	int dir;
+
+	(void)max;
+	l->msg_chunk = proc_value("/proc/sys/kernel/msgmax", 8192);
+	for (dir = 0; dir < 2; dir++)
+	{
+		l->msqid[dir] = msgget(IPC_PRIVATE, IPC_CREAT | 0600);
+		if (-1 == l->msqid[dir])
+			return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = msg_orphaned;
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGCHLD, &sa, NULL);
+	orphan_msqid = l->msqid;
+	l->msg_buf = malloc(sizeof(long) + l->msg_chunk);
+	return NULL == l->msg_buf ? -1 : 0;
+}
+
+static int msg_bench_send(LINK *l, int dir, const char *buf, size_t len)
+{
+	size_t piece;
+
+	*(long *)l->msg_buf = 1;
+	do
+	{
+		piece = len < (size_t)l->msg_chunk ? len : (size_t)l->msg_chunk;
+		memcpy(l->msg_buf + sizeof(long), buf, piece);
+		while (-1 == msgsnd(l->msqid[dir], l->msg_buf, piece, 0))
+			if (EINTR != errno)		/* never restarted, SIGCHLD included */
+				return -1;
+		buf += piece;
+		len -= piece;
+	} while (0 < len);
+	return 0;
+}
+
+static int msg_bench_recv(LINK *l, int dir, char *buf, size_t len)
+{
+	ssize_t n;
+
+	do
+	{
+		while (-1 == (n = msgrcv(l->msqid[dir], l->msg_buf, l->msg_chunk, 0, 0)) && EINTR == errno)
+			;
+		if (0 >= n)
+			return -1;
+		memcpy(buf, l->msg_buf + sizeof(long), n);
+		buf += n;
+		len -= n;
+	} while (0 < len);
+	return 0;
+}
+
+static void msg_bench_close(LINK *l, int owner)
+{
+	int dir;
+
+	signal(SIGCHLD, SIG_DFL);
+	orphan_msqid = NULL;
+	for (dir = 0; dir < 2; dir++)
+		if (owner)
+			msgctl(l->msqid[dir], IPC_RMID, NULL);
+	free(l->msg_buf);
+}
+
+/* --- shared memory, POSIX and System V only differ in the mapping --- */
+
+static void channels(LINK *l, void *base, size_t max)
+{
+	l->chan_bytes = (sizeof(SHMCHANNEL) + max + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+	l->chan[0] = base;
+	l->chan[1] = (SHMCHANNEL *)((char *)base + l->chan_bytes);
+}
+
+/*
+	until full is no longer seen, -1 when the child died meanwhile; the
+	fence pairs with the one in flag_set()
+*/
+static int flag_wait(SHMCHANNEL *c, uint32_t seen)
+{
+	struct timespec ts = { 0, PEER_WAIT_MS * 1000000L };
+	int spin = 0;
+
+	while (seen == atomic_load_explicit(&c->full, memory_order_acquire))
+	{
+		if (spin++ < shm_spin)
+			continue;
+		atomic_store_explicit(&c->waiting, 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (seen == atomic_load_explicit(&c->full, memory_order_acquire) &&
+			-1 == syscall(SYS_futex, &c->full, FUTEX_WAIT, seen, &ts, NULL, 0) &&
+			ETIMEDOUT == errno && peer_gone())
+			return -1;
+		spin = 0;
+	}
+	return 0;
+}
+
+static void flag_set(SHMCHANNEL *c, uint32_t value)
+{
+	atomic_store_explicit(&c->full, value, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&c->waiting, memory_order_relaxed) && atomic_exchange(&c->waiting, 0))
+		syscall(SYS_futex, &c->full, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static int shm_bench_send(LINK *l, int dir, const char *buf, size_t len)
+{
+	SHMCHANNEL *c = l->chan[dir];
+
+	if (-1 == flag_wait(c, 1))
+		return -1;
+	memcpy(c->data, buf, len);
+	flag_set(c, 1);
+	return 0;
+}
+
+static int shm_bench_recv(LINK *l, int dir, char *buf, size_t len)
+{
+	SHMCHANNEL *c = l->chan[dir];
+
+	if (-1 == flag_wait(c, 0))
+		return -1;
+	memcpy(buf, c->data, len);
+	flag_set(c, 0);
+	return 0;
+}
+
+static int posix_shm_open(LINK *l, size_t max)
+{
+	int fd;
+
+	channels(l, NULL, max);
+	l->shm_bytes = 2 * l->chan_bytes;
+	snprintf(l->shm_name, sizeof(l->shm_name), "/ipcbench.%ld", (long)getpid());
+	fd = shm_open(l->shm_name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (-1 == fd)
+		return -1;
+	if (-1 == ftruncate(fd, l->shm_bytes))
+	{
+		close(fd);
+		return -1;
+	}
+	l->shm_base = mmap(NULL, l->shm_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == l->shm_base)
+		return -1;
+	channels(l, l->shm_base, max);
+	return 0;
+}
+
+static void posix_shm_close(LINK *l, int owner)
+{
+	munmap(l->shm_base, l->shm_bytes);
+	if (owner)
+		shm_unlink(l->shm_name);
+}
+
+static int sysv_shm_open(LINK *l, size_t max)
+{
+	channels(l, NULL, max);
+	l->shm_bytes = 2 * l->chan_bytes;
+	l->shmid = shmget(IPC_PRIVATE, l->shm_bytes, IPC_CREAT | 0600);
+	if (-1 == l->shmid)
+		return -1;
+	l->shm_base = shmat(l->shmid, NULL, 0);
+	if ((void *)-1 == l->shm_base)
+		return -1;
+	/* gone once both processes detach, even if one dies */
+	shmctl(l->shmid, IPC_RMID, NULL);
+	channels(l, l->shm_base, max);
+	return 0;
+}
+
+static void sysv_shm_close(LINK *l, int owner)
+{
+	(void)owner;
+	shmdt(l->shm_base);
+}
+
+static const TRANSPORT transports[] =
+{
+	{ "pipe", pipe_open, stream_send, stream_recv, pipe_split, pipe_close },
+	{ "unix", unix_open, stream_send, stream_recv, unix_split, unix_close },
+	{ "posix_mq", mq_bench_open, mq_bench_send, mq_bench_recv, NULL, mq_bench_close },
+	{ "sysv_msg", msg_bench_open, msg_bench_send, msg_bench_recv, NULL, msg_bench_close },
+	{ "posix_shm", posix_shm_open, shm_bench_send, shm_bench_recv, NULL, posix_shm_close },
+	{ "sysv_shm", sysv_shm_open, shm_bench_send, shm_bench_recv, NULL, sysv_shm_close },
+};
+
+/* --- the two tests, the child mirrors the parent's schedule --- */
+
+static long clamp(long value, long low, long high)
+{
+	return value < low ? low : high < value ? high : value;
+}
+
+static long pings(size_t size)
+{
+	return clamp(PING_BYTES / size, MIN_COUNT, MAX_PINGS);
+}
+
+static long messages(size_t size)
+{
+	return clamp(STREAM_BYTES / size, MIN_COUNT, MAX_MESSAGES);
+}
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	if (0 > cpu)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (-1 == sched_setaffinity(0, sizeof(set), &set))
+		perror("sched_setaffinity");
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* 8, 64, 512 ... below max_size, then max_size itself; returns how many */
+static int size_list(size_t max_size, size_t *sizes)
+{
+	size_t size;
+	int n = 0;
+
+	for (size = MIN_SIZE; size < max_size; size *= 8)
+		sizes[n++] = size;
+	sizes[n++] = max_size;
+	return n;
+}
+
+static int child(const TRANSPORT *t, LINK *l, char *buf, const size_t *sizes, int nsizes)
+{
+	size_t size;
+	long i, warm;
+	int s;
+
+	for (s = 0; s < nsizes; s++)
+	{
+		size = sizes[s];
+		warm = pings(size) / 10;
+		for (i = 0; i < warm + pings(size); i++)
+			if (-1 == t->recv(l, 0, buf, size) || -1 == t->send(l, 1, buf, size))
+				return -1;
+		for (i = 0; i < messages(size); i++)
+			if (-1 == t->recv(l, 0, buf, size))
+				return -1;
+		if (-1 == t->send(l, 1, buf, 1))
+			return -1;
+	}
+	return 0;
+}
+
+static int parent(const TRANSPORT *t, LINK *l, char *buf, const size_t *sizes, int nsizes, long long *rtt)
+{
+	long long start, elapsed;
+	size_t size;
+	long i, warm, n;
+	int s;
+
+	for (s = 0; s < nsizes; s++)
+	{
+		size = sizes[s];
+		warm = pings(size) / 10;
+		n = pings(size);
+		for (i = 0; i < warm + n; i++)
+		{
+			start = now_ns();
+			if (-1 == t->send(l, 0, buf, size) || -1 == t->recv(l, 1, buf, size))
+				return -1;
+			if (i >= warm)
+				rtt[i - warm] = now_ns() - start;
+		}
+		qsort(rtt, n, sizeof(rtt[0]), compare_ns);
+
+		start = now_ns();
+		for (i = 0; i < messages(size); i++)
+			if (-1 == t->send(l, 0, buf, size))
+				return -1;
+		if (-1 == t->recv(l, 1, buf, 1))
+			return -1;
+		elapsed = now_ns() - start;
+
+		printf("%s,%zu,%ld,%.2f,%.2f,%ld,%.3f\n", t->name, size, n,
+			rtt[n / 2] / 1000.0, rtt[n * 99 / 100] / 1000.0,
+			messages(size), (double)size * messages(size) / elapsed);
+		fflush(stdout);
+	}
+	return 0;
+}
+
+static int run(const TRANSPORT *t, size_t max_size, int parent_cpu, int child_cpu)
+{
+	LINK l;
+	size_t sizes[MAX_SIZES];
+	sigset_t chld;
+	char *buf;
+	long long *rtt;
+	pid_t pid;
+	int status, ret, nsizes;
+
+	memset(&l, 0, sizeof(l));
+	buf = malloc(max_size);
+	rtt = malloc(MAX_PINGS * sizeof(long long));
+	if (NULL == buf || NULL == rtt || -1 == t->open(&l, max_size))
+	{
+		fprintf(stderr, "%s: ", t->name);
+		perror("setup");
+		free(buf);
+		free(rtt);
+		return -1;
+	}
+	memset(buf, 'x', max_size);
+	nsizes = size_list(max_size, sizes);
+	/* a child dying before peer is set must still be seen */
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, NULL);
+	pid = fork();
+	if (-1 == pid)
+	{
+		perror("fork");
+		exit(EXIT_FAILURE);
+	}
+	if (0 == pid)
+	{
+		sigprocmask(SIG_UNBLOCK, &chld, NULL);
+		pin(child_cpu);
+		if (NULL != t->split)
+			t->split(&l, 0);
+		ret = child(t, &l, buf, sizes, nsizes);
+		t->close(&l, 0);
+		_exit(-1 == ret ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+	pin(parent_cpu);
+	if (NULL != t->split)
+		t->split(&l, 1);
+	peer = pid;
+	sigprocmask(SIG_UNBLOCK, &chld, NULL);
+	ret = parent(t, &l, buf, sizes, nsizes, rtt);
+	if (-1 == ret)
+	{
+		fprintf(stderr, "%s: ", t->name);
+		perror("transfer");
+		kill(pid, SIGKILL);
+	}
+	waitpid(pid, &status, 0);
+	peer = 0;
+	t->close(&l, 1);
+	free(buf);
+	free(rtt);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *only = NULL;
+	size_t max_size = MAX_SIZE;
+	int parent_cpu = -1, child_cpu = -1;
+	unsigned int i;
+	int ran = 0;
+
+	for (i = 1; i < (unsigned int)argc; i++)
+	{
+		if (0 == strcmp(argv[i], "--cpus") && i + 1 < (unsigned int)argc &&
+			2 == sscanf(argv[i + 1], "%d,%d", &parent_cpu, &child_cpu))
+			i++;
+		else if (0 == strcmp(argv[i], "--transport") && i + 1 < (unsigned int)argc)
+			only = argv[++i];
+		else if (0 == strcmp(argv[i], "--max-size") && i + 1 < (unsigned int)argc)
+			max_size = strtoul(argv[++i], NULL, 0);
+		else
+		{
+			fprintf(stderr, "usage: %s [--cpus PARENT,CHILD] [--transport NAME] [--max-size BYTES]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (MIN_SIZE > max_size || MAX_SIZE < max_size)
+	{
+		fprintf(stderr, "--max-size must be %d to %d\n", MIN_SIZE, MAX_SIZE);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < sizeof(transports) / sizeof(transports[0]); i++)
+		ran += NULL == only || 0 == strcmp(only, transports[i].name);
+	if (0 == ran)
+	{
+		fprintf(stderr, "no transport %s\n", only);
+		exit(EXIT_FAILURE);
+	}
+	shm_spin = 1 < sysconf(_SC_NPROCESSORS_ONLN) ? SHM_SPIN : 0;
+	signal(SIGPIPE, SIG_IGN);		/* a dead child is EPIPE, not the end of us */
+
+	printf("transport,size,round_trips,p50_us,p99_us,messages,gbps\n");
+	for (i = 0; i < sizeof(transports) / sizeof(transports[0]); i++)
+		if ((NULL == only || 0 == strcmp(only, transports[i].name)) &&
+			-1 == run(&transports[i], max_size, parent_cpu, child_cpu))
+			exit(EXIT_FAILURE);
+	exit(EXIT_SUCCESS);
+}
@@ -1,14 +1,27 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <mqueue.h>
+#include <time.h>
 
 #include "msgheader.h"
+#include "shmring.h"
 
 #define OPEN_FLAG    O_RDWR|O_CREAT|O_EXCL
 #define OPEN_MODE    S_IRUSR|S_IWUSR
 
+/*
+usage : msgreceiver [--ring] [--bench]
+--ring   create the shared memory ring RING_NAME instead of the queue
+--bench  count messages until an empty one ("msgsender --bench"), print
+         messages/sec and exit
+*/
+
+static SHMRING  *ring = NULL;
+
 //cleanup function to clean up the message queue
 void cleanup(int signum)
 {
@@ -19,6 +32,13 @@ void cleanup(int signum)
     all references to the message queue have been closed
     */
 
+    if (NULL != ring)
+    {
+        if (-1 == shm_unlink(RING_NAME))
+            perror("shm_unlink failed");
+        printf("ring removed\n");
+        exit(-1);
+    }
     if (-1 == mq_unlink(MQ_NAME))
     {
         perror("mq_unlink failed");
@@ -28,14 +48,95 @@ void cleanup(int signum)
     exit(-1);
 }
 
-int main(void)
+/*
+receive until the empty message, the clock starts at the first one;
+the sender numbers its messages, every one out of order is counted
+*/
+static void bench(mqd_t msqid)
+{
+    samplemsgbuf    buf;
+    struct timespec start, end;
+    long            count = 0;
+    long            bytes = 0;
+    long            seq;
+    long            wrong = 0;
+    double          secs;
+    int             retval;
+
+    for(;;)
+    {
+        if (NULL != ring)
+            retval = ring_receive(ring, buf, MSG_SIZE);
+        else if (0 > (retval = mq_receive(msqid, buf, MSG_SIZE, NULL)))
+        {
+            perror("msg queue receive");
+            return;
+        }
+        if (0 == count)
+            clock_gettime(CLOCK_MONOTONIC, &start);
+        if (0 == retval)
+            break;
+        if ((int)sizeof(seq) <= retval)
+        {
+            memcpy(&seq, buf, sizeof(seq));
+            wrong += seq != count;
+        }
+        count++;
+        bytes += retval;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("receiver: %s, %ld messages in %.3f s, %.0f msgs/sec, %.1f MB/s, %ld out of order\n",
+           NULL != ring ? "shm ring" : "mq", count, secs, count / secs, bytes / secs / 1e6, wrong);
+}
+
+int main(int argc, char *argv[])
 {
     samplemsgbuf    buf;
     int             retval = 0;
+    int             i;
+    int             use_ring = 0;
+    int             bench_run = 0;
 
-    mqd_t           msqid;
+    mqd_t           msqid = -1;
     struct mq_attr  qattr;
 
+    for (i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "--ring"))
+            use_ring = 1;
+        else if (0 == strcmp(argv[i], "--bench"))
+            bench_run = 1;
+        else
+        {
+            printf("usage: %s [--ring] [--bench]\n", argv[0]);
+            exit(-1);
+        }
+    }
+
+    if (use_ring)
+    {
+        /* the receiver creates it, as it creates the queue */
+        if (NULL == (ring = ring_map(RING_NAME, 1)))			// #define RING_NAME  "/ring00001"
+        {
+            perror("ring create");
+            exit(-1);
+        }
+        printf("reciever: ready to receive messages on the ring.\n");
+        signal(SIGINT, cleanup);
+        if (bench_run)
+            bench(msqid);
+        else for(;;)
+        {
+            retval = ring_receive(ring, buf, MSG_SIZE - 1);
+            buf[retval < MSG_SIZE - 1 ? retval : MSG_SIZE - 1] = '\0';
+            printf("receiver: \"%s\"\n", buf);
+        }
+        ring_unmap(ring);
+        shm_unlink(RING_NAME);
+        return 0;
+    }
+
     /*
     setting the attribute structure before creating the queue
     setting of mq_flags  is not required, that is beign taken 
@@ -89,7 +190,9 @@ int main(void)
     /*
     receiver started, it quits only if the queue has been removed
     */
-    for(;;)
+    if (bench_run)
+        bench(msqid);
+    else for(;;)
     {
         /*
         Messages with any priority can be received
@@ -1,31 +1,111 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 //#include <sys/types.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <mqueue.h>
+#include <time.h>
 
 #include "msgheader.h"
+#include "shmring.h"
 
 #define OPEN_FLAG       O_RDWR
 
 #define INPUT_MSG_SIZE  MSG_SIZE - 1
 
-int main(void)
+/*
+usage : msgsender [--ring] [--bench COUNT [SIZE]]
+--ring   send through the shared memory ring of msgreceiver --ring
+--bench  send COUNT messages of SIZE bytes (default 64) flat out, then
+         an empty one to tell "msgreceiver --bench" the run is over
+*/
+
+static mqd_t    msqid = -1;
+static SHMRING  *ring = NULL;
+
+static int send_msg(const char *msg, int len)
+{
+    if (NULL != ring)
+        return ring_send(ring, msg, len);
+    return mq_send(msqid, msg, len, 0);
+}
+
+static void bench(long count, int size)
+{
+    samplemsgbuf    buf;
+    struct timespec start, end;
+    double          secs;
+    long            i;
+
+    memset(buf, 'x', size);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < count; i++)
+    {
+        memcpy(buf, &i, sizeof(i) < (size_t)size ? sizeof(i) : (size_t)size);
+        if (0 > send_msg(buf, size))
+        {
+            perror("send");
+            return;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    send_msg(buf, 0);
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("sender: %ld messages of %d bytes in %.3f s, %.0f msgs/sec\n",
+           count, size, secs, count / secs);
+}
+
+int main(int argc, char *argv[])
 {
     int             readchars = 0;
-    int             retval = 0;
-    mqd_t           msqid;
-    struct mq_attr  qattr;
+    int             i;
+    long            count = 0;
+    int             size = 64;
+    int             use_ring = 0;
     samplemsgbuf    buf;
 
-    if (-1 == (msqid = mq_open(MQ_NAME, OPEN_FLAG)))				// #define MQ_NAME  "/mq00001"
+    for (i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "--ring"))
+            use_ring = 1;
+        else if (0 == strcmp(argv[i], "--bench") && i + 1 < argc)
+        {
+            count = atol(argv[++i]);
+            if (i + 1 < argc && '-' != argv[i + 1][0])
+                size = atoi(argv[++i]);
+        }
+        else
+        {
+            printf("usage: %s [--ring] [--bench COUNT [SIZE]]\n", argv[0]);
+            exit(-1);
+        }
+    }
+    /* mq_send() refuses more than mq_msgsize, keep both transports comparable */
+    if (0 > count || 0 >= size || MSG_SIZE < size)
+    {
+        printf("message size must be 1 to %d\n", MSG_SIZE);
+        exit(-1);
+    }
+
+    if (use_ring)
+    {
+        if (NULL == (ring = ring_map(RING_NAME, 0)))			// #define RING_NAME  "/ring00001"
+        {
+            perror("ring open");
+            exit(-1);
+        }
+    }
+    else if (-1 == (msqid = mq_open(MQ_NAME, OPEN_FLAG)))				// #define MQ_NAME  "/mq00001"
     {
         perror("mq_open");
         exit(-1);
     }
 
-    for(;;) /* sender in the infinite loop */
+    if (0 < count)
+        bench(count, size);
+    else for(;;) /* sender in the infinite loop */
     {
         printf("sender: give me a message to send.\n");
         printf("typing \"stop\" would stop sending messages.\n");
@@ -36,12 +116,15 @@ int main(void)
         /*
         only readchars-1 characters are sent to the peer to avoid sending '\n'
         */
-        if (0 > mq_send(msqid, buf, readchars-1, 0))
+        if (0 > send_msg(buf, readchars-1))
         {
             perror("msg queue send");
             break;
         }
     }
-    mq_close(msqid);
+    if (NULL != ring)
+        ring_unmap(ring);
+    else
+        mq_close(msqid);
     return 0;
 }
@@ -0,0 +1,148 @@
+/*
+	Increments per second of a counter in shared memory with N processes
+	for N = 1, 2, 4 ... 16, each adding one INCREMENTS times:
+	sem      count++ between sem_wait() and sem_post() on a process
+	         shared semaphore, the old SHMSTRUCT protocol
+	atomic   fetch_add on the padded counter of shmcounter.h
+	sharded  fetch_add on the process's own slot, summed at the end
+	The final count is checked against N * INCREMENTS in every mode.
+
+	usage : sharedMemoryCounterBench [increments per process] [max processes]
+	build : gcc -O2 sharedMemoryCounterBench.c -o sharedMemoryCounterBench -lpthread
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <semaphore.h>
+
+#include "shmcounter.h"
+
+#define DEFAULT_INCREMENTS	2000000
+#define MAX_PROCS		16
+#define MODE_SEM		2
+
+typedef struct shmstruct
+{
+	sem_t mutex;
+	int64_t count;
+}SHMSTRUCT;
+
+typedef struct benchshm
+{
+	SHMSTRUCT sem;
+	SHMCOUNTER counter;
+}BENCHSHM;
+
+static BENCHSHM *shm;
+
+static void worker(int mode, long increments)
+{
+	COUNTERSHARD *slot;
+	long i;
+
+	if (MODE_SEM == mode)
+		for (i = 0; i < increments; i++)
+		{
+			sem_wait(&shm->sem.mutex);
+			shm->sem.count++;
+			sem_post(&shm->sem.mutex);
+		}
+	else if (COUNTER_ATOMIC == mode)
+		for (i = 0; i < increments; i++)
+			counter_add(&shm->counter, 1);
+	else
+	{
+		slot = counter_shard(&shm->counter);
+		for (i = 0; i < increments; i++)
+			counter_shard_add(slot, 1);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+/* increments per second, -1 when the final count is wrong */
+static double run(int mode, int n, long increments)
+{
+	struct timespec start, end;
+	int64_t count;
+	pid_t pid;
+	int index;
+
+	memset(shm, 0, sizeof(BENCHSHM));
+	if (-1 == sem_init(&shm->sem.mutex, 1, 1))
+	{
+		perror(" sem_init ERROR: ");
+		exit(EXIT_FAILURE);
+	}
+	fflush(stdout);			// or the children print it again
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (index = 0; index < n; index++)
+	{
+		pid = fork();
+		if (-1 == pid)
+		{
+			perror(" fork ERROR: ");
+			exit(EXIT_FAILURE);
+		}
+		if (0 == pid)
+			worker(mode, increments);
+	}
+	for (index = 0; index < n; index++)
+		wait(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	count = MODE_SEM == mode ? shm->sem.count : counter_read(&shm->counter, mode);
+	sem_destroy(&shm->sem.mutex);
+	if ((int64_t)n * increments != count)
+		return -1;
+	return n * increments / ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *names[] = { "atomic", "sharded", "sem" };
+	long increments = DEFAULT_INCREMENTS;
+	int max_procs = MAX_PROCS;
+	double rate[3];
+	int n, mode;
+
+	if (2 <= argc)
+		increments = atol(argv[1]);
+	if (3 <= argc)
+		max_procs = atoi(argv[2]);
+	if (0 >= increments || 0 >= max_procs || MAX_PROCS < max_procs)
+	{
+		fprintf(stdout, "usage: %s [increments per process] [max processes, up to %d]\n", argv[0], MAX_PROCS);
+		exit(EXIT_FAILURE);
+	}
+
+	shm = mmap(NULL, sizeof(BENCHSHM), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == shm)
+	{
+		perror(" mmap ERROR: ");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "%ld increments per process, %ld CPUs\n", increments, sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(stdout, "%10s %14s %14s %14s\n", "processes", "sem incr/s", "atomic incr/s", "sharded incr/s");
+	for (n = 1; n <= max_procs; n *= 2)
+	{
+		for (mode = 0; mode < 3; mode++)
+		{
+			rate[mode] = run(mode, n, increments);
+			if (0 > rate[mode])
+			{
+				fprintf(stdout, "%10d wrong count (%s)\n", n, names[mode]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		fprintf(stdout, "%10d %14.0f %14.0f %14.0f\n", n, rate[MODE_SEM], rate[COUNTER_ATOMIC], rate[COUNTER_SHARDED]);
+	}
+	munmap(shm, sizeof(BENCHSHM));
+	exit(EXIT_SUCCESS);
+}
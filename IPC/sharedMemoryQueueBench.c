@@ -0,0 +1,211 @@
+/*
+	Scaling of the shared memory work queue of shmqueue.h against the
+	textbook semaphore bounded buffer (one sem_t mutex plus counting
+	semaphores for free and full slots), with N writer and N reader
+	processes for N = 1, 2, 4 ... 16.
+
+	Writers push ITEMS integers between them, the parent then pushes one
+	stop item per reader. Readers add up what they get; the sum and the
+	count are checked, so a lost or doubled item shows as an error.
+
+	usage : sharedMemoryQueueBench [items] [max processes per side]
+	build : gcc -O2 sharedMemoryQueueBench.c -o sharedMemoryQueueBench -lpthread
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <semaphore.h>
+
+#include "shmqueue.h"
+
+#define DEFAULT_ITEMS	2000000
+#define MAX_PROCS	16
+#define KIND_STOP	1
+
+typedef struct semqueue
+{
+	sem_t mutex;
+	sem_t free_slots;
+	sem_t full_slots;
+	uint32_t head;
+	uint32_t tail;
+	WORKITEM slot[QUEUE_SLOTS];
+}SEMQUEUE;
+
+typedef struct benchshm
+{
+	SHMQUEUE queue;
+	SEMQUEUE semq;
+	_Atomic int64_t sum;
+	_Atomic int64_t count;
+}BENCHSHM;
+
+static BENCHSHM *shm;
+static int use_sem;
+
+static void sem_push(SEMQUEUE *q, const WORKITEM *item)
+{
+	sem_wait(&q->free_slots);
+	sem_wait(&q->mutex);
+	q->slot[q->tail++ & (QUEUE_SLOTS - 1)] = *item;
+	sem_post(&q->mutex);
+	sem_post(&q->full_slots);
+}
+
+static void sem_pop(SEMQUEUE *q, WORKITEM *item)
+{
+	sem_wait(&q->full_slots);
+	sem_wait(&q->mutex);
+	*item = q->slot[q->head++ & (QUEUE_SLOTS - 1)];
+	sem_post(&q->mutex);
+	sem_post(&q->free_slots);
+}
+
+static void push(const WORKITEM *item)
+{
+	if (use_sem)
+		sem_push(&shm->semq, item);
+	else
+		queue_push(&shm->queue, item);
+}
+
+static void writer(int id, long first, long last)
+{
+	WORKITEM item;
+	long i;
+
+	item.producer = id;
+	item.kind = 0;
+	for (i = first; i < last; i++)
+	{
+		item.value = i;
+		push(&item);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+static void reader(void)
+{
+	WORKITEM item;
+	int64_t sum = 0, count = 0;
+
+	for (;;)
+	{
+		if (use_sem)
+			sem_pop(&shm->semq, &item);
+		else
+			queue_pop(&shm->queue, &item);
+		if (KIND_STOP == item.kind)
+			break;
+		sum += item.value;
+		count++;
+	}
+	atomic_fetch_add(&shm->sum, sum);
+	atomic_fetch_add(&shm->count, count);
+	exit(EXIT_SUCCESS);
+}
+
+static void reset(void)
+{
+	memset(shm, 0, sizeof(BENCHSHM));
+	queue_init(&shm->queue);
+	if (-1 == sem_init(&shm->semq.mutex, 1, 1) ||
+		-1 == sem_init(&shm->semq.free_slots, 1, QUEUE_SLOTS) ||
+		-1 == sem_init(&shm->semq.full_slots, 1, 0))
+	{
+		perror(" sem_init ERROR: ");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* items per second for n writers and n readers, -1 on a wrong result */
+static double run(int n, long items)
+{
+	struct timespec start, end;
+	WORKITEM stop;
+	pid_t pid;
+	int index;
+
+	reset();
+	fflush(stdout);			// or the children print it again
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (index = 0; index < 2 * n; index++)
+	{
+		pid = fork();
+		if (-1 == pid)
+		{
+			perror(" fork ERROR: ");
+			exit(EXIT_FAILURE);
+		}
+		if (0 == pid)
+		{
+			if (index < n)
+				writer(index, items * index / n, items * (index + 1) / n);
+			reader();
+		}
+	}
+	// writers were forked first, reap them before stopping the readers
+	for (index = 0; index < n; index++)
+		wait(NULL);
+	memset(&stop, 0, sizeof(stop));
+	stop.kind = KIND_STOP;
+	for (index = 0; index < n; index++)
+		push(&stop);
+	for (index = 0; index < n; index++)
+		wait(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (items != atomic_load(&shm->count) ||
+		(int64_t)items * (items - 1) / 2 != atomic_load(&shm->sum))
+		return -1;
+	return items / ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int main(int argc, char **argv)
+{
+	long items = DEFAULT_ITEMS;
+	int max_procs = MAX_PROCS;
+	double futex_rate, sem_rate;
+	int n;
+
+	if (2 <= argc)
+		items = atol(argv[1]);
+	if (3 <= argc)
+		max_procs = atoi(argv[2]);
+	if (0 >= items || 0 >= max_procs || MAX_PROCS < max_procs)
+	{
+		fprintf(stdout, "usage: %s [items] [max processes per side, up to %d]\n", argv[0], MAX_PROCS);
+		exit(EXIT_FAILURE);
+	}
+
+	shm = mmap(NULL, sizeof(BENCHSHM), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == shm)
+	{
+		perror(" mmap ERROR: ");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stdout, "%ld items, %ld CPUs, queue of %d slots\n", items, sysconf(_SC_NPROCESSORS_ONLN), QUEUE_SLOTS);
+	fprintf(stdout, "%8s %8s %16s %16s\n", "writers", "readers", "futex items/s", "sem items/s");
+	for (n = 1; n <= max_procs; n *= 2)
+	{
+		use_sem = 0;
+		futex_rate = run(n, items);
+		use_sem = 1;
+		sem_rate = run(n, items);
+		if (0 > futex_rate || 0 > sem_rate)
+		{
+			fprintf(stdout, "%8d %8d lost or duplicated items (%s)\n", n, n, 0 > futex_rate ? "futex" : "sem");
+			exit(EXIT_FAILURE);
+		}
+		fprintf(stdout, "%8d %8d %16.0f %16.0f\n", n, n, futex_rate, sem_rate);
+	}
+	munmap(shm, sizeof(BENCHSHM));
+	exit(EXIT_SUCCESS);
+}
@@ -1,6 +1,8 @@
 /*
-	This program will create a Shared Memory Object and write interger values.
-	This values will be letter read by some other Shared Memory read program.
+	This program will create (or open) a Shared Memory work queue and write
+	integer work items into it. The items will be letter read by one or more
+	sharedMemoryReaderCounterInc programs; any number of writers and readers
+	may run at the same time. See shmqueue.h for the queue itself.
 */
 
 #include <stdio.h>
@@ -11,136 +13,63 @@
 #include <sys/stat.h>        /* For mode constants */
 #include <fcntl.h>           /* For O_* constants */
 #include <unistd.h>
-#include <semaphore.h>
 
-#define SHMOBJ_LEN 256
+#include "shmqueue.h"
 
-
-typedef struct shmstruct
-{
-	int count;
-}SHMSTRUCT;
-sem_t * sem_mutex;			// for semaphore lock
+#define DEFAULT_ITEMS 5
 
 
 int main(int argc, char **argv)
 {
 	// variable declaration - start
-	int shm_fd = -1;
-	int ret_val = 0;
-	//int index = 0;
-	
-	struct stat shmfd_strct;
-	SHMSTRUCT *cnt_ptr;
+	int index = 0;
+	int items = DEFAULT_ITEMS;
+
+	SHMQUEUE *queue_ptr;
+	WORKITEM item;
+	pid_t pid = 0;
 	// variable declaration - end
 
-	//fprintf(stdout, "Inside main\n");
-	if(3 != argc)
+	if(2 != argc && 3 != argc)
 	{
 		fprintf(stdout, "Wrong no of arguments\n");
-		fprintf(stdout, "After exe give one shared memory argument path and one semaphore lock\n");
-		exit(EXIT_FAILURE);
-	}
-	
-
-	// function to open a shared memory object descriptor using shm_open()
-	shm_fd = shm_open(argv[1], O_CREAT|O_RDWR, S_IRWXU);
-	if(-1 == shm_fd)
-	{
-		fprintf(stdout, "Unable to create shared memory object descriptor\n");
-		perror(" ERROR: ");
-		exit(EXIT_FAILURE);
-	}
-
-	
-	// update the length of shared memory object
-	ret_val = ftruncate(shm_fd, sizeof(shm_fd));
-	if(-1 == ret_val)
-	{
-		fprintf(stdout, "Unable to update shared memory object lenghth\n");
-		perror(" ERROR: ");
-		exit(EXIT_FAILURE);
-	}
-
-
-	// get info of shared memory object (st_mode, st_size, st_uid, st_gid)
-	shmfd_strct.st_mode = 0;	shmfd_strct.st_uid = 0;
-	shmfd_strct.st_size = 0;	shmfd_strct.st_gid = 0;
-	
-	ret_val = fstat(shm_fd, &shmfd_strct);
-	if(-1 == ret_val)
-	{
-		fprintf(stdout, "Unable to get info of shared memory object\n");
-		perror(" ERROR: ");
-		exit(EXIT_FAILURE);
-	}
-		
-	
-
-	// map the descriptor to shared memory
-	//cnt_ptr = (struct shmstruct *)mmap(NULL, 256, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-	cnt_ptr = (SHMSTRUCT *)mmap(NULL, shmfd_strct.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-	if(MAP_FAILED == cnt_ptr)
-	{
-		fprintf(stdout, "Unable to map shared memory object \n");
-		perror(" ERROR: ");
+		fprintf(stdout, "After exe give one shared memory argument path and optionally the number of items\n");
 		exit(EXIT_FAILURE);
 	}
+	if(3 == argc)
+		items = atoi(argv[2]);
 
-	fprintf(stdout, "cnt_ptr: %p\n", cnt_ptr);
 
-	// after call to mmap descriptor may be closed
-	ret_val = close(shm_fd);
-	if(-1 == ret_val)
+	// open the queue, the first writer or reader creates it
+	queue_ptr = queue_map(argv[1]);
+	if(NULL == queue_ptr)
 	{
-		fprintf(stdout, "Unable to close descriptor\n");
+		fprintf(stdout, "Unable to map shared memory queue\n");
 		perror(" ERROR: ");
 		exit(EXIT_FAILURE);
 	}
+	fprintf(stdout, "queue_ptr: %p\n", queue_ptr);
 
 
-	// open and close semaphore
-	sem_mutex = sem_open(argv[2], O_CREAT | O_RDWR, S_IRWXU, 1);
-	if(SEM_FAILED == sem_mutex)
-	{
-		fprintf(stdout, "Unable to open semaphore\n");
-		perror(" ERROR: ");
-		exit(EXIT_FAILURE);
-	}
-	
-	fprintf(stdout, "Inside semaphore server\n");
-
-	ret_val = sem_close(sem_mutex);
-	if(-1 == ret_val)
+	// no lock around the queue, a full queue puts the writer to sleep
+	pid = getpid();
+	item.producer = (int32_t)pid;
+	item.kind = 0;
+	for (index = 0; index < items; index++)
 	{
-		fprintf(stdout, "Unable to close semaphore\n");
-		perror(" ERROR: ");
-		exit(EXIT_FAILURE);
+		item.value = index;
+		queue_push(queue_ptr, &item);
+		fprintf(stdout, "PID: %ld item: %d\n", (long)pid, index);
 	}
 
 
 	// remove maping of shared memory object
-	ret_val = munmap(NULL, shmfd_strct.st_size);
-	if(-1 == ret_val)
-	{
-		fprintf(stdout, "Unable to unmap shared memory object\n");
-		perror(" ERROR: ");
-		exit(EXIT_FAILURE);
-	}
+	queue_unmap(queue_ptr);
 
-/*	
-UNLINK AFTER READING	 
-	ret_val = shm_unlink(argv[1]);
-	if(-1 == ret_val)
-	{
-		fprintf(stdout, "Unable to unlink shared memory object\n");
-		perror(" ERROR: ");
-		exit(EXIT_FAILURE);
-	}
-	
-	
+/*
+UNLINK AFTER READING, the readers remove the queue
 */
-	cnt_ptr = NULL;
+	queue_ptr = NULL;
 	fprintf(stdout, "\n");
 	exit(EXIT_SUCCESS);
 
@@ -149,4 +78,4 @@ UNLINK AFTER READING
 
 /*******************
 		END OF FILE
-********************/
\ No newline at end of file
+********************/
@@ -0,0 +1,132 @@
+/*
+	Counters shared between processes, without the global semaphore the
+	old SHMSTRUCT { int count; } needed around every count++.
+
+	COUNTER_ATOMIC  one atomic fetch_add on a counter alone on its cache
+	                line; reads are one load, every increment moves the
+	                line to the incrementing CPU
+	COUNTER_SHARDED each process claims a slot of its own and adds to it,
+	                the line stays in its cache; a read sums all slots
+	                and is only as exact as the moment it passes each one
+
+	Slots are handed out round robin, so past COUNTER_SHARDS processes
+	two may share one; their adds stay atomic and only slow down.
+*/
+
+#ifndef SHMCOUNTER_H
+#define SHMCOUNTER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define COUNTER_SHARDS	64
+#define COUNTER_ATOMIC	0
+#define COUNTER_SHARDED	1
+#define COUNTER_WAIT_MS	1000		/* for the creator to size the object */
+#ifndef CACHE_LINE
+#define CACHE_LINE	64
+#endif
+
+typedef struct countershard
+{
+	_Atomic int64_t value;
+	char pad[CACHE_LINE - sizeof(int64_t)];
+}COUNTERSHARD;
+
+typedef struct shmcounter
+{
+	COUNTERSHARD total;			/* COUNTER_ATOMIC */
+	_Atomic uint32_t next_shard;
+	char pad[CACHE_LINE - sizeof(uint32_t)];
+	COUNTERSHARD shard[COUNTER_SHARDS];	/* COUNTER_SHARDED */
+}SHMCOUNTER;
+
+/*
+	map the counter object, creating it at zero if it does not exist
+	yet; returns NULL with errno set on failure, ETIMEDOUT when an object
+	someone else created never reaches its size
+*/
+static inline SHMCOUNTER *counter_map(const char *name)
+{
+	SHMCOUNTER *c;
+	struct stat st;
+	int fd, created = 1, waited = 0;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (-1 == fd && EEXIST == errno)
+	{
+		created = 0;
+		fd = shm_open(name, O_RDWR, 0);
+	}
+	if (-1 == fd)
+		return NULL;
+	/* a new object reads as zeroes, nothing else to set up */
+	if (created && -1 == ftruncate(fd, sizeof(SHMCOUNTER)))
+	{
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	/* mapped before the creator's ftruncate() the first touch is SIGBUS */
+	while (!created)
+	{
+		if (-1 == fstat(fd, &st))
+		{
+			close(fd);
+			return NULL;
+		}
+		if ((off_t)sizeof(SHMCOUNTER) <= st.st_size)
+			break;
+		if (COUNTER_WAIT_MS <= waited++)
+		{
+			close(fd);
+			errno = ETIMEDOUT;
+			return NULL;
+		}
+		usleep(1000);
+	}
+	c = mmap(NULL, sizeof(SHMCOUNTER), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	return MAP_FAILED == c ? NULL : c;
+}
+
+static inline void counter_unmap(SHMCOUNTER *c)
+{
+	munmap(c, sizeof(SHMCOUNTER));
+}
+
+/* the slot this process adds to in COUNTER_SHARDED mode, claim it once */
+static inline COUNTERSHARD *counter_shard(SHMCOUNTER *c)
+{
+	return &c->shard[atomic_fetch_add_explicit(&c->next_shard, 1, memory_order_relaxed) % COUNTER_SHARDS];
+}
+
+static inline void counter_add(SHMCOUNTER *c, int64_t n)
+{
+	atomic_fetch_add_explicit(&c->total.value, n, memory_order_relaxed);
+}
+
+static inline void counter_shard_add(COUNTERSHARD *s, int64_t n)
+{
+	atomic_fetch_add_explicit(&s->value, n, memory_order_relaxed);
+}
+
+/* the count in the given mode */
+static inline int64_t counter_read(SHMCOUNTER *c, int mode)
+{
+	int64_t sum = 0;
+	int i;
+
+	if (COUNTER_ATOMIC == mode)
+		return atomic_load_explicit(&c->total.value, memory_order_relaxed);
+	for (i = 0; i < COUNTER_SHARDS; i++)
+		sum += atomic_load_explicit(&c->shard[i].value, memory_order_relaxed);
+	return sum;
+}
+
+#endif
@@ -0,0 +1,275 @@
+/*
+	Bounded multi producer / multi consumer queue of work items in shared
+	memory, for any number of writer and reader processes.
+
+	Every slot carries a sequence number that says whose turn it is:
+	seq == pos      free, a producer at position pos may fill it
+	seq == pos + 1  full, a consumer at position pos may empty it
+	A producer claims pos by a compare and swap on enqueue_pos, copies the
+	item and publishes it with seq = pos + 1; the consumer that empties
+	it hands it back to the next round with seq = pos + QUEUE_SLOTS. The
+	two positions sit on cache lines of their own. No lock is held; a
+	producer descheduled between claim and publish only keeps consumers
+	waiting for that one slot, other producers carry on.
+
+	A consumer that finds the queue empty raises reader_waiting, reads
+	the items event count and tries once more before sleeping in futex()
+	on that count. A producer that finds the flag up clears it, bumps the
+	count and wakes every sleeper; woken consumers that find nothing raise
+	the flag again. A burst of items costs one wakeup instead of one per
+	item. Producers wait for space the same way on the space event count.
+*/
+
+#ifndef SHMQUEUE_H
+#define SHMQUEUE_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define QUEUE_SLOTS	1024			/* power of two */
+#define QUEUE_SPIN	100			/* retries before sleeping, SMP only */
+#define QUEUE_READY	0x51554555u
+#define QUEUE_WAIT_MS	1000			/* for the creator to size the object */
+#ifndef CACHE_LINE
+#define CACHE_LINE	64
+#endif
+
+typedef struct workitem
+{
+	int64_t value;
+	int32_t producer;
+	int32_t kind;
+}WORKITEM;
+
+typedef struct queueslot
+{
+	_Atomic uint32_t seq;
+	uint32_t pad;
+	WORKITEM item;
+}QUEUESLOT;
+
+typedef struct shmqueue
+{
+	_Atomic uint32_t ready;			/* QUEUE_READY once the slots are numbered */
+	char pad0[CACHE_LINE - sizeof(uint32_t)];
+	_Atomic uint32_t enqueue_pos;
+	char pad1[CACHE_LINE - sizeof(uint32_t)];
+	_Atomic uint32_t dequeue_pos;
+	char pad2[CACHE_LINE - sizeof(uint32_t)];
+	_Atomic uint32_t items;			/* futex words, event counts */
+	_Atomic uint32_t reader_waiting;
+	char pad3[CACHE_LINE - 2 * sizeof(uint32_t)];
+	_Atomic uint32_t space;
+	_Atomic uint32_t writer_waiting;
+	char pad4[CACHE_LINE - 2 * sizeof(uint32_t)];
+	QUEUESLOT slot[QUEUE_SLOTS];
+}SHMQUEUE;
+
+static int queue_spin = -1;
+
+/* slot i is free for position i; the memory must be zeroed */
+static inline void queue_init(SHMQUEUE *q)
+{
+	uint32_t i;
+
+	if (-1 == queue_spin)
+		queue_spin = 1 < sysconf(_SC_NPROCESSORS_ONLN) ? QUEUE_SPIN : 0;
+	for (i = 0; i < QUEUE_SLOTS; i++)
+		atomic_store_explicit(&q->slot[i].seq, i, memory_order_relaxed);
+	atomic_store_explicit(&q->ready, QUEUE_READY, memory_order_release);
+}
+
+/*
+	map the queue object, creating and numbering it if it does not exist
+	yet; returns NULL with errno set on failure, ETIMEDOUT when an object
+	someone else created never reaches its size
+*/
+static inline SHMQUEUE *queue_map(const char *name)
+{
+	SHMQUEUE *q;
+	struct stat st;
+	int fd, created = 1, waited = 0;
+
+	if (-1 == queue_spin)
+		queue_spin = 1 < sysconf(_SC_NPROCESSORS_ONLN) ? QUEUE_SPIN : 0;
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	if (-1 == fd && EEXIST == errno)
+	{
+		created = 0;
+		fd = shm_open(name, O_RDWR, 0);
+	}
+	if (-1 == fd)
+		return NULL;
+	if (created && -1 == ftruncate(fd, sizeof(SHMQUEUE)))
+	{
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	/* mapped before the creator's ftruncate() the first touch is SIGBUS */
+	while (!created)
+	{
+		if (-1 == fstat(fd, &st))
+		{
+			close(fd);
+			return NULL;
+		}
+		if ((off_t)sizeof(SHMQUEUE) <= st.st_size)
+			break;
+		if (QUEUE_WAIT_MS <= waited++)
+		{
+			close(fd);
+			errno = ETIMEDOUT;
+			return NULL;
+		}
+		usleep(1000);
+	}
+	q = mmap(NULL, sizeof(SHMQUEUE), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == q)
+		return NULL;
+	if (created)
+		queue_init(q);
+	else
+		/* the creator may still be numbering the slots */
+		while (QUEUE_READY != atomic_load_explicit(&q->ready, memory_order_acquire))
+			usleep(1000);
+	return q;
+}
+
+static inline void queue_unmap(SHMQUEUE *q)
+{
+	munmap(q, sizeof(SHMQUEUE));
+}
+
+static inline void queue_wake(_Atomic uint32_t *waiting, _Atomic uint32_t *event)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(waiting, memory_order_relaxed) && atomic_exchange(waiting, 0))
+	{
+		atomic_fetch_add(event, 1);
+		syscall(SYS_futex, event, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+/* 0 when the item went in, -1 when the queue is full */
+static inline int queue_try_push(SHMQUEUE *q, const WORKITEM *item)
+{
+	QUEUESLOT *s;
+	uint32_t pos, seq;
+	int32_t dif;
+
+	pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+	for (;;)
+	{
+		s = &q->slot[pos & (QUEUE_SLOTS - 1)];
+		seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+		dif = (int32_t)(seq - pos);
+		if (0 == dif)
+		{
+			if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (0 > dif)
+			return -1;
+		else
+			pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+	}
+	s->item = *item;
+	atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+	queue_wake(&q->reader_waiting, &q->items);
+	return 0;
+}
+
+/* 0 when an item came out, -1 when the queue is empty */
+static inline int queue_try_pop(SHMQUEUE *q, WORKITEM *item)
+{
+	QUEUESLOT *s;
+	uint32_t pos, seq;
+	int32_t dif;
+
+	pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+	for (;;)
+	{
+		s = &q->slot[pos & (QUEUE_SLOTS - 1)];
+		seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+		dif = (int32_t)(seq - (pos + 1));
+		if (0 == dif)
+		{
+			if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (0 > dif)
+			return -1;
+		else
+			pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+	}
+	*item = s->item;
+	atomic_store_explicit(&s->seq, pos + QUEUE_SLOTS, memory_order_release);
+	queue_wake(&q->writer_waiting, &q->space);
+	return 0;
+}
+
+/*
+	raise the flag before the last try, then sleep unless the event count
+	moved; the fence pairs with the one in queue_wake()
+*/
+static inline uint32_t queue_register(_Atomic uint32_t *waiting, _Atomic uint32_t *event)
+{
+	atomic_store_explicit(waiting, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	return atomic_load(event);
+}
+
+static inline void queue_sleep(_Atomic uint32_t *event, uint32_t seen)
+{
+	syscall(SYS_futex, event, FUTEX_WAIT, seen, NULL, NULL, 0);
+}
+
+/* blocks while the queue is full */
+static inline void queue_push(SHMQUEUE *q, const WORKITEM *item)
+{
+	uint32_t seen;
+	int spin = 0;
+
+	while (-1 == queue_try_push(q, item))
+	{
+		if (spin++ < queue_spin)
+			continue;
+		seen = queue_register(&q->writer_waiting, &q->space);
+		if (-1 != queue_try_push(q, item))
+			return;
+		queue_sleep(&q->space, seen);
+		spin = 0;
+	}
+}
+
+/* blocks while the queue is empty */
+static inline void queue_pop(SHMQUEUE *q, WORKITEM *item)
+{
+	uint32_t seen;
+	int spin = 0;
+
+	while (-1 == queue_try_pop(q, item))
+	{
+		if (spin++ < queue_spin)
+			continue;
+		seen = queue_register(&q->reader_waiting, &q->items);
+		if (-1 != queue_try_pop(q, item))
+			return;
+		queue_sleep(&q->items, seen);
+		spin = 0;
+	}
+}
+
+#endif
@@ -0,0 +1,195 @@
+/*
+	Single producer / single consumer ring of variable length records in a
+	shm_open() segment, an alternative to the POSIX message queue of
+	msgsender.c / msgreceiver.c.
+
+	head is where the producer writes next, tail where the consumer reads
+	next. Both run free as 32 bit byte counts and live on cache lines of
+	their own, so the two processes only share the line they hand over.
+	A record is a 4 byte length and the payload, rounded up to 8 bytes.
+	One that would run past the end of the buffer leaves a RING_WRAP
+	marker and starts again at offset 0.
+
+	Nothing here is a system call while data flows. A side that finds
+	the ring empty (or full) raises its waiting flag and sleeps in
+	futex() on the index the other side moves; the other side wakes it
+	only when the flag is up. Flag and index are each written before the
+	other one is read (a full fence on both sides), so a wakeup cannot be
+	lost between the check and the sleep.
+*/
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stdint.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define RING_NAME	"/ring00001"
+#define RING_BYTES	(1 << 20)		/* power of two */
+#define RING_MAX_RECORD	(RING_BYTES / 4)
+#define RING_WRAP	0xFFFFFFFFu
+#define RING_SPIN	2000			/* polls before sleeping, SMP only */
+#define CACHE_LINE	64
+
+typedef struct shmring
+{
+	_Atomic uint32_t head;
+	char pad1[CACHE_LINE - sizeof(uint32_t)];
+	_Atomic uint32_t tail;
+	char pad2[CACHE_LINE - sizeof(uint32_t)];
+	_Atomic uint32_t reader_waiting;
+	char pad3[CACHE_LINE - sizeof(uint32_t)];
+	_Atomic uint32_t writer_waiting;
+	char pad4[CACHE_LINE - sizeof(uint32_t)];
+	char data[RING_BYTES];
+}SHMRING;
+
+static int ring_spin = -1;
+
+static inline uint32_t ring_record(uint32_t len)
+{
+	return (sizeof(uint32_t) + len + 7) & ~7u;
+}
+
+static inline void ring_wait(_Atomic uint32_t *word, uint32_t seen)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT, seen, NULL, NULL, 0);
+}
+
+static inline void ring_wake(_Atomic uint32_t *flag, _Atomic uint32_t *word)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(flag, memory_order_relaxed))
+	{
+		atomic_store_explicit(flag, 0, memory_order_relaxed);
+		syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+}
+
+/*
+	map the ring, creating it when create is set;
+	returns NULL with errno set on failure
+*/
+static inline SHMRING *ring_map(const char *name, int create)
+{
+	SHMRING *ring;
+	int fd;
+
+	if (-1 == ring_spin)
+		ring_spin = 1 < sysconf(_SC_NPROCESSORS_ONLN) ? RING_SPIN : 0;
+	if (create)
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+	else
+		fd = shm_open(name, O_RDWR, 0);
+	if (-1 == fd)
+		return NULL;
+	if (create && -1 == ftruncate(fd, sizeof(SHMRING)))
+	{
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	/* a fresh object is all zeroes: empty ring, nobody waiting */
+	ring = mmap(NULL, sizeof(SHMRING), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (MAP_FAILED == ring)
+	{
+		if (create)
+			shm_unlink(name);
+		return NULL;
+	}
+	return ring;
+}
+
+static inline void ring_unmap(SHMRING *ring)
+{
+	munmap(ring, sizeof(SHMRING));
+}
+
+/* producer side, blocks while the ring is full; -1 and EMSGSIZE if len is too long */
+static inline int ring_send(SHMRING *ring, const void *buf, uint32_t len)
+{
+	uint32_t head, tail, off, room, need, total;
+	int spin = 0;
+
+	if (RING_MAX_RECORD < len)
+	{
+		errno = EMSGSIZE;
+		return -1;
+	}
+	need = ring_record(len);
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	off = head & (RING_BYTES - 1);
+	room = RING_BYTES - off;
+	total = room < need ? room + need : need;
+	for (;;)
+	{
+		tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+		if (RING_BYTES - (head - tail) >= total)
+			break;
+		if (spin++ < ring_spin)
+			continue;
+		atomic_store_explicit(&ring->writer_waiting, 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (tail == atomic_load_explicit(&ring->tail, memory_order_relaxed))
+			ring_wait(&ring->tail, tail);
+		spin = 0;
+	}
+	if (room < need)
+	{
+		*(uint32_t *)(ring->data + off) = RING_WRAP;
+		head += room;
+		off = 0;
+	}
+	*(uint32_t *)(ring->data + off) = len;
+	memcpy(ring->data + off + sizeof(uint32_t), buf, len);
+	atomic_store_explicit(&ring->head, head + need, memory_order_release);
+	ring_wake(&ring->reader_waiting, &ring->head);
+	return 0;
+}
+
+/*
+	consumer side, blocks while the ring is empty; returns the record
+	length, the record is cut to max bytes
+*/
+static inline uint32_t ring_receive(SHMRING *ring, void *buf, uint32_t max)
+{
+	uint32_t head, tail, off, len;
+	int spin = 0;
+
+	tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	for (;;)
+	{
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		if (head != tail)
+		{
+			off = tail & (RING_BYTES - 1);
+			len = *(uint32_t *)(ring->data + off);
+			if (RING_WRAP != len)
+				break;
+			tail += RING_BYTES - off;
+			continue;
+		}
+		if (spin++ < ring_spin)
+			continue;
+		atomic_store_explicit(&ring->reader_waiting, 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (head == atomic_load_explicit(&ring->head, memory_order_relaxed))
+			ring_wait(&ring->head, head);
+		spin = 0;
+	}
+	memcpy(buf, ring->data + off + sizeof(uint32_t), len < max ? len : max);
+	atomic_store_explicit(&ring->tail, tail + ring_record(len), memory_order_release);
+	ring_wake(&ring->writer_waiting, &ring->tail);
+	return len;
+}
+
+#endif
@@ -0,0 +1,202 @@
+/*
+    System V message queue cost of three ways to send short lines:
+
+    struct  msgsnd(sizeof(samplemsgbuf)) for every message, as the old
+            sysVmsgsender.c did (mtype counted in, however short the text)
+    exact   one msgsnd() per message with only its length
+    packed  sysVmsgpack.h, as many messages per msgsnd() as fit
+
+    rate    a forked receiver takes COUNT messages, msgs/sec is measured
+            from the first msgsnd() to the receiver's exit
+    depth   with nobody receiving, how many messages the queue takes
+            (IPC_NOWAIT until EAGAIN) against its msg_qbytes
+
+    usage : sysVmsgBench [count]
+    build : gcc -O2 sysVmsgBench.c -o sysVmsgBench
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/wait.h>
+
+#include "sysVmsgheader.h"
+#include "sysVmsgpack.h"
+
+#define DEFAULT_COUNT   200000
+#define MODE_STRUCT     0
+#define MODE_EXACT      1
+#define MODE_PACKED     2
+
+static const char *names[] = { "struct", "exact", "packed" };
+static const int sizes[] = { 16, 64, 200 };
+
+/* the old layout plus room for the sizeof(mtype) bytes msgsnd() read past mtext */
+typedef struct oldmsgbuf {
+    samplemsgbuf msg;
+    char overrun[sizeof(long)];
+} oldmsgbuf;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* one message of size bytes; -1 and EAGAIN when IPC_NOWAIT finds no room */
+static int send_one(int mode, int msqid, msgpack *pack, oldmsgbuf *old, const char *text, int size)
+{
+    if (MODE_PACKED == mode)
+        return msgpack_put(pack, text, size);
+    memcpy(old->msg.mtext, text, size);
+    return msgsnd(msqid, &old->msg, MODE_STRUCT == mode ? sizeof(samplemsgbuf) : (size_t)size, pack->flags);
+}
+
+static void receiver(int mode, int msqid, long count)
+{
+    msgpack pack;
+    oldmsgbuf old;
+    const char *text;
+    long i;
+
+    msgpack_init(&pack, msqid, TYPE2_MSG, 0);
+    for (i = 0; i < count; i++)
+        if (-1 == (MODE_PACKED == mode ? msgpack_next(&pack, TYPE2_MSG, &text) :
+            msgrcv(msqid, &old.msg, sizeof(old) - sizeof(long), TYPE2_MSG, 0)))
+        {
+            perror("msgrcv");
+            _exit(EXIT_FAILURE);
+        }
+    _exit(EXIT_SUCCESS);
+}
+
+static double rate(int mode, int msqid, int size, long count)
+{
+    msgpack pack;
+    oldmsgbuf old;
+    char text[MSGSIZE];
+    long long start;
+    pid_t pid;
+    int status;
+    long i;
+
+    memset(text, 'x', sizeof(text));
+    msgpack_init(&pack, msqid, TYPE2_MSG, 0);
+    old.msg.mtype = TYPE2_MSG;
+    fflush(stdout);
+    pid = fork();
+    if (-1 == pid)
+    {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (0 == pid)
+        receiver(mode, msqid, count);
+    start = now_ns();
+    for (i = 0; i < count; i++)
+        if (-1 == send_one(mode, msqid, &pack, &old, text, size))
+        {
+            perror("msgsnd");
+            exit(EXIT_FAILURE);
+        }
+    /* a real sender flushes when its input runs dry, this one at the end */
+    if (-1 == msgpack_flush(&pack))
+    {
+        perror("msgsnd");
+        exit(EXIT_FAILURE);
+    }
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || EXIT_SUCCESS != WEXITSTATUS(status))
+        exit(EXIT_FAILURE);
+    return count / ((now_ns() - start) / 1e9);
+}
+
+/* messages held by the queue when it refuses more, then drained */
+static long depth(int mode, int msqid, int size)
+{
+    msgpack pack;
+    oldmsgbuf old;
+    char text[MSGSIZE];
+    long held = 0, packed = 0;
+
+    memset(text, 'x', sizeof(text));
+    msgpack_init(&pack, msqid, TYPE2_MSG, IPC_NOWAIT);
+    old.msg.mtype = TYPE2_MSG;
+    for (;;)
+    {
+        if (MODE_PACKED == mode)
+        {
+            /* a full pack goes out inside the put, count what it carried */
+            if (MSGPACK_BYTES < pack.used + MSGPACK_RECORD + size)
+            {
+                if (-1 == msgpack_flush(&pack))
+                    break;
+                held += packed;
+                packed = 0;
+            }
+            msgpack_put(&pack, text, size);
+            packed++;
+            continue;
+        }
+        if (-1 == send_one(mode, msqid, &pack, &old, text, size))
+            break;
+        held++;
+    }
+    if (EAGAIN != errno)
+        perror("msgsnd");
+    while (-1 != msgrcv(msqid, &pack.buf, MSGPACK_BYTES, 0, IPC_NOWAIT))
+        ;
+    return held;
+}
+
+int main(int argc, char *argv[])
+{
+    struct msqid_ds ds;
+    long count = DEFAULT_COUNT;
+    double r[3];
+    long d[3];
+    int msqid, s, mode;
+
+    if (2 <= argc)
+        count = atol(argv[1]);
+    if (0 >= count)
+    {
+        printf("usage: %s [count]\n", argv[0]);
+        exit(-1);
+    }
+    if ((msqid = msgget(IPC_PRIVATE, 0600 | IPC_CREAT)) == -1)
+    {
+        perror("msgget");
+        exit(-1);
+    }
+    msgctl(msqid, IPC_STAT, &ds);
+
+    printf("%ld messages, queue msg_qbytes %lu, pack %d bytes\n", count, (unsigned long)ds.msg_qbytes, MSGPACK_BYTES);
+    printf("%5s  %12s %12s %12s  %8s %8s %8s\n", "size", "struct/s", "exact/s", "packed/s",
+        "struct", "exact", "packed");
+    for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+    {
+        for (mode = MODE_STRUCT; mode <= MODE_PACKED; mode++)
+        {
+            r[mode] = rate(mode, msqid, sizes[s], count);
+            d[mode] = depth(mode, msqid, sizes[s]);
+        }
+        printf("%5d  %12.0f %12.0f %12.0f  %8ld %8ld %8ld\n", sizes[s], r[MODE_STRUCT], r[MODE_EXACT],
+            r[MODE_PACKED], d[MODE_STRUCT], d[MODE_EXACT], d[MODE_PACKED]);
+        fflush(stdout);
+    }
+    printf("msgs/sec, then messages queued before EAGAIN (%s, %s, %s)\n", names[0], names[1], names[2]);
+    if (msgctl(msqid, IPC_RMID, NULL) == -1)
+    {
+        perror("msgctl");
+        exit(-1);
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+    Variable length System V messages, several to one msgsnd().
+
+    msgsnd()'s size argument is the length of mtext alone, so a message
+    should cost the kernel only the bytes it uses; the old sender passed
+    sizeof(samplemsgbuf), mtype included, for every line however short.
+    Here each logical message is a record, a 2 byte length and the text,
+    and the records queued together travel in one pack:
+
+        mtype | len | text | len | text | ...
+
+    msgsnd() gets exactly the bytes of the records in the pack. A pack
+    goes out when the next record does not fit or on msgpack_flush();
+    the receiver takes one pack with msgrcv() and walks its records with
+    msgpack_next(). Fewer, fuller messages mean fewer system calls and
+    more logical messages before the queue's msg_qbytes is reached.
+*/
+
+#ifndef MSGPACK_H
+#define MSGPACK_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+
+#define MSGPACK_BYTES   8192            /* the default msgmax, the kernel refuses more */
+#define MSGPACK_RECORD  sizeof(uint16_t)
+
+typedef struct msgpackbuf {
+    long mtype;
+    char mtext[MSGPACK_BYTES];
+} msgpackbuf;
+
+typedef struct msgpack {
+    int         msqid;
+    int         flags;                  /* msgsnd() / msgrcv() flags, IPC_NOWAIT */
+    size_t      used;                   /* bytes of mtext filled, or read so far */
+    size_t      length;                 /* receiver: bytes in the pack */
+    msgpackbuf  buf;
+} msgpack;
+
+static inline void msgpack_init(msgpack *p, int msqid, long mtype, int flags)
+{
+    p->msqid = msqid;
+    p->flags = flags;
+    p->used = 0;
+    p->length = 0;
+    p->buf.mtype = mtype;
+}
+
+/* sends what is packed, exactly its length; 0 or -1 as msgsnd() */
+static inline int msgpack_flush(msgpack *p)
+{
+    if (0 == p->used)
+        return 0;
+    if (-1 == msgsnd(p->msqid, &p->buf, p->used, p->flags))
+        return -1;
+    p->used = 0;
+    return 0;
+}
+
+/*
+    appends one logical message, sending the pack first when it is full;
+    -1 with errno from msgsnd(), or EMSGSIZE if len can never fit
+*/
+static inline int msgpack_put(msgpack *p, const void *data, size_t len)
+{
+    uint16_t n = (uint16_t)len;
+
+    if (MSGPACK_BYTES - MSGPACK_RECORD < len)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (MSGPACK_BYTES < p->used + MSGPACK_RECORD + len && -1 == msgpack_flush(p))
+        return -1;
+    memcpy(p->buf.mtext + p->used, &n, MSGPACK_RECORD);
+    memcpy(p->buf.mtext + p->used + MSGPACK_RECORD, data, len);
+    p->used += MSGPACK_RECORD + len;
+    return 0;
+}
+
+/*
+    the next logical message of mtype, receiving a new pack when this one
+    is used up; returns its length with *data pointing into the pack,
+    -1 with errno from msgrcv(), or EBADMSG for a damaged pack
+*/
+static inline ssize_t msgpack_next(msgpack *p, long mtype, const char **data)
+{
+    ssize_t n;
+    uint16_t len;
+
+    while (p->used >= p->length)
+    {
+        n = msgrcv(p->msqid, &p->buf, MSGPACK_BYTES, mtype, p->flags);
+        if (-1 == n)
+            return -1;
+        p->used = 0;
+        p->length = n;
+    }
+    /* a length cut off at the end of the pack is as damaged as a long one */
+    if (p->length - p->used < MSGPACK_RECORD)
+    {
+        p->used = p->length;
+        errno = EBADMSG;
+        return -1;
+    }
+    memcpy(&len, p->buf.mtext + p->used, MSGPACK_RECORD);
+    if (p->length < p->used + MSGPACK_RECORD + len)
+    {
+        p->used = p->length;            /* not from msgpack_put(), drop the rest */
+        errno = EBADMSG;
+        return -1;
+    }
+    *data = p->buf.mtext + p->used + MSGPACK_RECORD;
+    p->used += MSGPACK_RECORD + len;
+    return len;
+}
+
+#endif
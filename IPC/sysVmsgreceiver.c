@@ -5,13 +5,13 @@
 #include <sys/ipc.h>
 #include <sys/msg.h>
 
-#include "msgheader.h"
-
-#define SIZE_OF_MSG (sizeof(samplemsgbuf))
+#include "sysVmsgheader.h"
+#include "sysVmsgpack.h"
 
 int main(void)
 {
-    samplemsgbuf   buf;
+    msgpack        pack;
+    const char     *text;
     int            msqid;
     key_t          key;
 	int count=0;
@@ -29,13 +29,15 @@ int main(void)
     
     printf("reciever: ready to receive messages.\n");
 
+    /* one msgrcv() brings every line the sender packed together */
+    msgpack_init(&pack, msqid, TYPE2_MSG, 0);
     for(;;) /* receiver quits only if the queue has been removed */
     {
-        /* Only a message of TYPE1 type can be retrieved*/ 
-	count =  msgrcv(msqid, (struct msgbuf *)&buf, SIZE_OF_MSG, TYPE2_MSG, 0);
-	if(count > 0)	  
+        /* Only a message of TYPE2 type can be retrieved*/ 
+	count =  msgpack_next(&pack, TYPE2_MSG, &text);
+	if(count >= 0)	  
         {
-    		printf("receiver: %d : \"%s\"\n", buf.mtype, buf.mtext);
+    		printf("receiver: %ld : \"%.*s\"\n", pack.buf.mtype, count, text);
         }
         else
         {
@@ -1,12 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
 
-#include "msgheader.h"
+#include "sysVmsgheader.h"
+#include "sysVmsgpack.h"
 
 
 //#define TYPE_SIZE  4
@@ -15,10 +17,12 @@
 int main(void)
 {
     int           msqid;
-    size_t        readchars = 0;
+    ssize_t       readchars = 0;
 //    char          mtype[TYPE_SIZE];
     key_t         key;
-    samplemsgbuf  mbuf;
+    char          input[MSGPACK_BYTES];
+    char          *line, *end;
+    msgpack       pack;
 
     if ((key = ftok(KEY_NAME, PROJ_ID_KEY)) == -1) 
     {
@@ -33,12 +37,26 @@ int main(void)
     
     printf("Enter data to be sent to receiver\n");
 
+    /*
+    every line is one message of its own length, without the '\n';
+    lines that arrive in one read (pasted, or piped in) go in one msgsnd
+    */
+    msgpack_init(&pack, msqid, TYPE2_MSG, 0);
     for(;;)
     {
-        readchars = read(0, mbuf.mtext, MSGSIZE-1);
-        mbuf.mtext[readchars-1] = '\0';
-        mbuf.mtype = TYPE2_MSG;
-        if (msgsnd(msqid, (struct msgbuf *)&mbuf, sizeof(mbuf), 0) == -1)
+        readchars = read(0, input, sizeof(input));
+        if (0 >= readchars)
+            return 0;               /* end of input, the queue stays for the receiver */
+        for (line = input; line < input + readchars; line = end + 1)
+        {
+            end = memchr(line, '\n', input + readchars - line);
+            if (NULL == end)
+                end = input + readchars;
+            /* no longer than the receiver can print */
+            if (msgpack_put(&pack, line, end - line < MSGSIZE - 1 ? end - line : MSGSIZE - 1) == -1)
+                break;
+        }
+        if (msgpack_flush(&pack) == -1)
         {
                 perror("msgsnd");
                 if (EIDRM == errno)
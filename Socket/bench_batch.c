@@ -0,0 +1,121 @@
+/*
+	Candidates per second of the batch primality kernel on random odd 64
+	bit numbers past the sieve, per instruction set:
+	is_prime     - one at a time, trial division by %
+	scalar       - prime_screen() with one multiply per prime and number
+	avx2         - the same four numbers at a time, when the CPU has it
+	"screen" times the trial division alone, "full" is_prime_batch()
+	with Miller-Rabin for the survivors. All results are compared.
+
+	usage : bench_batch [numbers] [rounds]
+*/
+
+#include"header.h"
+#include<time.h>
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* best of rounds, numbers per second */
+static double run(const uint64_t *n,int count,int rounds,unsigned char *out,int screen_only)
+{
+	long long t,best = 0;
+	int r;
+	for(r = 0;r < rounds;r++)
+	{
+		t = now_ns();
+		if(screen_only)
+			prime_screen(n,count,out);
+		else
+			is_prime_batch(n,count,out);
+		t = now_ns() - t;
+		if(0 == best || t < best)
+			best = t;
+	}
+	return count / (best / 1e9);
+}
+
+int main(int argc,char *argv[])
+{
+	uint64_t *n;
+	unsigned char *want,*scalar,*simd,*got;
+	uint64_t seed = 0x2545F4914F6CDD1DULL;
+	long long t,best = 0;
+	int count = 100000;
+	int rounds = 5;
+	int unknown = 0;
+	int i,r,bad = 0;
+	double screen_rate,full_rate;
+
+	if(2 <= argc)
+		count = atoi(argv[1]);
+	if(3 <= argc)
+		rounds = atoi(argv[2]);
+	if(0 >= count || 0 >= rounds)
+	{
+		printf("\nUsage : %s [numbers] [rounds]\n",argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	n = malloc(count * sizeof(uint64_t));
+	want = malloc(count);
+	scalar = malloc(count);
+	simd = malloc(count);
+	got = malloc(count);
+	if(NULL == n || NULL == want || NULL == scalar || NULL == simd || NULL == got)
+	{
+		perror("\nmalloc error");
+		exit(EXIT_FAILURE);
+	}
+	if(FAILURE == prime_init(SIEVE_LIMIT))
+		exit(EXIT_FAILURE);
+	for(i = 0;i < count;i++)
+		n[i] = xorshift(&seed) | SIEVE_LIMIT | 1;
+
+	for(r = 0;r < rounds;r++)
+	{
+		t = now_ns();
+		for(i = 0;i < count;i++)
+			want[i] = is_prime(n[i]);
+		t = now_ns() - t;
+		if(0 == best || t < best)
+			best = t;
+	}
+	printf("%d odd numbers past the sieve, best of %d\n",count,rounds);
+	printf("%-10s %16s %16s\n","","screen/s","full/s");
+	printf("%-10s %16s %16.0f\n","is_prime","-",count / (best / 1e9));
+
+	prime_simd(0);
+	screen_rate = run(n,count,rounds,scalar,1);
+	full_rate = run(n,count,rounds,got,0);
+	for(i = 0;i < count;i++)
+	{
+		unknown += PRIME_UNKNOWN == scalar[i];
+		bad += got[i] != want[i] || (PRIME_UNKNOWN != scalar[i] && scalar[i] != want[i]);
+	}
+	printf("%-10s %16.0f %16.0f\n","scalar",screen_rate,full_rate);
+
+	if(prime_simd(1))
+	{
+		screen_rate = run(n,count,rounds,simd,1);
+		full_rate = run(n,count,rounds,got,0);
+		for(i = 0;i < count;i++)
+			bad += got[i] != want[i] || simd[i] != scalar[i];
+		printf("%-10s %16.0f %16.0f\n","avx2",screen_rate,full_rate);
+	}
+	else
+		printf("%-10s %16s %16s\n","avx2","n/a","n/a");
+	printf("%.1f%% left to Miller-Rabin, %d mismatches\n",100.0 * unknown / count,bad);
+	return bad ? FAILURE : SUCCESS;
+}
@@ -0,0 +1,158 @@
+/*
+	Benchmark of the result cache under a Zipf distributed key stream.
+	Keys are random numbers above the sieve, so every miss runs
+	Miller-Rabin. Reports the hit rate, the mean cost per request with
+	and without the cache and the cost of a lookup on a hot key.
+
+	usage : bench_cache [threads] [distinct keys] [zipf exponent] [cache MB]
+*/
+
+#include"header.h"
+#include<math.h>
+#include<time.h>
+
+#define LOOKUPS 2000000		/* per thread */
+#define HOT_KEYS 1000		/* most popular keys, always cached */
+
+struct bench_thread
+{
+	pthread_t tid;
+	unsigned int seed;
+	int *ranks;
+	long long cached_ns;	/* Zipf stream through the cache */
+	long long plain_ns;	/* same stream straight to is_prime() */
+	long long hot_ns;	/* hot keys only, every lookup hits */
+};
+
+static uint64_t *keys;
+static double *cdf;
+static int nkeys;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* rank of a Zipf sample, binary search of the cumulative distribution */
+static int zipf_rank(unsigned int *seed)
+{
+	double u = rand_r(seed) / (RAND_MAX + 1.0);
+	int lo = 0,hi = nkeys - 1,mid;
+	while(lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if(cdf[mid] < u)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void *bench_main(void *arg)
+{
+	struct bench_thread *t = arg;
+	long long start;
+	int i;
+
+	for(i = 0;i < LOOKUPS;i++)
+		t->ranks[i] = zipf_rank(&t->seed);
+
+	start = now_ns();
+	for(i = 0;i < LOOKUPS;i++)
+		is_prime_cached(keys[t->ranks[i]]);
+	t->cached_ns = now_ns() - start;
+
+	start = now_ns();
+	for(i = 0;i < LOOKUPS;i++)
+		is_prime(keys[t->ranks[i]]);
+	t->plain_ns = now_ns() - start;
+
+	start = now_ns();
+	for(i = 0;i < LOOKUPS;i++)
+		is_prime_cached(keys[i % HOT_KEYS]);
+	t->hot_ns = now_ns() - start;
+	return NULL;
+}
+
+int main(int argc,char *argv[])
+{
+	struct bench_thread *threads;
+	double s = 0.99,sum = 0;
+	int nthreads = 1;
+	int mbytes = CACHE_MB;
+	uint64_t hits,misses,coalesced;
+	long long cached_ns = 0,plain_ns = 0,hot_ns = 0;
+	unsigned int seed = 1;
+	int i;
+
+	nkeys = 1000000;
+	if(2 <= argc)
+		nthreads = atoi(argv[1]);
+	if(3 <= argc)
+		nkeys = atoi(argv[2]);
+	if(4 <= argc)
+		s = atof(argv[3]);
+	if(5 <= argc)
+		mbytes = atoi(argv[4]);
+	if(0 >= nthreads || HOT_KEYS > nkeys || 0 >= mbytes)
+	{
+		printf("\nUsage : %s [threads] [distinct keys] [zipf exponent] [cache MB]\n",argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	keys = malloc(nkeys * sizeof(uint64_t));
+	cdf = malloc(nkeys * sizeof(double));
+	threads = calloc(nthreads,sizeof(struct bench_thread));
+	if(NULL == keys || NULL == cdf || NULL == threads)
+	{
+		perror("\nmalloc error");
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0;i < nkeys;i++)
+	{
+		keys[i] = (((uint64_t)rand_r(&seed) << 32) | rand_r(&seed)) | SIEVE_LIMIT;
+		sum += 1.0 / pow(i + 1,s);
+		cdf[i] = sum;
+	}
+	for(i = 0;i < nkeys;i++)
+		cdf[i] = cdf[i] / sum;
+
+	if(FAILURE == prime_init(SIEVE_LIMIT) || FAILURE == cache_init(mbytes))
+		exit(EXIT_FAILURE);
+
+	for(i = 0;i < nthreads;i++)
+	{
+		threads[i].seed = i + 1;
+		threads[i].ranks = malloc(LOOKUPS * sizeof(int));
+		if(NULL == threads[i].ranks)
+		{
+			perror("\nmalloc error");
+			exit(EXIT_FAILURE);
+		}
+		pthread_create(&threads[i].tid,NULL,bench_main,&threads[i]);
+	}
+	for(i = 0;i < nthreads;i++)
+	{
+		pthread_join(threads[i].tid,NULL);
+		cached_ns += threads[i].cached_ns;
+		plain_ns += threads[i].plain_ns;
+		hot_ns += threads[i].hot_ns;
+		free(threads[i].ranks);
+	}
+	cache_stats(&hits,&misses,&coalesced);
+	hits = hits - (uint64_t)nthreads * LOOKUPS;	/* the hot key pass */
+
+	printf("threads %d keys %d zipf %.2f cache %d MB\n",nthreads,nkeys,s,mbytes);
+	printf("hit rate        %.1f %%\n",100.0 * hits / (hits + misses));
+	printf("with cache      %.0f ns/op\n",(double)cached_ns / nthreads / LOOKUPS);
+	printf("without cache   %.0f ns/op\n",(double)plain_ns / nthreads / LOOKUPS);
+	printf("hot key hit     %.0f ns/op\n",(double)hot_ns / nthreads / LOOKUPS);
+
+	free(threads);
+	free(cdf);
+	free(keys);
+	return SUCCESS;
+}
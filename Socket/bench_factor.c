@@ -0,0 +1,98 @@
+/*
+	Benchmark of factor() over random semiprimes p * q, both factors of
+	the same bit length, which is the worst case for Pollard rho at a
+	given size: its run time grows with the root of the smaller factor.
+	Every answer is checked. The cost is also given in Miller-Rabin
+	tests of random 64 bit numbers, the unit of the pool's --offload.
+
+	usage : bench_factor [numbers per size]
+*/
+
+#include"header.h"
+#include<time.h>
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* a random prime of exactly bits bits */
+static uint64_t random_prime(uint64_t *seed,int bits)
+{
+	uint64_t n;
+	do
+		n = (xorshift(seed) >> (64 - bits)) | (1ULL << (bits - 1)) | 1;
+	while(!is_prime(n));
+	return n;
+}
+
+int main(int argc,char *argv[])
+{
+	static const int sizes[] = { 8, 12, 16, 20, 24, 28, 32 };
+	uint64_t factors[MAX_FACTORS];
+	uint64_t *p,*q;
+	uint64_t seed = 0x2545F4914F6CDD1DULL;
+	long long start,elapsed;
+	double mr_ns;
+	int count = 2000;
+	int bad,i,k,m;
+
+	if(2 <= argc)
+		count = atoi(argv[1]);
+	if(0 >= count)
+	{
+		printf("\nUsage : %s [numbers per size]\n",argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	p = malloc(count * sizeof(uint64_t));
+	q = malloc(count * sizeof(uint64_t));
+	if(NULL == p || NULL == q)
+	{
+		perror("\nmalloc error");
+		exit(EXIT_FAILURE);
+	}
+	if(FAILURE == prime_init(SIEVE_LIMIT) || FAILURE == factor_init())
+		exit(EXIT_FAILURE);
+
+	for(i = 0;i < count;i++)
+		p[i] = xorshift(&seed) | SIEVE_LIMIT;
+	start = now_ns();
+	for(i = 0;i < count;i++)
+		m = is_prime(p[i]);
+	mr_ns = (double)(now_ns() - start) / count;
+	printf("is_prime on random 64 bit numbers %.0f ns\n",mr_ns);
+	printf("%-14s %12s %12s %10s\n","factor bits","numbers/s","ns/number","MR tests");
+
+	for(k = 0;k < (int)(sizeof(sizes) / sizeof(sizes[0]));k++)
+	{
+		for(i = 0;i < count;i++)
+		{
+			p[i] = random_prime(&seed,sizes[k]);
+			q[i] = random_prime(&seed,sizes[k]);
+		}
+		bad = 0;
+		start = now_ns();
+		for(i = 0;i < count;i++)
+		{
+			m = factor(p[i] * q[i],factors);
+			if(2 != m || factors[0] != (p[i] < q[i] ? p[i] : q[i]) || factors[1] != (p[i] < q[i] ? q[i] : p[i]))
+				bad++;
+		}
+		elapsed = now_ns() - start;
+		printf("%2d x %-9d %12.0f %12.0f %10.1f%s\n",sizes[k],sizes[k],count / (elapsed / 1e9),
+			(double)elapsed / count,elapsed / mr_ns / count,bad ? "  WRONG" : "");
+	}
+	free(p);
+	free(q);
+	return SUCCESS;
+}
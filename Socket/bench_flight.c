@@ -0,0 +1,137 @@
+/*
+	Benchmark of single flight misses. Every thread asks for the same
+	number at the same moment, released together by a barrier, like a
+	burst of clients asking about one large prime. Keys are fresh primes
+	above the sieve so each burst starts on a miss and the test is the
+	slowest Miller-Rabin case. Reports the tests actually run per burst
+	and the CPU time, with and without coalescing.
+
+	usage : bench_flight [threads] [bursts]
+*/
+
+#include"header.h"
+#include<sys/resource.h>
+#include<time.h>
+
+struct bench_thread
+{
+	pthread_t tid;
+	uint64_t *keys;
+};
+
+static pthread_barrier_t burst;
+static int nbursts;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long cpu_ns(void)
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF,&ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000LL +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000LL;
+}
+
+static void *bench_main(void *arg)
+{
+	struct bench_thread *t = arg;
+	int i;
+	for(i = 0;i < nbursts;i++)
+	{
+		pthread_barrier_wait(&burst);
+		is_prime_cached(t->keys[i]);
+	}
+	return NULL;
+}
+
+/* nbursts primes above the sieve, none asked before */
+static void fresh_primes(uint64_t *keys,unsigned int *seed)
+{
+	uint64_t n;
+	int i;
+	for(i = 0;i < nbursts;i++)
+	{
+		do
+			n = (((uint64_t)rand_r(seed) << 33) ^ ((uint64_t)rand_r(seed) << 2) ^ rand_r(seed)) | SIEVE_LIMIT | 1;
+		while(!is_prime(n));
+		keys[i] = n;
+	}
+}
+
+static void run(struct bench_thread *threads,int nthreads,int on,unsigned int *seed)
+{
+	uint64_t hits,misses,coalesced,hits0,misses0,coalesced0;
+	long long wall,cpu;
+	int i;
+
+	fresh_primes(threads[0].keys,seed);
+	cache_coalesce(on);
+	cache_stats(&hits0,&misses0,&coalesced0);
+	wall = now_ns();
+	cpu = cpu_ns();
+	for(i = 0;i < nthreads;i++)
+		pthread_create(&threads[i].tid,NULL,bench_main,&threads[i]);
+	for(i = 0;i < nthreads;i++)
+		pthread_join(threads[i].tid,NULL);
+	cpu = cpu_ns() - cpu;
+	wall = now_ns() - wall;
+	cache_stats(&hits,&misses,&coalesced);
+	hits = hits - hits0;
+	misses = misses - misses0;
+	coalesced = coalesced - coalesced0;
+
+	printf("%-12s tests/burst %5.2f  hits %8llu  coalesced %8llu  cpu %6.1f ms  wall %6.1f ms\n",
+		on ? "coalesce" : "no coalesce",(double)(misses - coalesced) / nbursts,
+		(unsigned long long)hits,(unsigned long long)coalesced,cpu / 1e6,wall / 1e6);
+}
+
+int main(int argc,char *argv[])
+{
+	struct bench_thread *threads;
+	unsigned int seed = 1;
+	int nthreads = 8;
+	int i;
+
+	nbursts = 20000;
+	if(2 <= argc)
+		nthreads = atoi(argv[1]);
+	if(3 <= argc)
+		nbursts = atoi(argv[2]);
+	if(0 >= nthreads || 0 >= nbursts)
+	{
+		printf("\nUsage : %s [threads] [bursts]\n",argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	threads = calloc(nthreads,sizeof(struct bench_thread));
+	if(NULL == threads)
+	{
+		perror("\nmalloc error");
+		exit(EXIT_FAILURE);
+	}
+	threads[0].keys = malloc(nbursts * sizeof(uint64_t));
+	if(NULL == threads[0].keys)
+	{
+		perror("\nmalloc error");
+		exit(EXIT_FAILURE);
+	}
+	for(i = 1;i < nthreads;i++)
+		threads[i].keys = threads[0].keys;
+	if(FAILURE == prime_init(SIEVE_LIMIT) || FAILURE == cache_init(CACHE_MB))
+		exit(EXIT_FAILURE);
+	pthread_barrier_init(&burst,NULL,nthreads);
+
+	printf("threads %d bursts %d\n",nthreads,nbursts);
+	run(threads,nthreads,0,&seed);
+	run(threads,nthreads,1,&seed);
+
+	pthread_barrier_destroy(&burst);
+	free(threads[0].keys);
+	free(threads);
+	return SUCCESS;
+}
@@ -0,0 +1,240 @@
+/*
+	Throughput of the client library against a running server, compared
+	with the one round trip per number of my_client.c. Every thread keeps
+	--depth numbers outstanding: it submits them, then waits for all of
+	them, as an application checking a list would.
+
+	sync      - one connection per thread, write_check() and
+		    read_check_response() for every number
+	futures   - pclient_check() and pfuture_wait(), without and with
+		    the batching window
+	callbacks - pclient_check_cb(), the last callback of a round wakes
+		    the thread
+
+	usage : bench_pclient <server address> <port> [--threads N] [--conns N]
+		[--depth N] [--window US] [--duration SEC]
+*/
+
+#include"header.h"
+#include<time.h>
+
+struct bench_thread
+{
+	pthread_t tid;
+	uint64_t seed;
+	uint64_t done;			/* numbers answered */
+	uint64_t errors;
+	pthread_mutex_t lock;		/* callbacks of the round */
+	pthread_cond_t round;
+	int left;
+};
+
+enum mode
+{
+	MODE_SYNC,
+	MODE_FUTURES,
+	MODE_CALLBACKS
+};
+
+static const char *address;
+static int port;
+static int depth = 64;
+static long long end_ns;
+static enum mode mode;
+static struct pclient *pc;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t next_key(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return 2 + *s % 10000000;
+}
+
+static void *run_sync(struct bench_thread *t)
+{
+	struct sockaddr_in server;
+	unsigned char status;
+	int fd;
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	server.sin_addr.s_addr = inet_addr(address);
+	fd = socket(AF_INET,SOCK_STREAM,0);
+	if(ERR == fd || ERR == connect(fd,(struct sockaddr*)&server,sizeof(server)))
+	{
+		perror("\nConnect error");
+		exit(EXIT_FAILURE);
+	}
+	while(now_ns() < end_ns)
+	{
+		if(FAILURE == write_check(fd,next_key(&t->seed)) || FAILURE == read_check_response(fd,&status))
+		{
+			t->errors++;
+			break;
+		}
+		t->done++;
+	}
+	close(fd);
+	return NULL;
+}
+
+static void answered(void *arg,uint64_t n,int status)
+{
+	struct bench_thread *t = arg;
+	(void)n;
+	pthread_mutex_lock(&t->lock);
+	if(ERR == status)
+		t->errors++;
+	t->done++;
+	if(0 == --t->left)
+		pthread_cond_signal(&t->round);
+	pthread_mutex_unlock(&t->lock);
+}
+
+static void *bench_main(void *arg)
+{
+	struct bench_thread *t = arg;
+	struct pfuture **futures;
+	int i;
+
+	if(MODE_SYNC == mode)
+		return run_sync(t);
+	futures = malloc(depth * sizeof(struct pfuture *));
+	if(NULL == futures)
+	{
+		perror("\nmalloc error");
+		exit(EXIT_FAILURE);
+	}
+	while(now_ns() < end_ns)
+	{
+		if(MODE_CALLBACKS == mode)
+		{
+			t->left = depth;
+			for(i = 0;i < depth;i++)
+				if(FAILURE == pclient_check_cb(pc,next_key(&t->seed),answered,t))
+				{
+					printf("\npclient_check_cb error\n");
+					exit(EXIT_FAILURE);
+				}
+			pthread_mutex_lock(&t->lock);
+			while(0 != t->left)
+				pthread_cond_wait(&t->round,&t->lock);
+			pthread_mutex_unlock(&t->lock);
+			continue;
+		}
+		for(i = 0;i < depth;i++)
+		{
+			futures[i] = pclient_check(pc,next_key(&t->seed));
+			if(NULL == futures[i])
+			{
+				printf("\npclient_check error\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+		for(i = 0;i < depth;i++)
+		{
+			if(ERR == pfuture_wait(pc,futures[i]))
+				t->errors++;
+			t->done++;
+		}
+	}
+	free(futures);
+	return NULL;
+}
+
+static void run(const char *name,enum mode m,int nthreads,int conns,int window_us,int seconds)
+{
+	struct bench_thread *threads;
+	uint64_t done = 0,errors = 0;
+	long long start;
+	int i;
+
+	threads = calloc(nthreads,sizeof(struct bench_thread));
+	if(NULL == threads)
+	{
+		perror("\nmalloc error");
+		exit(EXIT_FAILURE);
+	}
+	mode = m;
+	if(MODE_SYNC != m)
+	{
+		pc = pclient_open(address,port,conns,window_us);
+		if(NULL == pc)
+		{
+			printf("\npclient_open error\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	start = now_ns();
+	end_ns = start + seconds * 1000000000LL;
+	for(i = 0;i < nthreads;i++)
+	{
+		threads[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+		pthread_mutex_init(&threads[i].lock,NULL);
+		pthread_cond_init(&threads[i].round,NULL);
+		pthread_create(&threads[i].tid,NULL,bench_main,&threads[i]);
+	}
+	for(i = 0;i < nthreads;i++)
+	{
+		pthread_join(threads[i].tid,NULL);
+		done += threads[i].done;
+		errors += threads[i].errors;
+	}
+	if(MODE_SYNC != m)
+		pclient_close(pc);
+	printf("%-22s %10.0f req/s  errors %llu\n",name,done / ((now_ns() - start) / 1e9),(unsigned long long)errors);
+	free(threads);
+}
+
+int main(int argc,char *argv[])
+{
+	char name[64];
+	int nthreads = 4;
+	int conns = 4;
+	int window_us = 100;
+	int seconds = 3;
+	int i;
+
+	if(3 > argc)
+	{
+		printf("\nUsage : %s <server address> <port> [--threads N] [--conns N]\n"
+			"\t[--depth N] [--window US] [--duration SEC]\n",argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	address = argv[1];
+	port = atoi(argv[2]);
+	for(i = 3;i + 1 < argc;i = i + 2)
+	{
+		if(0 == strcmp(argv[i],"--threads"))
+			nthreads = atoi(argv[i + 1]);
+		else if(0 == strcmp(argv[i],"--conns"))
+			conns = atoi(argv[i + 1]);
+		else if(0 == strcmp(argv[i],"--depth"))
+			depth = atoi(argv[i + 1]);
+		else if(0 == strcmp(argv[i],"--window"))
+			window_us = atoi(argv[i + 1]);
+		else if(0 == strcmp(argv[i],"--duration"))
+			seconds = atoi(argv[i + 1]);
+	}
+	if(0 >= nthreads || 0 >= conns || 0 >= depth || 0 > window_us || 0 >= seconds)
+	{
+		printf("\nInvalid arguments\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("threads %d conns %d depth %d\n",nthreads,conns,depth);
+	run("sync",MODE_SYNC,nthreads,conns,0,seconds);
+	run("futures window 0",MODE_FUTURES,nthreads,conns,0,seconds);
+	snprintf(name,sizeof(name),"futures window %dus",window_us);
+	run(name,MODE_FUTURES,nthreads,conns,window_us,seconds);
+	snprintf(name,sizeof(name),"callbacks window %dus",window_us);
+	run(name,MODE_CALLBACKS,nthreads,conns,window_us,seconds);
+	return SUCCESS;
+}
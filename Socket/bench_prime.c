@@ -0,0 +1,108 @@
+/*
+	Micro benchmark of the primality engine against the original
+	trial division check_prime() over several input ranges.
+
+	usage : bench_prime [numbers per range]
+*/
+
+#include"header.h"
+#include<time.h>
+
+/* the check_prime() loop this engine replaced */
+static int old_is_prime(int integer)
+{
+	int i,count = 0;
+	for(i = 2;i <= integer/2;i++)
+	{
+		if(integer%i == 0)
+			count++;
+	}
+	return count == 0;
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t rand64(void)
+{
+	return ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^ rand();
+}
+
+int main(int argc,char *argv[])
+{
+	static const struct { const char *name; uint64_t lo, hi; } ranges[] = {
+		{ "[2, 10^3)",		2,		1000ULL },
+		{ "[10^3, 10^5)",	1000ULL,	100000ULL },
+		{ "[10^5, 10^7)",	100000ULL,	10000000ULL },
+		{ "[10^7, 2^31)",	10000000ULL,	2147483647ULL },
+		{ "[2^31, 2^64)",	2147483648ULL,	UINT64_MAX },
+	};
+	uint64_t *nums;
+	long long t,old_ns,new_ns;
+	int count = 100000;
+	int old_done;
+	int found;
+	unsigned int r;
+	int i;
+
+	if(2 <= argc)
+		count = atoi(argv[1]);
+	if(0 >= count)
+	{
+		printf("\nUsage : %s [numbers per range]\n",argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	nums = malloc(count * sizeof(uint64_t));
+	if(NULL == nums)
+	{
+		perror("\nmalloc error");
+		exit(EXIT_FAILURE);
+	}
+
+	t = now_ns();
+	if(FAILURE == prime_init(SIEVE_LIMIT))
+		exit(EXIT_FAILURE);
+	printf("sieve below %llu built in %.1f ms\n\n",(unsigned long long)SIEVE_LIMIT,(now_ns() - t) / 1e6);
+	printf("%-14s %8s %14s %14s %10s\n","range","primes","old ns/op","new ns/op","speedup");
+
+	for(r = 0;r < sizeof(ranges) / sizeof(ranges[0]);r++)
+	{
+		for(i = 0;i < count;i++)
+			nums[i] = ranges[r].lo + rand64() % (ranges[r].hi - ranges[r].lo);
+
+		found = 0;
+		t = now_ns();
+		for(i = 0;i < count;i++)
+			found += is_prime(nums[i]);
+		new_ns = now_ns() - t;
+
+		/* the old loop is O(n), give it one second per range at most */
+		old_done = 0;
+		if(ranges[r].hi <= 2147483648ULL)
+		{
+			t = now_ns();
+			while(old_done < count && now_ns() - t < 1000000000LL)
+			{
+				if(old_is_prime(nums[old_done]) != is_prime(nums[old_done]))
+				{
+					printf("mismatch for %llu\n",(unsigned long long)nums[old_done]);
+					exit(EXIT_FAILURE);
+				}
+				old_done++;
+			}
+			old_ns = now_ns() - t;
+		}
+
+		if(old_done)
+			printf("%-14s %8d %14.1f %14.1f %9.0fx\n",ranges[r].name,found,(double)old_ns / old_done,
+				(double)new_ns / count,((double)old_ns / old_done) / ((double)new_ns / count));
+		else
+			printf("%-14s %8d %14s %14.1f %10s\n",ranges[r].name,found,"-",(double)new_ns / count,"-");
+	}
+	free(nums);
+	return SUCCESS;
+}
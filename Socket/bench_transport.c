@@ -0,0 +1,152 @@
+/*
+	Latency of a single request on each transport to a running server:
+	one OP_CHECK of a number inside the sieve, so the answer costs next to
+	nothing and the round trip is all transport.
+	tcp  - loopback to the server's port, TCP_NODELAY
+	unix - the AF_UNIX listener
+	shm  - the same socket after OP_SHM, frames through the shared rings
+
+	usage : bench_transport <server address> <port> [--unix PATH] [--count N]
+*/
+
+#include"header.h"
+#include<netinet/tcp.h>
+#include<time.h>
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* one OP_CHECK frame for n */
+static void check_frame(char *frame,uint64_t n)
+{
+	struct frame_hdr hdr;
+	hdr.word = htonl(PROTO_MAGIC | OP_CHECK);
+	hdr.count = htonl(1);
+	n = htobe64(n);
+	memcpy(frame,&hdr,sizeof(hdr));
+	memcpy(frame + sizeof(hdr),&n,sizeof(n));
+}
+
+static void report(const char *name,struct hist *h,long long total_ns)
+{
+	printf("%-6s %10.0f %10.2f %10.2f %10.2f %10.2f\n",name,h->total / (total_ns / 1e9),
+		(double)total_ns / h->total / 1000,hist_percentile(h,50) / 1000.0,
+		hist_percentile(h,99) / 1000.0,hist_percentile(h,99.9) / 1000.0);
+}
+
+/* count round trips on a connected socket, either kind */
+static int run_socket(const char *name,int fd,int count)
+{
+	struct hist *h;
+	char frame[sizeof(struct frame_hdr) + sizeof(uint64_t)];
+	unsigned char status;
+	long long start,t;
+	int i,integer = 0;
+
+	h = calloc(1,sizeof(struct hist));
+	if(NULL == h)
+		return FAILURE;
+	start = now_ns();
+	for(i = 0;i < count;i++)
+	{
+		check_frame(frame,1000 + i % 100000);
+		t = now_ns();
+		if(FAILURE == write_full(fd,frame,sizeof(frame)) || FAILURE == read_full(fd,&status,1))
+		{
+			free(h);
+			return FAILURE;
+		}
+		hist_record(h,now_ns() - t);
+	}
+	report(name,h,now_ns() - start);
+	write_request(fd,&integer);
+	close(fd);
+	free(h);
+	return SUCCESS;
+}
+
+static int run_shm(struct shm_client *sc,int count)
+{
+	struct hist *h;
+	char frame[sizeof(struct frame_hdr) + sizeof(uint64_t)];
+	unsigned char status;
+	long long start,t;
+	int i,integer = 0;
+
+	h = calloc(1,sizeof(struct hist));
+	if(NULL == h)
+		return FAILURE;
+	start = now_ns();
+	for(i = 0;i < count;i++)
+	{
+		check_frame(frame,1000 + i % 100000);
+		t = now_ns();
+		if(FAILURE == shm_write(sc,frame,sizeof(frame)) || FAILURE == shm_read(sc,&status,1))
+		{
+			free(h);
+			return FAILURE;
+		}
+		hist_record(h,now_ns() - t);
+	}
+	report("shm",h,now_ns() - start);
+	shm_write(sc,&integer,sizeof(int));
+	shm_close(sc);
+	free(h);
+	return SUCCESS;
+}
+
+int main(int argc,char *argv[])
+{
+	struct sockaddr_in server;
+	struct shm_client *sc;
+	const char *path = UNIX_PATH;
+	int count = 100000;
+	int optval = 1;
+	int fd,i;
+
+	if(3 > argc)
+	{
+		printf("\nUsage : %s <server address> <port> [--unix PATH] [--count N]\n",argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	for(i = 3;i + 1 < argc;i = i + 2)
+	{
+		if(0 == strcmp(argv[i],"--unix"))
+			path = argv[i + 1];
+		else if(0 == strcmp(argv[i],"--count"))
+			count = atoi(argv[i + 1]);
+	}
+	if(0 >= count)
+	{
+		printf("\nInvalid count\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("%d requests each\n",count);
+	printf("%-6s %10s %10s %10s %10s %10s\n","","req/s","mean us","p50 us","p99 us","p99.9 us");
+	server.sin_family = AF_INET;
+	server.sin_port = htons(atoi(argv[2]));
+	server.sin_addr.s_addr = inet_addr(argv[1]);
+	fd = socket(AF_INET,SOCK_STREAM,0);
+	if(ERR == fd || ERR == connect(fd,(struct sockaddr*)&server,sizeof(server)))
+	{
+		perror("\nConnect error");
+		exit(EXIT_FAILURE);
+	}
+	setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&optval,sizeof(optval));
+	if(FAILURE == run_socket("tcp",fd,count))
+		exit(EXIT_FAILURE);
+
+	fd = unix_connect(path);
+	if(ERR == fd || FAILURE == run_socket("unix",fd,count))
+		exit(EXIT_FAILURE);
+
+	sc = shm_connect(path);
+	if(NULL == sc || FAILURE == run_shm(sc,count))
+		exit(EXIT_FAILURE);
+	return SUCCESS;
+}
@@ -0,0 +1,222 @@
+/*
+	Datagram rate of the UDP mode against a running server. One thread
+	sends OP_BATCH datagrams with sendmmsg(), another takes the replies
+	with recvmmsg() and checks every 64th of them against is_prime().
+	At most --window datagrams are outstanding, 0 sends flat out; one
+	without a reply for UDP_LOST_MS is written off as lost, the window
+	moves on. Compare server runs with --udp-batch 1 and the default.
+
+	usage : bench_udp <server address> <port> [--batch N] [--window N]
+		[--vlen N] [--duration SEC]
+*/
+
+#include"header.h"
+#include<stdatomic.h>
+#include<time.h>
+
+#define UDP_LOST_MS 20
+#define BENCH_VLEN_MAX 256
+
+static int fd;
+static int batch = 64;			/* integers per datagram */
+static int window = 256;
+static int bench_vlen = 32;
+static long long end_ns;
+static _Atomic uint64_t sent;
+static _Atomic uint64_t replies;
+static _Atomic uint64_t bad;
+static _Atomic int sending = 1;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* integer j of datagram id, so replies can be checked without keeping requests */
+static uint64_t key(uint32_t id,int j)
+{
+	uint64_t x = ((uint64_t)id << 8 | j) * 0x9E3779B97F4A7C15ULL;
+	return x ^ x >> 29;
+}
+
+static size_t build(char *buf,uint32_t id)
+{
+	struct frame_hdr hdr;
+	uint64_t n;
+	int j;
+	memcpy(buf,&id,sizeof(id));
+	hdr.word = htonl(PROTO_MAGIC | OP_BATCH);
+	hdr.count = htonl(batch);
+	memcpy(buf + sizeof(id),&hdr,sizeof(hdr));
+	for(j = 0;j < batch;j++)
+	{
+		n = htobe64(key(id,j) % 100000000);
+		memcpy(buf + sizeof(id) + sizeof(hdr) + j * sizeof(uint64_t),&n,sizeof(n));
+	}
+	return sizeof(id) + sizeof(hdr) + batch * sizeof(uint64_t);
+}
+
+static int check(const char *buf,size_t len)
+{
+	struct frame_hdr hdr;
+	const unsigned char *bits;
+	uint32_t id;
+	int j;
+	if(len != sizeof(id) + sizeof(hdr) + (batch + 7) / 8)
+		return FAILURE;
+	memcpy(&id,buf,sizeof(id));
+	memcpy(&hdr,buf + sizeof(id),sizeof(hdr));
+	if(htonl(PROTO_MAGIC | OP_BATCH) != hdr.word || htonl(batch) != hdr.count)
+		return FAILURE;
+	if(0 != id % 64)
+		return SUCCESS;
+	bits = (const unsigned char *)buf + sizeof(id) + sizeof(hdr);
+	for(j = 0;j < batch;j++)
+		if(is_prime(key(id,j) % 100000000) != !!(bits[j / 8] & (1 << (j % 8))))
+			return FAILURE;
+	return SUCCESS;
+}
+
+static void *receiver(void *arg)
+{
+	static struct mmsghdr msgs[BENCH_VLEN_MAX];
+	static struct iovec iov[BENCH_VLEN_MAX];
+	static char bufs[BENCH_VLEN_MAX][256];
+	struct timeval tv = { 0,100000 };
+	int i,n;
+	(void)arg;
+	setsockopt(fd,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+	for(i = 0;i < BENCH_VLEN_MAX;i++)
+	{
+		iov[i].iov_base = bufs[i];
+		iov[i].iov_len = sizeof(bufs[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	while(1)
+	{
+		n = recvmmsg(fd,msgs,BENCH_VLEN_MAX,MSG_WAITFORONE,NULL);
+		if(ERR == n)
+		{
+			if(EINTR == errno)
+				continue;
+			if((EAGAIN == errno || EWOULDBLOCK == errno || ECONNREFUSED == errno) &&
+				atomic_load(&sending))
+				continue;
+			break;		/* drained after the senders stopped */
+		}
+		for(i = 0;i < n;i++)
+			if(FAILURE == check(bufs[i],msgs[i].msg_len))
+				atomic_fetch_add(&bad,1);
+		atomic_fetch_add(&replies,n);
+	}
+	return NULL;
+}
+
+static void run(void)
+{
+	static struct mmsghdr msgs[BENCH_VLEN_MAX];
+	static struct iovec iov[BENCH_VLEN_MAX];
+	static char bufs[BENCH_VLEN_MAX][UDP_DATAGRAM];
+	uint64_t lost = 0;
+	uint32_t id = 0;
+	long long stall = 0;
+	int i,n;
+
+	for(i = 0;i < bench_vlen;i++)
+	{
+		iov[i].iov_base = bufs[i];
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	while(now_ns() < end_ns)
+	{
+		if(window && atomic_load(&sent) - atomic_load(&replies) - lost + bench_vlen > (uint64_t)window)
+		{
+			if(0 == stall)
+				stall = now_ns();
+			else if(now_ns() - stall > UDP_LOST_MS * 1000000LL)
+			{
+				lost = atomic_load(&sent) - atomic_load(&replies);
+				stall = 0;
+			}
+			sched_yield();
+			continue;
+		}
+		stall = 0;
+		for(i = 0;i < bench_vlen;i++)
+			iov[i].iov_len = build(bufs[i],id++);
+		n = sendmmsg(fd,msgs,bench_vlen,0);
+		if(ERR == n)
+		{
+			if(ECONNREFUSED == errno || ENOBUFS == errno || EINTR == errno)
+				continue;
+			perror("\nsendmmsg error");
+			exit(EXIT_FAILURE);
+		}
+		atomic_fetch_add(&sent,n);
+	}
+}
+
+int main(int argc,char *argv[])
+{
+	struct sockaddr_in server;
+	pthread_t tid;
+	long long start,elapsed;
+	int seconds = 3;
+	int i;
+
+	if(3 > argc)
+	{
+		printf("\nUsage : %s <server address> <port> [--batch N] [--window N] [--vlen N] [--duration SEC]\n",argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	for(i = 3;i + 1 < argc;i = i + 2)
+	{
+		if(0 == strcmp(argv[i],"--batch"))
+			batch = atoi(argv[i + 1]);
+		else if(0 == strcmp(argv[i],"--window"))
+			window = atoi(argv[i + 1]);
+		else if(0 == strcmp(argv[i],"--vlen"))
+			bench_vlen = atoi(argv[i + 1]);
+		else if(0 == strcmp(argv[i],"--duration"))
+			seconds = atoi(argv[i + 1]);
+	}
+	if(0 >= batch || UDP_MAX_BATCH < batch || 0 > window || 0 >= bench_vlen || BENCH_VLEN_MAX < bench_vlen ||
+		(window && window < bench_vlen) || 0 >= seconds)
+	{
+		printf("\nInvalid arguments\n");
+		exit(EXIT_FAILURE);
+	}
+	if(FAILURE == prime_init(SIEVE_LIMIT))
+		exit(EXIT_FAILURE);
+
+	/* connected, so only the server's replies come in */
+	server.sin_family = AF_INET;
+	server.sin_port = htons(atoi(argv[2]));
+	server.sin_addr.s_addr = inet_addr(argv[1]);
+	fd = socket(AF_INET,SOCK_DGRAM,0);
+	if(ERR == fd || ERR == connect(fd,(struct sockaddr*)&server,sizeof(server)))
+	{
+		perror("\nConnect error");
+		exit(EXIT_FAILURE);
+	}
+	pthread_create(&tid,NULL,receiver,NULL);
+	start = now_ns();
+	end_ns = start + seconds * 1000000000LL;
+	run();
+	elapsed = now_ns() - start;
+	atomic_store(&sending,0);
+	pthread_join(tid,NULL);
+
+	printf("batch %d window %d vlen %d\n",batch,window,bench_vlen);
+	printf("sent    %10.0f datagrams/s\n",atomic_load(&sent) / (elapsed / 1e9));
+	printf("replies %10.0f datagrams/s %12.0f integers/s\n",atomic_load(&replies) / (elapsed / 1e9),
+		atomic_load(&replies) * batch / (elapsed / 1e9));
+	printf("lost    %10.2f %%  bad replies %llu\n",
+		100.0 * (atomic_load(&sent) - atomic_load(&replies)) / (atomic_load(&sent) ? atomic_load(&sent) : 1),
+		(unsigned long long)atomic_load(&bad));
+	return SUCCESS;
+}
@@ -0,0 +1,311 @@
+/*
+	Bounded primality result cache shared by all server threads.
+	The table is an array of 4-way buckets, one cache line each, indexed
+	by a hash of the number. Eviction is CLOCK inside the bucket: a hit
+	sets the entry's reference bit, an insert gives referenced entries a
+	second chance and replaces the first unreferenced one.
+	Reads take no lock, every entry is guarded by its own sequence count
+	(odd while a writer owns it) and a torn read is retried as a miss.
+	Only numbers above the sieve go through the cache, smaller ones are a
+	single bit lookup already.
+	Misses are single flight: the first thread to miss on a number runs
+	Miller-Rabin, the others missing on it meanwhile sleep until the
+	answer is in and share it instead of each running the same test.
+*/
+
+#include"header.h"
+#include<stdatomic.h>
+
+#define CACHE_WAYS 4
+#define FLIGHT_SHARDS 64
+
+struct cache_entry
+{
+	_Atomic uint32_t seq;		/* even and non zero when valid */
+	_Atomic uint8_t result;
+	_Atomic uint8_t ref;		/* CLOCK reference bit */
+	uint16_t pad;
+	_Atomic uint64_t key;
+};
+
+struct cache_bucket
+{
+	struct cache_entry way[CACHE_WAYS];
+} __attribute__((aligned(64)));
+
+/* per thread hit/miss counters, summed by cache_stats(), a line of their own */
+struct cache_counters
+{
+	_Atomic uint64_t hits;		/* written by the owning thread only */
+	_Atomic uint64_t misses;
+	_Atomic uint64_t coalesced;	/* misses answered by another thread's test */
+	struct cache_counters *next;
+} __attribute__((aligned(64)));
+
+/* a test in progress, on the stack of the thread running it */
+struct flight
+{
+	uint64_t n;
+	int result;
+	int done;
+	int waiters;
+	struct flight *next;
+};
+
+struct flight_shard
+{
+	pthread_mutex_t lock;
+	pthread_cond_t landed;		/* some test of the shard finished */
+	struct flight *head;
+} __attribute__((aligned(64)));
+
+static struct cache_bucket *buckets;
+static uint64_t bucket_mask;
+static struct flight_shard *shards;
+static int coalesce = 1;
+static struct cache_counters *counters_list;
+static pthread_mutex_t counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct cache_counters *my_counters;
+
+static uint64_t hash64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* mbytes of table, rounded down to a power of two buckets, 0 disables it */
+int cache_init(size_t mbytes)
+{
+	uint64_t nbuckets = 1;
+	int i;
+	if(0 == mbytes)
+		return SUCCESS;
+	while(nbuckets * 2 * sizeof(struct cache_bucket) <= mbytes << 20)
+		nbuckets = nbuckets * 2;
+	buckets = aligned_alloc(64,nbuckets * sizeof(struct cache_bucket));
+	if(NULL == buckets)
+	{
+		perror("cache allocation error\n");
+		return FAILURE;
+	}
+	memset(buckets,0,nbuckets * sizeof(struct cache_bucket));
+	bucket_mask = nbuckets - 1;
+
+	shards = aligned_alloc(64,FLIGHT_SHARDS * sizeof(struct flight_shard));
+	if(NULL == shards)
+	{
+		perror("cache allocation error\n");
+		return FAILURE;
+	}
+	for(i = 0;i < FLIGHT_SHARDS;i++)
+	{
+		pthread_mutex_init(&shards[i].lock,NULL);
+		pthread_cond_init(&shards[i].landed,NULL);
+		shards[i].head = NULL;
+	}
+	return SUCCESS;
+}
+
+/* 0 runs every miss on its own, for comparison */
+void cache_coalesce(int on)
+{
+	coalesce = on;
+}
+
+static void counter_inc(_Atomic uint64_t *counter)
+{
+	atomic_store_explicit(counter,atomic_load_explicit(counter,memory_order_relaxed) + 1,memory_order_relaxed);
+}
+
+static struct cache_counters *counters(void)
+{
+	if(NULL == my_counters)
+	{
+		my_counters = aligned_alloc(64,sizeof(struct cache_counters));
+		if(NULL == my_counters)
+		{
+			perror("cache counters allocation error\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(my_counters,0,sizeof(struct cache_counters));
+		pthread_mutex_lock(&counters_lock);
+		my_counters->next = counters_list;
+		counters_list = my_counters;
+		pthread_mutex_unlock(&counters_lock);
+	}
+	return my_counters;
+}
+
+static int cache_lookup(struct cache_bucket *b,uint64_t n,int *result)
+{
+	struct cache_entry *e;
+	uint32_t seq;
+	int i,r;
+	for(i = 0;i < CACHE_WAYS;i++)
+	{
+		e = &b->way[i];
+		seq = atomic_load_explicit(&e->seq,memory_order_acquire);
+		if(0 == seq || (seq & 1))
+			continue;
+		if(n != atomic_load_explicit(&e->key,memory_order_relaxed))
+			continue;
+		r = atomic_load_explicit(&e->result,memory_order_relaxed);
+		atomic_thread_fence(memory_order_acquire);
+		if(seq != atomic_load_explicit(&e->seq,memory_order_relaxed))
+			return 0;
+		if(0 == atomic_load_explicit(&e->ref,memory_order_relaxed))
+			atomic_store_explicit(&e->ref,1,memory_order_relaxed);
+		*result = r;
+		return 1;
+	}
+	return 0;
+}
+
+/* best effort, gives up when another writer owns the victim */
+static void cache_insert(struct cache_bucket *b,uint64_t n,int result)
+{
+	struct cache_entry *e = NULL;
+	uint32_t seq;
+	int i,pass;
+	for(pass = 0;pass < 2 && NULL == e;pass++)
+	{
+		for(i = 0;i < CACHE_WAYS;i++)
+		{
+			if(0 == atomic_load_explicit(&b->way[i].ref,memory_order_relaxed))
+			{
+				e = &b->way[i];
+				break;
+			}
+			atomic_store_explicit(&b->way[i].ref,0,memory_order_relaxed);
+		}
+	}
+	if(NULL == e)
+		e = &b->way[n % CACHE_WAYS];
+
+	seq = atomic_load_explicit(&e->seq,memory_order_relaxed);
+	if((seq & 1) || !atomic_compare_exchange_strong_explicit(&e->seq,&seq,seq + 1,
+			memory_order_acquire,memory_order_relaxed))
+		return;
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&e->key,n,memory_order_relaxed);
+	atomic_store_explicit(&e->result,result,memory_order_relaxed);
+	atomic_store_explicit(&e->ref,0,memory_order_relaxed);
+	atomic_store_explicit(&e->seq,seq + 2,memory_order_release);
+}
+
+/*
+	miss path: join the test already running for n, or run it. The runner
+	caches the result before it leaves the shard list, so a thread finding
+	neither a flight nor an entry under the lock really has to test n.
+	The flight lives on the runner's stack, the runner waits for its
+	waiters to read the result before returning.
+*/
+static int flight_check(struct cache_bucket *b,uint64_t n,struct cache_counters *cnt,int (*test)(uint64_t))
+{
+	struct flight_shard *s = &shards[(hash64(n) >> 32) % FLIGHT_SHARDS];
+	struct flight mine,*f,**link;
+	int result;
+
+	pthread_mutex_lock(&s->lock);
+	for(f = s->head;NULL != f;f = f->next)
+		if(n == f->n)
+			break;
+	if(NULL != f)
+	{
+		f->waiters++;
+		while(!f->done)
+			pthread_cond_wait(&s->landed,&s->lock);
+		result = f->result;
+		if(0 == --f->waiters)
+			pthread_cond_broadcast(&s->landed);
+		pthread_mutex_unlock(&s->lock);
+		counter_inc(&cnt->coalesced);
+		return result;
+	}
+	if(cache_lookup(b,n,&result))
+	{
+		pthread_mutex_unlock(&s->lock);
+		return result;
+	}
+	mine.n = n;
+	mine.done = 0;
+	mine.waiters = 0;
+	mine.next = s->head;
+	s->head = &mine;
+	pthread_mutex_unlock(&s->lock);
+
+	result = test(n);
+	cache_insert(b,n,result);
+
+	pthread_mutex_lock(&s->lock);
+	for(link = &s->head;*link != &mine;link = &(*link)->next)
+		;
+	*link = mine.next;
+	mine.result = result;
+	mine.done = 1;
+	if(mine.waiters)
+	{
+		pthread_cond_broadcast(&s->landed);
+		while(mine.waiters)
+			pthread_cond_wait(&s->landed,&s->lock);
+	}
+	pthread_mutex_unlock(&s->lock);
+	return result;
+}
+
+/* test(n) through the cache, test is is_prime() or a shortcut agreeing with it */
+static int cached(uint64_t n,int (*test)(uint64_t))
+{
+	struct cache_bucket *b;
+	struct cache_counters *cnt;
+	int result;
+	if(NULL == buckets)
+		return test(n);
+	cnt = counters();
+	b = &buckets[hash64(n) & bucket_mask];
+	if(cache_lookup(b,n,&result))
+	{
+		counter_inc(&cnt->hits);
+		return result;
+	}
+	counter_inc(&cnt->misses);
+	if(coalesce)
+		return flight_check(b,n,cnt,test);
+	result = test(n);
+	cache_insert(b,n,result);
+	return result;
+}
+
+int is_prime_cached(uint64_t n)
+{
+	if(is_sieved(n))
+		return is_prime(n);
+	return cached(n,is_prime);
+}
+
+/* for a PRIME_UNKNOWN of prime_screen(), a miss goes straight to Miller-Rabin */
+int is_screened_cached(uint64_t n)
+{
+	return cached(n,is_prime_screened);
+}
+
+/* sums of the per thread counters, not a consistent snapshot */
+void cache_stats(uint64_t *hits,uint64_t *misses,uint64_t *coalesced)
+{
+	struct cache_counters *c;
+	*hits = 0;
+	*misses = 0;
+	*coalesced = 0;
+	pthread_mutex_lock(&counters_lock);
+	for(c = counters_list;NULL != c;c = c->next)
+	{
+		*hits = *hits + atomic_load_explicit(&c->hits,memory_order_relaxed);
+		*misses = *misses + atomic_load_explicit(&c->misses,memory_order_relaxed);
+		*coalesced = *coalesced + atomic_load_explicit(&c->coalesced,memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&counters_lock);
+}
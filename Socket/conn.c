@@ -0,0 +1,484 @@
+/*
+	Connection state shared by the server backends: the buffered input,
+	the pending output and the answers to every request parsed out of
+	the input. The backends own the socket I/O.
+	A request costing more than the pool threshold becomes a task for the
+	worker pool. Every request after it on the connection becomes a task
+	too, answered at once but held back until the ones before it are done,
+	so the answers still go out in request order.
+	A connection without input for the idle timeout is reaped, a task
+	still running at its deadline is told to stop and answered with
+	ERROR_TIMEOUT in its place.
+*/
+
+#include"header.h"
+
+static uint64_t idle_ms;
+static uint64_t deadline_ms;
+
+/* 0 disables either */
+void conn_timeouts(uint64_t idle,uint64_t deadline)
+{
+	idle_ms = idle;
+	deadline_ms = deadline;
+}
+
+int conn_init(struct conn *c,int socket_fd)
+{
+	memset(c,0,sizeof(struct conn));
+	if(FAILURE == rbuf_init(&c->in,RBUF_SIZE))
+		return FAILURE;
+	c->fd = socket_fd;
+	metrics_conn(1);
+	return SUCCESS;
+}
+
+/* the backend's pool completions and timer wheel, arms the idle timeout */
+void conn_attach(struct conn *c,struct completions *cq,struct wheel *w)
+{
+	c->cq = cq;
+	c->wheel = w;
+	c->idle.kind = TIMER_IDLE;
+	c->idle.owner = c;
+	if(NULL != w && idle_ms)
+		timer_arm(w,&c->idle,idle_ms);
+}
+
+/* idle timer fired, SUCCESS when the connection should go */
+int conn_idle(struct conn *c)
+{
+	if(0 < c->inflight)
+	{
+		timer_arm(c->wheel,&c->idle,idle_ms);	/* waiting on us, not idle */
+		return FAILURE;
+	}
+	metrics_add(STAT_IDLE_CLOSED,1);
+	return SUCCESS;
+}
+
+static void task_free(struct task *t)
+{
+	timer_cancel(&t->deadline);
+	free(t->integers);
+	free(t->answer.out);
+	free(t);
+}
+
+/* frees the buffers, closing the socket is up to the backend, no task may be in the pool */
+void conn_destroy(struct conn *c)
+{
+	struct task *t;
+	while(NULL != (t = c->tasks))
+	{
+		c->tasks = t->next;
+		task_free(t);
+	}
+	c->tasks_tail = NULL;
+	timer_cancel(&c->idle);
+	if(NULL != c->shm)
+		shm_release(c);
+	rbuf_free(&c->in);
+	free(c->out);
+	c->out = NULL;
+	c->out_len = 0;
+	c->out_cap = 0;
+	metrics_conn(0);
+}
+
+/* make room for len more output bytes and return where they go */
+char *conn_reserve(struct conn *c,size_t len)
+{
+	char *out;
+	size_t cap;
+	if(c->out_len + len > c->out_cap)
+	{
+		cap = c->out_cap ? c->out_cap : 256;
+		while(cap < c->out_len + len)
+			cap = cap * 2;
+		out = realloc(c->out,cap);
+		if(NULL == out)
+			return NULL;
+		c->out = out;
+		c->out_cap = cap;
+	}
+	out = c->out + c->out_len;
+	c->out_len = c->out_len + len;
+	return out;
+}
+
+int conn_queue(struct conn *c,const void *data,size_t len)
+{
+	char *out;
+	out = conn_reserve(c,len);
+	if(NULL == out)
+		return FAILURE;
+	memcpy(out,data,len);
+	return SUCCESS;
+}
+
+static int conn_answer(struct conn *c,int integer)
+{
+	char prime[RESPONSE_SIZE];
+	int len;
+	check_prime(integer,prime);
+	len = strlen(prime);
+	if(FAILURE == conn_queue(c,&len,sizeof(int)))
+		return FAILURE;
+	return conn_queue(c,prime,len);
+}
+
+/* a range the sieve cannot answer is a protocol error like a bad frame */
+static int conn_answer_range(struct conn *c,const struct frame *f)
+{
+	struct frame_hdr hdr;
+	unsigned char *results;
+	uint64_t a,b,count;
+	a = frame_integer(f,0);
+	b = frame_integer(f,1);
+	if(!range_valid(a,b) || b - a >= MAX_RANGE_COUNT)
+		return FAILURE;
+	hdr.word = htonl(PROTO_MAGIC | f->op);
+	if(OP_RANGE_COUNT == f->op)
+	{
+		hdr.count = htonl(1);
+		count = htobe64(range_query(a,b,NULL,c->cancel));
+		if(FAILURE == conn_queue(c,&hdr,sizeof(hdr)))
+			return FAILURE;
+		return conn_queue(c,&count,sizeof(count));
+	}
+	if(b - a >= MAX_RANGE_BITMAP)
+		return FAILURE;
+	hdr.count = htonl(b - a + 1);
+	if(FAILURE == conn_queue(c,&hdr,sizeof(hdr)))
+		return FAILURE;
+	results = (unsigned char *)conn_reserve(c,(b - a + 8) / 8);
+	if(NULL == results)
+		return FAILURE;
+	memset(results,0,(b - a + 8) / 8);
+	range_query(a,b,results,c->cancel);
+	return SUCCESS;
+}
+
+/* m and the m factors of every integer, see OP_FACTOR */
+static int conn_answer_factor(struct conn *c,const struct frame *f)
+{
+	struct frame_hdr hdr;
+	uint64_t factors[MAX_FACTORS];
+	unsigned char *answer;
+	uint32_t i;
+	int m,j;
+	hdr.word = htonl(PROTO_MAGIC | OP_FACTOR);
+	hdr.count = htonl(f->count);
+	if(FAILURE == conn_queue(c,&hdr,sizeof(hdr)))
+		return FAILURE;
+	for(i = 0;i < f->count;i++)
+	{
+		if(0 == (i & 63) && NULL != c->cancel && __atomic_load_n(c->cancel,__ATOMIC_RELAXED))
+			return FAILURE;
+		m = factor(frame_integer(f,i),factors);
+		answer = (unsigned char *)conn_reserve(c,1 + m * sizeof(uint64_t));
+		if(NULL == answer)
+			return FAILURE;
+		answer[0] = m;
+		for(j = 0;j < m;j++)
+			factors[j] = htobe64(factors[j]);
+		memcpy(answer + 1,factors,m * sizeof(uint64_t));
+	}
+	return SUCCESS;
+}
+
+static int conn_answer_frame(struct conn *c,const struct frame *f)
+{
+	struct frame_hdr hdr;
+	unsigned char *results;
+	uint64_t stats[STAT_FIELDS];
+	uint32_t i;
+	if(OP_CHECK == f->op)
+	{
+		results = (unsigned char *)conn_reserve(c,1);
+		if(NULL == results)
+			return FAILURE;
+		results[0] = metrics_check(frame_integer(f,0)) ? STATUS_PRIME : STATUS_NOT_PRIME;
+		return SUCCESS;
+	}
+	if(OP_RANGE_COUNT == f->op || OP_RANGE_BITMAP == f->op)
+		return conn_answer_range(c,f);
+	if(OP_FACTOR == f->op)
+		return conn_answer_factor(c,f);
+	if(OP_SHM == f->op)
+	{
+		/* over TCP, or with requests still unanswered, see conn_parse() */
+		hdr.word = htonl(PROTO_MAGIC | OP_ERROR);
+		hdr.count = htonl(ERROR_UNSUPPORTED);
+		return conn_queue(c,&hdr,sizeof(hdr));
+	}
+	if(OP_STATS == f->op)
+	{
+		metrics_collect(stats);
+		for(i = 0;i < STAT_FIELDS;i++)
+			stats[i] = htobe64(stats[i]);
+		hdr.word = htonl(PROTO_MAGIC | OP_STATS);
+		hdr.count = htonl(STAT_FIELDS);
+		if(FAILURE == conn_queue(c,&hdr,sizeof(hdr)))
+			return FAILURE;
+		return conn_queue(c,stats,sizeof(stats));
+	}
+	hdr.word = htonl(PROTO_MAGIC | f->op);
+	hdr.count = htonl(f->count);
+	if(FAILURE == conn_queue(c,&hdr,sizeof(hdr)))
+		return FAILURE;
+	results = (unsigned char *)conn_reserve(c,(f->count + 7) / 8);
+	if(NULL == results)
+		return FAILURE;
+	memset(results,0,(f->count + 7) / 8);
+	return metrics_check_batch(f,results,c->cancel);
+}
+
+static int conn_answer_any(struct conn *c,const struct frame *f)
+{
+	if(OP_V1 == f->op)
+		return conn_answer(c,f->value);
+	return conn_answer_frame(c,f);
+}
+
+/*
+	rough cost of a frame in Miller-Rabin tests, sieving RANGE_COST_SPAN
+	numbers counts as one, factoring a number past the sieve FACTOR_COST
+*/
+#define RANGE_COST_SPAN 1024
+#define FACTOR_COST 64
+
+static uint64_t frame_cost(const struct frame *f)
+{
+	uint64_t cost = 0,a,b;
+	uint32_t i;
+	switch(f->op)
+	{
+	case OP_V1:
+		return !is_sieved((uint64_t)(uint32_t)f->value);
+	case OP_CHECK:
+	case OP_BATCH:
+		for(i = 0;i < f->count;i++)
+			if(!is_sieved(frame_integer(f,i)))
+				cost++;
+		return cost;
+	case OP_RANGE_COUNT:
+	case OP_RANGE_BITMAP:
+		a = frame_integer(f,0);
+		b = frame_integer(f,1);
+		return a <= b ? (b - a) / RANGE_COST_SPAN + 1 : 0;
+	case OP_FACTOR:
+		for(i = 0;i < f->count;i++)
+			if(!is_sieved(frame_integer(f,i)))
+				cost = cost + FACTOR_COST;
+		return cost;
+	}
+	return 0;
+}
+
+/* ERROR_TIMEOUT in place of the answer to f */
+static int conn_answer_error(struct conn *c,const struct frame *f)
+{
+	struct frame_hdr hdr;
+	char text[RESPONSE_SIZE + 8];
+	int len;
+	if(OP_V1 == f->op)
+	{
+		len = sprintf(text,"%d timed out",f->value);
+		if(FAILURE == conn_queue(c,&len,sizeof(int)))
+			return FAILURE;
+		return conn_queue(c,text,len);
+	}
+	hdr.word = htonl(PROTO_MAGIC | OP_ERROR);
+	hdr.count = htonl(ERROR_TIMEOUT);
+	return conn_queue(c,&hdr,sizeof(hdr));
+}
+
+void conn_run_task(struct task *t)
+{
+	if(__atomic_load_n(&t->cancel,__ATOMIC_RELAXED))
+		t->ret_val = FAILURE;	/* expired while queued */
+	else
+		t->ret_val = conn_answer_any(&t->answer,&t->f);
+}
+
+/* called by the owning I/O thread for a task back from the pool */
+void conn_task_done(struct task *t)
+{
+	t->c->inflight--;
+	timer_cancel(&t->deadline);
+	if(t->orphan)
+		task_free(t);
+	else
+		t->done = 1;
+}
+
+/* deadline fired on the I/O thread, conn_collect() sends the error */
+void conn_task_expired(struct task *t)
+{
+	t->expired = 1;
+	__atomic_store_n(&t->cancel,1,__ATOMIC_RELAXED);
+	metrics_add(STAT_TIMEOUTS,1);
+}
+
+/* queue the frame behind the earlier tasks, to the pool when offload is set */
+static int conn_defer(struct conn *c,const struct frame *f,uint64_t start,int offload)
+{
+	struct task *t;
+	size_t len;
+	t = calloc(1,sizeof(struct task));
+	if(NULL == t)
+		return FAILURE;
+	t->f = *f;
+	if(NULL != f->payload)
+	{
+		len = (size_t)f->count * sizeof(uint64_t);
+		t->integers = malloc(len);
+		if(NULL == t->integers)
+		{
+			free(t);
+			return FAILURE;
+		}
+		memcpy(t->integers,f->payload,len);
+		t->f.payload = t->integers;
+	}
+	t->c = c;
+	t->start = start;
+	if(NULL != c->tasks_tail)
+		c->tasks_tail->next = t;
+	else
+		c->tasks = t;
+	c->tasks_tail = t;
+	if(offload)
+	{
+		t->answer.cancel = &t->cancel;
+		c->inflight++;
+		if(SUCCESS == pool_submit(t))
+		{
+			t->deadline.kind = TIMER_DEADLINE;
+			t->deadline.owner = t;
+			if(NULL != c->wheel && deadline_ms)
+				timer_arm(c->wheel,&t->deadline,deadline_ms);
+			return SUCCESS;
+		}
+		c->inflight--;		/* pool full, answer it here */
+	}
+	conn_run_task(t);
+	t->done = 1;
+	return SUCCESS;
+}
+
+/* move the answers of the finished tasks at the front to the output */
+int conn_collect(struct conn *c)
+{
+	struct task *t;
+	size_t out_len;
+	int ret_val = SUCCESS;
+	out_len = c->out_len;
+	while(NULL != (t = c->tasks) && (t->done || t->expired))
+	{
+		c->tasks = t->next;
+		if(NULL == c->tasks)
+			c->tasks_tail = NULL;
+		if(t->expired)
+		{
+			if(SUCCESS == ret_val && FAILURE == conn_answer_error(c,&t->f))
+				ret_val = FAILURE;
+			if(!t->done)
+			{
+				t->orphan = 1;	/* the pool still has it */
+				continue;
+			}
+		}
+		else if(SUCCESS == ret_val && SUCCESS == t->ret_val)
+		{
+			if(0 == c->out_len)
+			{
+				free(c->out);		/* take the answer over, no copy */
+				c->out = t->answer.out;
+				c->out_len = t->answer.out_len;
+				c->out_cap = t->answer.out_cap;
+				t->answer.out = NULL;
+			}
+			else if(FAILURE == conn_queue(c,t->answer.out,t->answer.out_len))
+				ret_val = FAILURE;
+			if(SUCCESS == ret_val)
+				metrics_request(t->start);
+		}
+		else
+			ret_val = FAILURE;
+		task_free(t);
+	}
+	metrics_add(STAT_BYTES_OUT,c->out_len - out_len);
+	if(FAILURE == ret_val)
+		metrics_add(STAT_ERRORS,1);
+	return ret_val;
+}
+
+/*
+	answer every complete frame in the input buffer, the request latency
+	of each one counts from the start of the pass, right after the recv
+*/
+int conn_parse(struct conn *c)
+{
+	struct frame f;
+	ssize_t len;
+	uint64_t start;
+	size_t in_start,out_len;
+	int offload,ret_val;
+	start = metrics_now();
+	if(NULL != c->wheel && idle_ms)
+		timer_arm(c->wheel,&c->idle,idle_ms);
+	in_start = c->in.start;
+	out_len = c->out_len;
+	while(!c->closing)
+	{
+		len = parse_frame(c->in.data + c->in.start,c->in.end - c->in.start,&f,&c->need);
+		if(ERR == len)
+		{
+			metrics_add(STAT_ERRORS,1);
+			return FAILURE;
+		}
+		if(0 == len)
+			break;
+		c->in.start = c->in.start + len;
+		if(OP_V1 == f.op && 0 == f.value)
+		{
+			c->closing = 1;
+			break;
+		}
+		/*
+			the rings take over from the socket between requests, the
+			client sends nothing more until the answer; the backend
+			offers them once the pass is over
+		*/
+		if(OP_SHM == f.op && c->shm_ok && NULL == c->shm && NULL == c->tasks &&
+			c->in.start == c->in.end && 0 == c->out_len)
+		{
+			c->shm_wanted = 1;
+			break;
+		}
+		offload = NULL != c->cq && pool_wanted(frame_cost(&f));
+		if(NULL != c->tasks || offload)
+			ret_val = conn_defer(c,&f,start,offload);
+		else
+		{
+			ret_val = conn_answer_any(c,&f);
+			if(SUCCESS == ret_val)
+				metrics_request(start);
+		}
+		if(FAILURE == ret_val)
+		{
+			metrics_add(STAT_ERRORS,1);
+			return FAILURE;
+		}
+	}
+	metrics_add(STAT_BYTES_IN,c->in.start - in_start);
+	metrics_add(STAT_BYTES_OUT,c->out_len - out_len);
+	if(c->in.start == c->in.end)
+	{
+		c->in.start = 0;
+		c->in.end = 0;
+	}
+	return SUCCESS;
+}
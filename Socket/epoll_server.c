@@ -0,0 +1,378 @@
+/*
+	Edge-triggered epoll event loop for the prime server.
+	All connections are multiplexed in one thread, every socket is
+	non-blocking and the v1 wire format of function.c is kept:
+	request  - 4 byte integer in network order, 0 ends the session
+	response - int length followed by the text answer
+	A first word carrying PROTO_MAGIC starts a v2 frame instead, answered
+	in binary without any text formatting.
+	Tasks back from the worker pool are announced on an eventfd in the
+	same epoll set, the epoll_wait() timeout drives the timer wheel.
+	The AF_UNIX listener is shared by every worker, EPOLLEXCLUSIVE wakes
+	only one of them per connection. Its connections may switch to the
+	shared memory rings of shm.c, their socket then only rings doorbells.
+	The worker's UDP socket is level-triggered, see udp.c.
+*/
+
+#include"header.h"
+#include<sys/epoll.h>
+
+static struct conn *conn_new(int socket_fd,struct completions *cq,struct wheel *w)
+{
+	struct conn *c;
+	c = malloc(sizeof(struct conn));
+	if(NULL == c)
+		return NULL;
+	if(FAILURE == conn_init(c,socket_fd))
+	{
+		free(c);
+		return NULL;
+	}
+	conn_attach(c,cq,w);
+	return c;
+}
+
+/* a connection with tasks in the pool is freed when the last one comes back */
+static void conn_close(struct conn *c)
+{
+	if(ERR != c->fd)
+		close(c->fd);	/* also removes it from the epoll set */
+	c->fd = ERR;
+	if(0 < c->inflight)
+		return;
+	conn_destroy(c);
+	free(c);
+}
+
+/* write as much of the pending output as the socket takes */
+static int conn_flush(struct conn *c)
+{
+	ssize_t n;
+	if(NULL != c->shm)
+		return shm_push(c);
+	while(c->out_off < c->out_len)
+	{
+		n = send(c->fd,c->out + c->out_off,c->out_len - c->out_off,MSG_NOSIGNAL);
+		if(0 > n)
+		{
+			if(EINTR == errno)
+				continue;
+			if(EAGAIN == errno || EWOULDBLOCK == errno)
+				return SUCCESS;	/* EPOLLOUT resumes the flush */
+			return FAILURE;
+		}
+		c->out_off = c->out_off + n;
+	}
+	c->out_off = 0;
+	c->out_len = 0;
+	return SUCCESS;
+}
+
+/*
+	drain the doorbells, then answer what the ring holds until it stays
+	empty; after the peer's EOF only what is already in the ring
+*/
+static int shm_readable(struct conn *c)
+{
+	char bells[64];
+	ssize_t n;
+	int eof = 0;
+	while(1)
+	{
+		n = recv(c->fd,bells,sizeof(bells),0);
+		if(0 == n)
+		{
+			eof = 1;
+			break;
+		}
+		if(0 > n)
+		{
+			if(EINTR == errno)
+				continue;
+			if(EAGAIN == errno || EWOULDBLOCK == errno)
+				break;
+			return FAILURE;
+		}
+	}
+	do
+	{
+		while(!c->closing && 0 < (n = shm_pull(c)))
+			if(FAILURE == conn_parse(c) || FAILURE == shm_push(c))
+				return FAILURE;
+		if(ERR == n)
+			return FAILURE;
+	}
+	while(!c->closing && !eof && shm_sleep(c));
+	if(eof)
+		c->closing = 1;
+	return shm_push(c);
+}
+
+/*
+	One large recv() per pass, every complete frame in it is answered and
+	a partial one stays buffered. A short read means the socket is
+	drained, otherwise read on until EAGAIN as edge-triggered mode needs.
+	EOF stops the reading like a 0 request: the answers still queued or
+	in the pool are sent before the connection closes.
+*/
+static int conn_readable(struct conn *c)
+{
+	ssize_t n;
+	size_t room;
+	if(NULL != c->shm)
+		return shm_readable(c);
+	while(!c->closing)
+	{
+		room = c->in.cap - (c->in.end - c->in.start);
+		n = rbuf_fill(&c->in,c->fd,c->need);
+		if(0 == n)
+		{
+			c->closing = 1;	/* peer shut its side, it may still read */
+			break;
+		}
+		if(0 > n)
+		{
+			if(EAGAIN == errno || EWOULDBLOCK == errno)
+				break;
+			return FAILURE;
+		}
+		if(FAILURE == conn_parse(c))
+			return FAILURE;
+		if(c->shm_wanted)
+		{
+			c->shm_wanted = 0;
+			if(FAILURE == shm_offer(c))
+				return FAILURE;
+			return shm_readable(c);
+		}
+		if((size_t)n < room)
+			break;
+	}
+	return conn_flush(c);
+}
+
+/* local is set for the AF_UNIX listener, whose connections may ask for OP_SHM */
+static int accept_all(int epoll_fd,int listen_fd,int local,struct completions *cq,struct wheel *w)
+{
+	int socket_fd;
+	struct conn *c;
+	struct epoll_event ev;
+	while(1)
+	{
+		socket_fd = accept4(listen_fd,NULL,NULL,SOCK_NONBLOCK);
+		if(ERR == socket_fd)
+		{
+			if(EINTR == errno || ECONNABORTED == errno)
+				continue;
+			if(EAGAIN == errno || EWOULDBLOCK == errno)
+				return SUCCESS;
+			if(EMFILE == errno || ENFILE == errno)
+			{
+				perror("\nAccept error");
+				return SUCCESS;	/* retried on the next event */
+			}
+			return FAILURE;
+		}
+		c = conn_new(socket_fd,cq,w);
+		if(NULL == c)
+		{
+			close(socket_fd);
+			continue;
+		}
+		c->shm_ok = local;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		ev.data.ptr = c;
+		if(ERR == epoll_ctl(epoll_fd,EPOLL_CTL_ADD,socket_fd,&ev))
+		{
+			perror("\nepoll_ctl error");
+			conn_close(c);
+		}
+	}
+}
+
+/* send what the finished or expired tasks answered */
+static void conn_settle(struct conn *c)
+{
+	if(FAILURE == conn_collect(c) || FAILURE == conn_flush(c))
+		conn_close(c);
+	else if(c->closing && 0 == c->out_len && NULL == c->tasks)
+		conn_close(c);
+}
+
+/* hand the answers of the returned tasks to their connections */
+static void tasks_returned(struct completions *cq)
+{
+	struct task *t,*next;
+	struct conn *c;
+	uint64_t count;
+	if(ERR == read(cq->efd,&count,sizeof(count)) && EAGAIN != errno)
+		perror("\neventfd read error");
+	for(t = completions_take(cq);NULL != t;t = next)
+	{
+		next = t->next_done;
+		c = t->c;
+		conn_task_done(t);
+		if(ERR == c->fd)
+			conn_close(c);	/* closed meanwhile, free it with the last task */
+		else
+			conn_settle(c);
+	}
+}
+
+/* reap idle connections, answer the tasks past their deadline */
+static void timers_expired(struct wheel *w)
+{
+	struct timer *tm,*next;
+	struct task *t;
+	struct conn *c;
+	for(tm = wheel_advance(w,wheel_now());NULL != tm;tm = next)
+	{
+		next = tm->next;
+		if(TIMER_IDLE == tm->kind)
+		{
+			c = tm->owner;
+			if(ERR != c->fd && SUCCESS == conn_idle(c))
+				conn_close(c);
+			continue;
+		}
+		t = tm->owner;
+		c = t->c;
+		conn_task_expired(t);
+		if(ERR != c->fd)
+			conn_settle(c);
+	}
+}
+
+/* unix_fd and udp_fd are ERR without the AF_UNIX listener or UDP */
+int run_epoll_server(int listen_fd,int unix_fd,int udp_fd)
+{
+	int epoll_fd;
+	int i,n;
+	int returned;
+	struct conn *c;
+	struct completions cq;
+	struct wheel wheel;
+	struct udp *udp = NULL;
+	struct epoll_event ev;
+	struct epoll_event events[MAX_EVENTS];
+
+	if(FAILURE == set_nonblocking(listen_fd) || (ERR != unix_fd && FAILURE == set_nonblocking(unix_fd)))
+		return FAILURE;
+
+	epoll_fd = epoll_create1(0);
+	if(ERR == epoll_fd)
+	{
+		perror("\nepoll_create error");
+		return FAILURE;
+	}
+
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = NULL;		/* NULL marks the listening socket */
+	if(ERR == epoll_ctl(epoll_fd,EPOLL_CTL_ADD,listen_fd,&ev))
+	{
+		perror("\nepoll_ctl error");
+		close(epoll_fd);
+		return FAILURE;
+	}
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.ptr = &unix_fd;		/* &unix_fd the AF_UNIX one */
+	if(ERR != unix_fd && ERR == epoll_ctl(epoll_fd,EPOLL_CTL_ADD,unix_fd,&ev))
+	{
+		perror("\nepoll_ctl error");
+		close(epoll_fd);
+		return FAILURE;
+	}
+
+	if(ERR != udp_fd)
+	{
+		udp = udp_open(udp_fd);
+		ev.events = EPOLLIN;
+		ev.data.ptr = udp;	/* and the udp the datagram socket */
+		if(NULL == udp || ERR == epoll_ctl(epoll_fd,EPOLL_CTL_ADD,udp_fd,&ev))
+		{
+			perror("\nUDP error");
+			close(epoll_fd);
+			return FAILURE;
+		}
+	}
+
+	if(FAILURE == completions_init(&cq))
+	{
+		close(epoll_fd);
+		return FAILURE;
+	}
+	wheel_init(&wheel,wheel_now());
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.ptr = &cq;		/* and &cq the pool's eventfd */
+	if(ERR == epoll_ctl(epoll_fd,EPOLL_CTL_ADD,cq.efd,&ev))
+	{
+		perror("\nepoll_ctl error");
+		close(epoll_fd);
+		return FAILURE;
+	}
+
+	while(1)
+	{
+		n = epoll_wait(epoll_fd,events,MAX_EVENTS,wheel_timeout(&wheel));
+		if(ERR == n)
+		{
+			if(EINTR == errno)
+				continue;
+			perror("\nepoll_wait error");
+			break;
+		}
+		returned = 0;
+		for(i = 0;i < n;i++)
+		{
+			c = events[i].data.ptr;
+			if((void *)&cq == (void *)c)
+			{
+				returned = 1;	/* after the batch, it may free its conns */
+				continue;
+			}
+			if(NULL != udp && (void *)udp == (void *)c)
+			{
+				udp_readable(udp);
+				continue;
+			}
+			if(NULL == c || (void *)&unix_fd == (void *)c)
+			{
+				if(FAILURE == accept_all(epoll_fd,NULL == c ? listen_fd : unix_fd,NULL != c,&cq,&wheel))
+				{
+					perror("\nAccept error");
+					close(epoll_fd);
+					return FAILURE;
+				}
+				continue;
+			}
+			if(events[i].events & (EPOLLERR | EPOLLHUP))
+			{
+				conn_close(c);
+				continue;
+			}
+			if(events[i].events & EPOLLIN)
+			{
+				if(FAILURE == conn_readable(c))
+				{
+					conn_close(c);
+					continue;
+				}
+			}
+			else if(events[i].events & EPOLLOUT)
+			{
+				if(FAILURE == conn_flush(c))
+				{
+					conn_close(c);
+					continue;
+				}
+			}
+			if(c->closing && 0 == c->out_len && NULL == c->tasks)
+				conn_close(c);
+		}
+		if(returned)
+			tasks_returned(&cq);
+		timers_expired(&wheel);
+	}
+	close(epoll_fd);
+	return FAILURE;
+}
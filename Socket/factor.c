@@ -0,0 +1,217 @@
+/*
+	Prime factorization for OP_FACTOR, every 64 bit input.
+	- trial division by the odd primes below FACTOR_TRIAL, each one a
+	  multiply by its inverse mod 2^64 and a compare instead of a divide
+	- what is left is prime when it is below FACTOR_TRIAL^2 or passes
+	  Miller-Rabin
+	- a composite is split by Pollard-Brent rho, iterating x^2 + c in the
+	  Montgomery domain so a step is two multiplies and no divide
+*/
+
+#include"header.h"
+
+#define FACTOR_TRIAL 4096		/* trial division bound, primes below it */
+#define RHO_BATCH 128			/* differences multiplied per gcd */
+
+struct trial_prime
+{
+	uint64_t inverse;		/* p * inverse == 1 mod 2^64 */
+	uint64_t limit;			/* n divisible by p iff n * inverse <= limit */
+	uint32_t p;
+};
+
+static struct trial_prime *trial;
+static int ntrial;
+
+/* the table of odd primes below FACTOR_TRIAL, from the prime_init() sieve */
+int factor_init(void)
+{
+	uint64_t p;
+	trial = malloc(FACTOR_TRIAL / 2 * sizeof(struct trial_prime));
+	if(NULL == trial)
+	{
+		perror("factor allocation error\n");
+		return FAILURE;
+	}
+	for(p = 3;p < FACTOR_TRIAL;p = p + 2)
+	{
+		if(!is_prime(p))
+			continue;
+		trial[ntrial].p = p;
+		trial[ntrial].inverse = inverse64(p);
+		trial[ntrial].limit = UINT64_MAX / p;
+		ntrial++;
+	}
+	return SUCCESS;
+}
+
+struct mont
+{
+	uint64_t n;
+	uint64_t inverse;		/* n^-1 mod 2^64 */
+};
+
+/* t / 2^64 mod n for t < n * 2^64 */
+static uint64_t redc(const struct mont *m,unsigned __int128 t)
+{
+	uint64_t q,hi,qn;
+	q = (uint64_t)t * m->inverse;
+	qn = ((unsigned __int128)q * m->n) >> 64;
+	hi = t >> 64;
+	return hi >= qn ? hi - qn : hi - qn + m->n;
+}
+
+static uint64_t mont_mul(const struct mont *m,uint64_t a,uint64_t b)
+{
+	return redc(m,(unsigned __int128)a * b);
+}
+
+static uint64_t gcd64(uint64_t a,uint64_t b)
+{
+	uint64_t t;
+	int shift;
+	if(0 == a)
+		return b;
+	if(0 == b)
+		return a;
+	shift = __builtin_ctzll(a | b);
+	a = a >> __builtin_ctzll(a);
+	while(b)
+	{
+		b = b >> __builtin_ctzll(b);
+		if(a > b)
+		{
+			t = a;
+			a = b;
+			b = t;
+		}
+		b = b - a;
+	}
+	return a << shift;
+}
+
+/* x^2 + c mod n, everything in Montgomery form */
+static uint64_t rho_step(const struct mont *m,uint64_t x,uint64_t c)
+{
+	uint64_t y = mont_mul(m,x,x);
+	y = y + c;
+	if(y < c || y >= m->n)
+		y = y - m->n;
+	return y;
+}
+
+/*
+	Brent's variant: the tortoise jumps to the hare at powers of two and
+	the differences are multiplied RHO_BATCH at a time before one gcd.
+	n odd and composite, returns a factor, n itself when c was unlucky.
+*/
+static uint64_t pollard_brent(uint64_t n,uint64_t c)
+{
+	struct mont m;
+	uint64_t x,y,ys,q,g,r,k,i,lim;
+
+	m.n = n;
+	m.inverse = inverse64(n);
+	y = 2;
+	q = 1;
+	g = 1;
+	x = y;
+	ys = y;
+	for(r = 1;1 == g;r = r * 2)
+	{
+		x = y;
+		for(i = 0;i < r;i++)
+			y = rho_step(&m,y,c);
+		for(k = 0;k < r && 1 == g;k = k + RHO_BATCH)
+		{
+			ys = y;
+			lim = r - k < RHO_BATCH ? r - k : RHO_BATCH;
+			for(i = 0;i < lim;i++)
+			{
+				y = rho_step(&m,y,c);
+				q = mont_mul(&m,q,x > y ? x - y : y - x);
+			}
+			g = gcd64(q,n);
+		}
+	}
+	/* the batch overshot, walk it again one gcd at a time */
+	if(g == n)
+	{
+		do
+		{
+			ys = rho_step(&m,ys,c);
+			g = gcd64(x > ys ? x - ys : ys - x,n);
+		}
+		while(1 == g);
+	}
+	return g;
+}
+
+/* n > 1 with no prime factor below FACTOR_TRIAL */
+static int factor_large(uint64_t n,uint64_t *factors,int count)
+{
+	uint64_t d,c;
+	if((unsigned __int128)n < (unsigned __int128)FACTOR_TRIAL * FACTOR_TRIAL || is_prime(n))
+	{
+		factors[count] = n;
+		return count + 1;
+	}
+	for(c = 1;;c++)
+	{
+		d = pollard_brent(n,c);
+		if(d != n)
+			break;
+	}
+	count = factor_large(d,factors,count);
+	return factor_large(n / d,factors,count);
+}
+
+/*
+	prime factors of n with multiplicity in ascending order, at most
+	MAX_FACTORS of them, returns how many; 0 and 1 have none
+*/
+int factor(uint64_t n,uint64_t *factors)
+{
+	uint64_t q,f;
+	int count = 0;
+	int i,j;
+
+	if(n < 2)
+		return 0;
+	while(0 == (n & 1))
+	{
+		factors[count++] = 2;
+		n = n >> 1;
+	}
+	for(i = 0;i < ntrial && 1 != n;i++)
+	{
+		if((uint64_t)trial[i].p * trial[i].p > n)
+			break;
+		while(1)
+		{
+			q = n * trial[i].inverse;
+			if(q > trial[i].limit)
+				break;
+			factors[count++] = trial[i].p;
+			n = q;			/* the exact quotient */
+		}
+	}
+	if(1 == n)
+		return count;
+	if(i < ntrial && (uint64_t)trial[i].p * trial[i].p > n)
+	{
+		factors[count++] = n;		/* no divisor up to its root */
+		return count;
+	}
+	j = count;
+	count = factor_large(n,factors,count);
+	/* rho finds the factors in any order */
+	for(i = j + 1;i < count;i++)
+	{
+		f = factors[i];
+		for(j = i;j > 0 && factors[j - 1] > f;j--)
+			factors[j] = factors[j - 1];
+		factors[j] = f;
+	}
+	return count;
+}
@@ -1,27 +1,16 @@
 #include"header.h"
 int read_request(int socket_fd,int *integer)
 {
-        int n;
-        n = read(socket_fd,integer,sizeof(int));
-        if(0 > n)
-        {
-                perror("\nReading error\n");
+        if(FAILURE == read_full(socket_fd,integer,sizeof(int)))
                 return FAILURE;
-        }
         *integer = ntohl(*integer);
         return SUCCESS;
 }
 
+/* v1 text answer, sprintf terminates the string */
 int check_prime(int integer,char *prime)
 {
-        int i,count =0;
-        memset(prime,0,20);
-        for(i = 2;i <= integer/2;i++)
-        {
-                if(integer%i ==0)
-                count++;
-        }
-        if(count == 0)
+        if(0 < integer && metrics_check(integer))
         {
                 sprintf(prime,"%d is prime",integer);
         }
@@ -34,31 +23,30 @@ int check_prime(int integer,char *prime)
 
 }
 
+/* v1 answer, length and text go out in one writev */
 int write_response(int socket_fd,char *buffer)
 {
+        struct iovec iov[2];
         int len;
-        int n;
+        ssize_t n;
         len = strlen(buffer);
-        int bytes=0;
-        n = write(socket_fd,&len,sizeof(int));
+        iov[0].iov_base = &len;
+        iov[0].iov_len = sizeof(int);
+        iov[1].iov_base = buffer;
+        iov[1].iov_len = len;
+        n = writev(socket_fd,iov,2);
         if(0 > n)
         {
                 perror("Writing err\n");
 		return FAILURE;
         }
-
-        while(bytes<len)
+        if(n < (ssize_t)sizeof(int))
         {
-                n = write(socket_fd,buffer+bytes,len- bytes);
-                if(0 > n)
-                {
-                        perror("Writing Err\n");
+                if(FAILURE == write_full(socket_fd,(char *)&len + n,sizeof(int) - n))
                         return FAILURE;
-                }
-                bytes = bytes + n;
+                n = sizeof(int);
         }
-
-        return SUCCESS;
+        return write_full(socket_fd,buffer + (n - sizeof(int)),len - (n - sizeof(int)));
 }
 
 int write_request(int socket_fd,int *integer)
@@ -74,29 +62,428 @@ int write_request(int socket_fd,int *integer)
         return SUCCESS;
 }
 
+/* buffer holds RESPONSE_SIZE bytes, the text is always terminated */
 int read_response(int socket_fd,char *buffer)
 {
-        memset(buffer,0,20);
-        int len,bytes=0;
-        int n;
-        n = read(socket_fd,&len,sizeof(int));
-        if(0 > n)
+        int len;
+        memset(buffer,0,RESPONSE_SIZE);
+        if(FAILURE == read_full(socket_fd,&len,sizeof(int)))
+                return FAILURE;
+        if(0 > len || RESPONSE_SIZE <= len)
         {
-                perror("Reading error\n");
+                printf("\nBad response length %d\n",len);
                 return FAILURE;
         }
-        while(bytes<len)
+        return read_full(socket_fd,buffer,len);
+}
+
+
+int set_nonblocking(int socket_fd)
+{
+        int flags;
+        flags = fcntl(socket_fd,F_GETFL,0);
+        if(ERR == flags)
         {
-                n = read(socket_fd,buffer+bytes,len-bytes);
-                if(0>n)
+                perror("fcntl error\n");
+                return FAILURE;
+        }
+        if(ERR == fcntl(socket_fd,F_SETFL,flags | O_NONBLOCK))
+        {
+                perror("fcntl error\n");
+                return FAILURE;
+        }
+        return SUCCESS;
+}
+
+int read_full(int socket_fd,void *buffer,size_t len)
+{
+        size_t bytes = 0;
+        ssize_t n;
+        while(bytes < len)
+        {
+                n = read(socket_fd,(char *)buffer + bytes,len - bytes);
+                if(0 > n && EINTR == errno)
+                        continue;
+                if(0 >= n)
+                {
+                        if(0 == n)
+                                errno = ECONNRESET;
+                        perror("Reading error\n");
+                        return FAILURE;
+                }
+                bytes = bytes + n;
+        }
+        return SUCCESS;
+}
+
+int write_full(int socket_fd,const void *buffer,size_t len)
+{
+        size_t bytes = 0;
+        ssize_t n;
+        while(bytes < len)
+        {
+                n = write(socket_fd,(const char *)buffer + bytes,len - bytes);
+                if(0 > n)
                 {
-                        perror("Reading Error\n");
+                        if(EINTR == errno)
+                                continue;
+                        perror("Writing error\n");
                         return FAILURE;
                 }
-                bytes = bytes+n;
+                bytes = bytes + n;
+        }
+        return SUCCESS;
+}
 
+/* connected stream socket to the server's AF_UNIX listener at path */
+int unix_connect(const char *path)
+{
+        struct sockaddr_un server;
+        int socket_fd;
+        if(strlen(path) >= sizeof(server.sun_path))
+        {
+                printf("\nSocket path too long\n");
+                return ERR;
         }
+        socket_fd = socket(AF_UNIX,SOCK_STREAM,0);
+        if(ERR == socket_fd)
+        {
+                perror("\nSocket error");
+                return ERR;
+        }
+        memset(&server,0,sizeof(server));
+        server.sun_family = AF_UNIX;
+        strcpy(server.sun_path,path);
+        if(ERR == connect(socket_fd,(struct sockaddr*)&server,sizeof(server)))
+        {
+                perror("\nConnect error");
+                close(socket_fd);
+                return ERR;
+        }
+        return socket_fd;
+}
+
+/* whole v2 frame in a single write */
+int write_frame(int socket_fd,uint32_t op,const uint64_t *integers,uint32_t count)
+{
+        struct frame_hdr *hdr;
+        uint64_t *payload;
+        uint32_t i;
+        int ret_val;
+        if(0 == count || MAX_BATCH < count)
+                return FAILURE;
+        hdr = malloc(sizeof(struct frame_hdr) + count * sizeof(uint64_t));
+        if(NULL == hdr)
+                return FAILURE;
+        hdr->word = htonl(PROTO_MAGIC | op);
+        hdr->count = htonl(count);
+        payload = (uint64_t *)(hdr + 1);
+        for(i = 0;i < count;i++)
+                payload[i] = htobe64(integers[i]);
+        ret_val = write_full(socket_fd,hdr,sizeof(struct frame_hdr) + count * sizeof(uint64_t));
+        free(hdr);
+        return ret_val;
+}
+
+int write_batch(int socket_fd,const uint64_t *integers,uint32_t count)
+{
+        return write_frame(socket_fd,OP_BATCH,integers,count);
+}
+
+/* an OP_ERROR frame came back in place of the answer */
+static int frame_error(const struct frame_hdr *hdr)
+{
+        if(htonl(PROTO_MAGIC | OP_ERROR) != hdr->word)
+                return 0;
+        if(htonl(ERROR_TIMEOUT) == hdr->count)
+                printf("\nRequest timed out\n");
+        else
+                printf("\nRequest failed : error %u\n",ntohl(hdr->count));
+        return 1;
+}
+
+/* unpacks the bitmask into one 0/1 byte per integer */
+int read_batch_response(int socket_fd,unsigned char *results,uint32_t count)
+{
+        struct frame_hdr hdr;
+        uint32_t i;
+        if(FAILURE == read_full(socket_fd,&hdr,sizeof(hdr)))
+                return FAILURE;
+        if(frame_error(&hdr))
+                return FAILURE;
+        if(htonl(PROTO_MAGIC | OP_BATCH) != hdr.word || htonl(count) != hdr.count)
+        {
+                printf("\nUnexpected batch response\n");
+                return FAILURE;
+        }
+        if(FAILURE == read_full(socket_fd,results,(count + 7) / 8))
+                return FAILURE;
+        for(i = count;i-- > 0;)		/* backwards, the bitmask sits in front */
+                results[i] = (results[i / 8] >> (i % 8)) & 1;
         return SUCCESS;
 }
 
+int write_check(int socket_fd,uint64_t integer)
+{
+        return write_frame(socket_fd,OP_CHECK,&integer,1);
+}
 
+/* a status byte, or the first byte of an OP_ERROR frame */
+int read_check_response(int socket_fd,unsigned char *status)
+{
+        struct frame_hdr hdr;
+        if(FAILURE == read_full(socket_fd,status,1))
+                return FAILURE;
+        if(PROTO_MAGIC >> 24 != *status)
+                return SUCCESS;
+        memcpy(&hdr,status,1);
+        if(FAILURE == read_full(socket_fd,(char *)&hdr + 1,sizeof(hdr) - 1))
+                return FAILURE;
+        frame_error(&hdr);
+        return FAILURE;
+}
+
+int write_stats(int socket_fd)
+{
+        struct frame_hdr hdr;
+        hdr.word = htonl(PROTO_MAGIC | OP_STATS);
+        hdr.count = 0;
+        return write_full(socket_fd,&hdr,sizeof(hdr));
+}
+
+/* *count is the room in stats on entry and the values stored on return */
+int read_stats_response(int socket_fd,uint64_t *stats,uint32_t *count)
+{
+        struct frame_hdr hdr;
+        uint64_t value;
+        uint32_t i,n;
+        if(FAILURE == read_full(socket_fd,&hdr,sizeof(hdr)))
+                return FAILURE;
+        if(frame_error(&hdr))
+                return FAILURE;
+        n = ntohl(hdr.count);
+        if(htonl(PROTO_MAGIC | OP_STATS) != hdr.word || MAX_BATCH < n)
+        {
+                printf("\nUnexpected stats response\n");
+                return FAILURE;
+        }
+        for(i = 0;i < n;i++)
+        {
+                if(FAILURE == read_full(socket_fd,&value,sizeof(value)))
+                        return FAILURE;
+                if(i < *count)
+                        stats[i] = be64toh(value);
+        }
+        if(n < *count)
+                *count = n;
+        return SUCCESS;
+}
+
+int write_range(int socket_fd,uint32_t op,uint64_t a,uint64_t b)
+{
+        uint64_t integers[2];
+        integers[0] = a;
+        integers[1] = b;
+        return write_frame(socket_fd,op,integers,2);
+}
+
+int read_range_count(int socket_fd,uint64_t *count)
+{
+        struct frame_hdr hdr;
+        if(FAILURE == read_full(socket_fd,&hdr,sizeof(hdr)))
+                return FAILURE;
+        if(frame_error(&hdr))
+                return FAILURE;
+        if(htonl(PROTO_MAGIC | OP_RANGE_COUNT) != hdr.word || htonl(1) != hdr.count)
+        {
+                printf("\nUnexpected range response\n");
+                return FAILURE;
+        }
+        if(FAILURE == read_full(socket_fd,count,sizeof(uint64_t)))
+                return FAILURE;
+        *count = be64toh(*count);
+        return SUCCESS;
+}
+
+/* the packed bitmap of n numbers, (n + 7) / 8 bytes */
+int read_range_bitmap(int socket_fd,unsigned char *bitmap,uint64_t n)
+{
+        struct frame_hdr hdr;
+        if(FAILURE == read_full(socket_fd,&hdr,sizeof(hdr)))
+                return FAILURE;
+        if(frame_error(&hdr))
+                return FAILURE;
+        if(htonl(PROTO_MAGIC | OP_RANGE_BITMAP) != hdr.word || htonl(n) != hdr.count)
+        {
+                printf("\nUnexpected range response\n");
+                return FAILURE;
+        }
+        return read_full(socket_fd,bitmap,(n + 7) / 8);
+}
+
+/* factors of integer i go to factors + i * MAX_FACTORS, nfactors[i] of them */
+int read_factor_response(int socket_fd,uint32_t count,uint64_t *factors,unsigned char *nfactors)
+{
+        struct frame_hdr hdr;
+        uint64_t *f;
+        uint32_t i,j;
+        if(FAILURE == read_full(socket_fd,&hdr,sizeof(hdr)))
+                return FAILURE;
+        if(frame_error(&hdr))
+                return FAILURE;
+        if(htonl(PROTO_MAGIC | OP_FACTOR) != hdr.word || htonl(count) != hdr.count)
+        {
+                printf("\nUnexpected factor response\n");
+                return FAILURE;
+        }
+        for(i = 0;i < count;i++)
+        {
+                if(FAILURE == read_full(socket_fd,&nfactors[i],1))
+                        return FAILURE;
+                if(MAX_FACTORS < nfactors[i])
+                {
+                        printf("\nUnexpected factor response\n");
+                        return FAILURE;
+                }
+                f = factors + (size_t)i * MAX_FACTORS;
+                if(FAILURE == read_full(socket_fd,f,nfactors[i] * sizeof(uint64_t)))
+                        return FAILURE;
+                for(j = 0;j < nfactors[i];j++)
+                        f[j] = be64toh(f[j]);
+        }
+        return SUCCESS;
+}
+
+int rbuf_init(struct rbuf *rb,size_t cap)
+{
+        rb->data = malloc(cap);
+        if(NULL == rb->data)
+                return FAILURE;
+        rb->start = 0;
+        rb->end = 0;
+        rb->cap = cap;
+        return SUCCESS;
+}
+
+void rbuf_free(struct rbuf *rb)
+{
+        free(rb->data);
+        rb->data = NULL;
+}
+
+/*
+        Moves a partial frame to the front and grows the buffer when it
+        has to hold more than cap bytes.
+*/
+static int rbuf_make_room(struct rbuf *rb,size_t need)
+{
+        char *data;
+        size_t cap;
+        if(0 < rb->start)
+        {
+                memmove(rb->data,rb->data + rb->start,rb->end - rb->start);
+                rb->end = rb->end - rb->start;
+                rb->start = 0;
+        }
+        if(need > rb->cap)
+        {
+                cap = rb->cap;
+                while(cap < need)
+                        cap = cap * 2;
+                data = realloc(rb->data,cap);
+                if(NULL == data)
+                {
+                        errno = ENOMEM;
+                        return FAILURE;
+                }
+                rb->data = data;
+                rb->cap = cap;
+        }
+        return SUCCESS;
+}
+
+/*
+        One recv() into the free space, after making room for a partial
+        frame that needs more than cap bytes. Returns what recv() returned.
+*/
+ssize_t rbuf_fill(struct rbuf *rb,int socket_fd,size_t need)
+{
+        ssize_t n;
+        if(FAILURE == rbuf_make_room(rb,need))
+                return ERR;
+        do
+                n = recv(socket_fd,rb->data + rb->end,rb->cap - rb->end,0);
+        while(0 > n && EINTR == errno);
+        if(0 < n)
+                rb->end = rb->end + n;
+        return n;
+}
+
+/* for backends whose data arrives elsewhere, e.g. in a provided buffer */
+int rbuf_append(struct rbuf *rb,const char *data,size_t len)
+{
+        if(FAILURE == rbuf_make_room(rb,rb->end - rb->start + len))
+                return FAILURE;
+        memcpy(rb->data + rb->end,data,len);
+        rb->end = rb->end + len;
+        return SUCCESS;
+}
+
+/*
+        Parses one request at data. Returns its length when it is complete,
+        0 when more bytes are needed (*need says how many in total) and ERR
+        for a malformed frame. A v1 integer is reported as OP_V1.
+*/
+ssize_t parse_frame(const char *data,size_t len,struct frame *f,size_t *need)
+{
+        uint32_t word,count;
+        size_t total;
+        *need = sizeof(uint32_t);
+        if(len < sizeof(uint32_t))
+                return 0;
+        memcpy(&word,data,sizeof(uint32_t));
+        word = ntohl(word);
+        if(PROTO_MAGIC != (word & PROTO_MAGIC_MASK))
+        {
+                f->op = OP_V1;
+                f->count = 1;
+                f->value = (int)word;
+                f->payload = NULL;
+                return sizeof(uint32_t);
+        }
+        *need = sizeof(struct frame_hdr);
+        if(len < sizeof(struct frame_hdr))
+                return 0;
+        memcpy(&count,data + sizeof(uint32_t),sizeof(uint32_t));
+        f->op = word & ~PROTO_MAGIC_MASK;
+        f->count = ntohl(count);
+        if(OP_BATCH != f->op && OP_CHECK != f->op && OP_STATS != f->op &&
+                OP_RANGE_COUNT != f->op && OP_RANGE_BITMAP != f->op && OP_FACTOR != f->op &&
+                OP_SHM != f->op)
+                return ERR;
+        if(OP_STATS == f->op || OP_SHM == f->op)
+        {
+                if(0 != f->count)
+                        return ERR;
+        }
+        else if(OP_RANGE_COUNT == f->op || OP_RANGE_BITMAP == f->op)
+        {
+                if(2 != f->count)
+                        return ERR;
+        }
+        else if(0 == f->count || MAX_BATCH < f->count || (OP_CHECK == f->op && 1 != f->count))
+                return ERR;
+        total = sizeof(struct frame_hdr) + (size_t)f->count * sizeof(uint64_t);
+        *need = total;
+        if(len < total)
+                return 0;
+        f->payload = data + sizeof(struct frame_hdr);
+        return total;
+}
+
+uint64_t frame_integer(const struct frame *f,uint32_t i)
+{
+        uint64_t integer;
+        memcpy(&integer,f->payload + i * sizeof(uint64_t),sizeof(uint64_t));
+        return be64toh(integer);
+}
@@ -1,3 +1,6 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE	/* accept4(), CPU affinity */
+#endif
 #include<stdio.h>
 #include<stdlib.h>
 #include<sys/types.h>
@@ -7,16 +10,355 @@
 #include<arpa/inet.h>
 #include<netinet/in.h>
 #include<string.h>
+#include<stdint.h>
+#include<errno.h>
+#include<pthread.h>
+#include<sched.h>
+#include<endian.h>
+#include<sys/uio.h>
+#include<sys/un.h>
 
 #define SUCCESS 0
 #define FAILURE 1
 #define ERR -1
 #define ZERO 0
 #define PORT 39000
+#define UNIX_PATH "/tmp/prime_server.sock"	/* default AF_UNIX listener, --unix */
+
+#define LISTEN_BACKLOG 1024	/* pending connections queued by the kernel */
+#define MAX_EVENTS 256		/* epoll events fetched per epoll_wait() */
+#define SIEVE_LIMIT (1ULL << 24)	/* numbers below it are answered from the sieve, --sieve-limit */
+#define SIEVE_MAX (1ULL << 36)		/* largest --sieve-limit, a 4 GB bitset */
+#define SIEVE_FILE "/tmp/prime_sieve.bin"	/* default --sieve-file */
+#define CACHE_MB 16		/* default result cache size, --cache-mb */
+
+/*
+	v2 frame, all fields in network order
+	request  - header word, count, count 8 byte integers
+	The top byte of the header word is PROTO_MAGIC, which no positive v1
+	integer has, so v1 and v2 clients share the port.
+
+	OP_CHECK response - one status byte
+	OP_BATCH response - header word, count, bitmask of (count + 7) / 8
+			    bytes, bit i of byte i / 8 set when integer i is prime
+	OP_STATS request  - count 0, no integers
+	OP_STATS response - header word, count, count 8 byte STAT_* values
+	OP_RANGE_COUNT request   - count 2, integers a and b
+	OP_RANGE_COUNT response  - header word, count 1, 8 byte number of
+				   primes in [a, b]
+	OP_RANGE_BITMAP request  - count 2, integers a and b
+	OP_RANGE_BITMAP response - header word, count b - a + 1, bitmask as
+				   for OP_BATCH, bit i set when a + i is prime
+	OP_FACTOR request  - count integers as for OP_BATCH
+	OP_FACTOR response - header word, count, then for every integer one
+			     byte with its number of prime factors m and m 8
+			     byte factors, ascending and with multiplicity;
+			     0 and 1 have none
+	OP_SHM request  - count 0, AF_UNIX connections only
+	OP_SHM response - header word, count is the size of the shared region,
+			  its memfd passed as SCM_RIGHTS; later frames go through
+			  the rings of shm.c and the socket only carries doorbells
+	OP_ERROR response - header word, count is the ERROR_* code, sent in
+			    place of the answer to any v2 request; a v1
+			    request gets the text "<n> timed out" instead
+*/
+#define PROTO_MAGIC 0xB2000000u
+#define PROTO_MAGIC_MASK 0xFF000000u
+#define OP_BATCH 1
+#define OP_CHECK 2
+#define OP_STATS 3
+#define OP_RANGE_COUNT 4
+#define OP_RANGE_BITMAP 5
+#define OP_FACTOR 6
+#define OP_SHM 7
+#define OP_ERROR 0xFF
+#define ERROR_TIMEOUT 1		/* the request ran past its deadline */
+#define ERROR_UNSUPPORTED 2	/* OP_SHM over TCP or on a backend without it */
+#define ERROR_BAD_DATAGRAM 3	/* UDP only, truncated, malformed or not a batch */
+#define MAX_BATCH 65536		/* largest count accepted in one frame */
+#define MAX_RANGE_BITMAP (1ULL << 27)	/* widest OP_RANGE_BITMAP, a 16 MB answer */
+#define MAX_RANGE_COUNT (1ULL << 34)	/* widest OP_RANGE_COUNT, about a minute on one core */
+#define MAX_FACTORS 64		/* prime factors of a 64 bit number, with multiplicity */
+#define SHM_RING_BYTES (1 << 16)	/* each direction of a shared memory connection */
+
+/*
+	UDP datagram on PORT - 4 byte id the reply echoes, then one OP_BATCH
+	or OP_CHECK frame of at most UDP_MAX_BATCH integers filling the rest
+	of the datagram exactly. The reply is the id and the TCP answer.
+	Nothing is retransmitted or ordered: a lost request or reply is only
+	noticed by the client, which resends after a timeout, the checks are
+	idempotent. A datagram past UDP_DATAGRAM bytes is truncated by the
+	kernel; it, and any other malformed one, gets the id and OP_ERROR
+	ERROR_BAD_DATAGRAM, or nothing when not even the id arrived.
+*/
+#define UDP_MAX_BATCH 180	/* 1452 byte request, fits a 1500 byte MTU */
+#define UDP_DATAGRAM 2048	/* receive buffer per datagram */
+#define UDP_VLEN 64		/* default --udp-batch, datagrams per recvmmsg() */
+#define UDP_RCVBUF (4 << 20)	/* receive buffer of the UDP socket */
+
+#define OP_V1 0			/* parse_frame() result for a v1 integer */
+
+#define STATUS_NOT_PRIME 0
+#define STATUS_PRIME 1
+#define PRIME_UNKNOWN 2		/* prime_screen(), up to Miller-Rabin */
+
+struct frame_hdr
+{
+	uint32_t word;		/* PROTO_MAGIC | opcode */
+	uint32_t count;
+};
+
+#define RESPONSE_SIZE 20	/* v1 text answer buffer */
+#define RBUF_SIZE 16384		/* initial per-connection input buffer */
+
+/* request parsed out of an input buffer, payload points into it */
+struct frame
+{
+	uint32_t op;
+	uint32_t count;
+	int value;		/* OP_V1 integer */
+	const char *payload;	/* count integers, network order */
+};
+
+/* input buffer, bytes start..end are received but not yet parsed */
+struct rbuf
+{
+	char *data;
+	size_t start;
+	size_t end;
+	size_t cap;
+};
+
+#define HIST_SUB_BITS 7
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+/* log-linear histogram, see hist.c */
+struct hist
+{
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+};
+
+/* OP_STATS values in response order, see metrics.c */
+#define STAT_REQUESTS 0
+#define STAT_BYTES_IN 1
+#define STAT_BYTES_OUT 2
+#define STAT_ERRORS 3
+#define STAT_ACTIVE 4
+#define STAT_CACHE_HITS 5
+#define STAT_CACHE_MISSES 6
+#define STAT_CHECK_P50 7
+#define STAT_CHECK_P99 8
+#define STAT_CHECK_P999 9
+#define STAT_CHECK_MAX 10
+#define STAT_REQUEST_P50 11
+#define STAT_REQUEST_P99 12
+#define STAT_REQUEST_P999 13
+#define STAT_REQUEST_MAX 14
+#define STAT_TIMEOUTS 15
+#define STAT_IDLE_CLOSED 16
+#define STAT_COALESCED 17
+#define STAT_UDP_IN 18
+#define STAT_UDP_BAD 19		/* malformed or truncated datagrams */
+#define STAT_UDP_DROPPED 20	/* replies the socket buffer had no room for */
+#define STAT_FIELDS 21
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4		/* 64^4 ms, about 4.6 hours */
+
+/* timer wheel entry, see timer.c */
+struct timer
+{
+	struct timer *next;
+	struct timer *prev;	/* NULL while not armed */
+	uint64_t expires;	/* tick */
+	struct wheel *wheel;
+	int kind;		/* TIMER_IDLE or TIMER_DEADLINE */
+	void *owner;		/* the conn or the task */
+};
+
+#define TIMER_IDLE 0
+#define TIMER_DEADLINE 1
+
+struct wheel
+{
+	uint64_t tick;		/* next tick to expire, in ms */
+	uint64_t armed;
+	struct timer slot[WHEEL_LEVELS][WHEEL_SLOTS];	/* list heads */
+};
+
+#define IDLE_TIMEOUT 60		/* default --idle, seconds */
+#define TASK_DEADLINE 10000	/* default --deadline, ms */
+
+/* connection state shared by the server backends, see conn.c */
+struct conn
+{
+	int fd;
+	struct rbuf in;		/* received bytes, may end in a partial frame */
+	size_t need;		/* bytes the partial frame needs in total */
+	char *out;		/* responses not yet accepted by the kernel */
+	size_t out_len;
+	size_t out_off;
+	size_t out_cap;
+	int closing;		/* client sent 0, close once out is flushed */
+	struct task *tasks;	/* answers behind an offloaded one, in order */
+	struct task *tasks_tail;
+	int inflight;		/* tasks in the pool, keep the conn until 0 */
+	struct completions *cq;	/* where the pool returns tasks, NULL inline only */
+	struct wheel *wheel;	/* of the I/O thread, NULL for no timeouts */
+	struct timer idle;
+	const int *cancel;	/* task answers only, give up once it is set */
+	int shm_ok;		/* AF_UNIX on a backend serving OP_SHM */
+	int shm_wanted;		/* OP_SHM parsed, the backend offers the rings */
+	struct shm_region *shm;	/* frames go through it once set, see shm.c */
+};
+
+/* a request answered off the I/O thread, see pool.c */
+struct task
+{
+	struct conn *c;
+	struct frame f;		/* payload points to integers */
+	char *integers;
+	uint64_t start;		/* receipt, for the request latency */
+	struct conn answer;	/* only its output buffer is used */
+	int ret_val;		/* FAILURE closes the connection like a bad frame */
+	int done;
+	int cancel;		/* set by the deadline, read by the pool thread */
+	int expired;		/* answered with ERROR_TIMEOUT */
+	int orphan;		/* expired and unlinked, freed once back from the pool */
+	struct timer deadline;
+	struct task *next;	/* in request order on the connection */
+	struct task *next_done;	/* on the completion list */
+};
+
+/* finished tasks of one I/O thread, efd is readable while it is not empty */
+struct completions
+{
+	pthread_mutex_t lock;
+	struct task *head;
+	int efd;
+};
+
+#define POOL_MIN_COST 16	/* default --offload, in Miller-Rabin tests */
 
 int write_request(int,int*);
 int read_response(int,char *);
 int read_request(int,int *);
 int write_response(int,char *);
 int check_prime(int,char *);
+int write_frame(int,uint32_t,const uint64_t *,uint32_t);
+int write_batch(int,const uint64_t *,uint32_t);
+int read_batch_response(int,unsigned char *,uint32_t);
+int write_check(int,uint64_t);
+int read_check_response(int,unsigned char *);
+int write_stats(int);
+int read_stats_response(int,uint64_t *,uint32_t *);
+int write_range(int,uint32_t,uint64_t,uint64_t);
+int read_range_count(int,uint64_t *);
+int read_range_bitmap(int,unsigned char *,uint64_t);
+int read_factor_response(int,uint32_t,uint64_t *,unsigned char *);
+int read_full(int,void *,size_t);
+int unix_connect(const char *);
+int write_full(int,const void *,size_t);
+
+struct pclient;
+struct pfuture;
+struct pclient *pclient_open(const char *,int,int,int);
+struct pfuture *pclient_check(struct pclient *,uint64_t);
+int pclient_check_cb(struct pclient *,uint64_t,void (*)(void *,uint64_t,int),void *);
+int pfuture_wait(struct pclient *,struct pfuture *);
+void pclient_close(struct pclient *);
+
+struct shm_client;
+struct shm_client *shm_connect(const char *);
+int shm_write(struct shm_client *,const void *,size_t);
+int shm_read(struct shm_client *,void *,size_t);
+void shm_close(struct shm_client *);
+int shm_offer(struct conn *);
+void shm_release(struct conn *);
+ssize_t shm_pull(struct conn *);
+int shm_push(struct conn *);
+int shm_sleep(struct conn *);
+
+int rbuf_init(struct rbuf *,size_t);
+void rbuf_free(struct rbuf *);
+ssize_t rbuf_fill(struct rbuf *,int,size_t);
+int rbuf_append(struct rbuf *,const char *,size_t);
+ssize_t parse_frame(const char *,size_t,struct frame *,size_t *);
+uint64_t frame_integer(const struct frame *,uint32_t);
+
+int prime_init(uint64_t);
+int prime_load(const char *,uint64_t,int *);
+int is_prime(uint64_t);
+int is_prime_screened(uint64_t);
+int is_sieved(uint64_t);
+uint64_t inverse64(uint64_t);
+int prime_simd(int);
+void prime_screen(const uint64_t *,size_t,unsigned char *);
+void is_prime_batch(const uint64_t *,size_t,unsigned char *);
+
+int factor_init(void);
+int factor(uint64_t,uint64_t *);
+
+int range_init(int);
+int range_valid(uint64_t,uint64_t);
+uint64_t range_query(uint64_t,uint64_t,unsigned char *,const int *);
+
+int cache_init(size_t);
+int is_prime_cached(uint64_t);
+int is_screened_cached(uint64_t);
+void cache_coalesce(int);
+void cache_stats(uint64_t *,uint64_t *,uint64_t *);
+
+int conn_init(struct conn *,int);
+void conn_destroy(struct conn *);
+char *conn_reserve(struct conn *,size_t);
+int conn_queue(struct conn *,const void *,size_t);
+int conn_parse(struct conn *);
+void conn_run_task(struct task *);
+void conn_task_done(struct task *);
+int conn_collect(struct conn *);
+void conn_attach(struct conn *,struct completions *,struct wheel *);
+void conn_timeouts(uint64_t,uint64_t);
+void conn_task_expired(struct task *);
+int conn_idle(struct conn *);
+
+void wheel_init(struct wheel *,uint64_t);
+void timer_arm(struct wheel *,struct timer *,uint64_t);
+void timer_cancel(struct timer *);
+struct timer *wheel_advance(struct wheel *,uint64_t);
+int wheel_timeout(const struct wheel *);
+uint64_t wheel_now(void);
+
+int pool_init(int,uint64_t);
+int pool_wanted(uint64_t);
+int pool_submit(struct task *);
+int completions_init(struct completions *);
+struct task *completions_take(struct completions *);
+
+void hist_record(struct hist *,uint64_t);
+void hist_merge(struct hist *,const struct hist *);
+uint64_t hist_percentile(const struct hist *,double);
+
+uint64_t metrics_now(void);
+void metrics_add(int,uint64_t);
+void metrics_conn(int);
+int metrics_check(uint64_t);
+int metrics_check_screened(uint64_t);
+int metrics_check_batch(const struct frame *,unsigned char *,const int *);
+void metrics_request(uint64_t);
+void metrics_collect(uint64_t *);
+void metrics_print(FILE *,const uint64_t *,uint32_t);
+void *metrics_dump(void *);
+
+struct udp;
+void udp_batch(int);
+struct udp *udp_open(int);
+void udp_readable(struct udp *);
+
+int set_nonblocking(int);
+int run_epoll_server(int,int,int);
+int run_uring_server(int,int,int);
 
@@ -0,0 +1,69 @@
+/*
+	Log-linear latency histogram in the HdrHistogram style: values below
+	2^HIST_SUB_BITS get a bucket each, above that every power of two is
+	split into 2^HIST_SUB_BITS buckets, so any recorded value is off by
+	less than 1 %. One writer per histogram, merge them to report. The
+	fields are stored and merged with relaxed atomics, so a histogram can
+	be merged while its owner is still recording into it.
+*/
+
+#include"header.h"
+
+static unsigned int hist_index(uint64_t v)
+{
+	unsigned int e;
+	if(v < (1u << HIST_SUB_BITS))
+		return v;
+	e = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+	return ((e + 1) << HIST_SUB_BITS) + (unsigned int)((v >> e) - (1u << HIST_SUB_BITS));
+}
+
+/* highest value that falls in bucket idx */
+static uint64_t hist_value(unsigned int idx)
+{
+	unsigned int e;
+	if(idx < (1u << HIST_SUB_BITS))
+		return idx;
+	e = (idx >> HIST_SUB_BITS) - 1;
+	return ((((uint64_t)1 << HIST_SUB_BITS) + (idx & ((1u << HIST_SUB_BITS) - 1)) + 1) << e) - 1;
+}
+
+void hist_record(struct hist *h,uint64_t v)
+{
+	unsigned int i = hist_index(v);
+	__atomic_store_n(&h->counts[i],h->counts[i] + 1,__ATOMIC_RELAXED);
+	__atomic_store_n(&h->total,h->total + 1,__ATOMIC_RELAXED);
+	if(v > h->max)
+		__atomic_store_n(&h->max,v,__ATOMIC_RELAXED);
+}
+
+void hist_merge(struct hist *dst,const struct hist *src)
+{
+	unsigned int i;
+	uint64_t max;
+	for(i = 0;i < HIST_BUCKETS;i++)
+		dst->counts[i] = dst->counts[i] + __atomic_load_n(&src->counts[i],__ATOMIC_RELAXED);
+	dst->total = dst->total + __atomic_load_n(&src->total,__ATOMIC_RELAXED);
+	max = __atomic_load_n(&src->max,__ATOMIC_RELAXED);
+	if(max > dst->max)
+		dst->max = max;
+}
+
+/* value below which the given percentage of the records fall */
+uint64_t hist_percentile(const struct hist *h,double percent)
+{
+	uint64_t want,seen = 0;
+	unsigned int i;
+	if(0 == h->total)
+		return 0;
+	want = (uint64_t)(h->total * percent / 100.0);
+	if(want >= h->total)
+		return h->max;
+	for(i = 0;i < HIST_BUCKETS;i++)
+	{
+		seen = seen + h->counts[i];
+		if(seen > want)
+			return hist_value(i) < h->max ? hist_value(i) : h->max;
+	}
+	return h->max;
+}
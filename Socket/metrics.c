@@ -0,0 +1,250 @@
+/*
+	Server metrics. Every thread owns a block of counters and latency
+	histograms and is the only writer of it, so recording is a few plain
+	stores with no lock or atomic read-modify-write. metrics_collect()
+	walks the list of blocks and sums them, a reader may see a value one
+	update behind but never a torn one.
+*/
+
+#include"header.h"
+#include<stdatomic.h>
+#include<time.h>
+
+struct metrics
+{
+	_Atomic uint64_t requests;
+	_Atomic uint64_t bytes_in;
+	_Atomic uint64_t bytes_out;
+	_Atomic uint64_t errors;
+	_Atomic uint64_t timeouts;
+	_Atomic uint64_t idle_closed;
+	_Atomic uint64_t opened;		/* connections */
+	_Atomic uint64_t closed;
+	_Atomic uint64_t udp_in;		/* datagrams */
+	_Atomic uint64_t udp_bad;
+	_Atomic uint64_t udp_dropped;
+	struct hist check;			/* ns per check_prime past the sieve */
+	struct hist request;			/* ns from receipt to queued answer */
+	struct metrics *next;
+} __attribute__((aligned(64)));		/* no line shared with another thread's block */
+
+static struct metrics *metrics_list;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct metrics *my_metrics;
+
+static const char *stat_names[STAT_FIELDS] = {
+	"requests", "bytes_in", "bytes_out", "errors", "active_conns",
+	"cache_hits", "cache_misses",
+	"check_p50_ns", "check_p99_ns", "check_p999_ns", "check_max_ns",
+	"request_p50_ns", "request_p99_ns", "request_p999_ns", "request_max_ns",
+	"timeouts", "idle_closed", "coalesced", "udp_in", "udp_bad", "udp_dropped"
+};
+
+uint64_t metrics_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct metrics *metrics(void)
+{
+	if(NULL == my_metrics)
+	{
+		my_metrics = aligned_alloc(64,sizeof(struct metrics));
+		if(NULL == my_metrics)
+		{
+			perror("metrics allocation error\n");
+			exit(EXIT_FAILURE);
+		}
+		memset(my_metrics,0,sizeof(struct metrics));
+		pthread_mutex_lock(&metrics_lock);
+		my_metrics->next = metrics_list;
+		metrics_list = my_metrics;
+		pthread_mutex_unlock(&metrics_lock);
+	}
+	return my_metrics;
+}
+
+static void counter_add(_Atomic uint64_t *counter,uint64_t n)
+{
+	atomic_store_explicit(counter,atomic_load_explicit(counter,memory_order_relaxed) + n,memory_order_relaxed);
+}
+
+void metrics_add(int counter,uint64_t n)
+{
+	struct metrics *m = metrics();
+	switch(counter)
+	{
+	case STAT_REQUESTS:
+		counter_add(&m->requests,n);
+		break;
+	case STAT_BYTES_IN:
+		counter_add(&m->bytes_in,n);
+		break;
+	case STAT_BYTES_OUT:
+		counter_add(&m->bytes_out,n);
+		break;
+	case STAT_ERRORS:
+		counter_add(&m->errors,n);
+		break;
+	case STAT_TIMEOUTS:
+		counter_add(&m->timeouts,n);
+		break;
+	case STAT_IDLE_CLOSED:
+		counter_add(&m->idle_closed,n);
+		break;
+	case STAT_UDP_IN:
+		counter_add(&m->udp_in,n);
+		break;
+	case STAT_UDP_BAD:
+		counter_add(&m->udp_bad,n);
+		break;
+	case STAT_UDP_DROPPED:
+		counter_add(&m->udp_dropped,n);
+		break;
+	}
+}
+
+void metrics_conn(int opened)
+{
+	struct metrics *m = metrics();
+	if(opened)
+		counter_add(&m->opened,1);
+	else
+		counter_add(&m->closed,1);
+}
+
+/*
+	is_prime_cached() with its latency recorded. A sieve lookup is a few
+	ns, less than the two clock reads, so only numbers past the sieve are
+	timed, clocking every lookup cost a quarter of the request rate.
+*/
+int metrics_check(uint64_t n)
+{
+	uint64_t start;
+	int result;
+	if(is_sieved(n))
+		return is_prime(n);
+	start = metrics_now();
+	result = is_prime_cached(n);
+	hist_record(&metrics()->check,metrics_now() - start);
+	return result;
+}
+
+/* is_screened_cached() timed the same way, prime_screen() already did the sieve */
+int metrics_check_screened(uint64_t n)
+{
+	uint64_t start;
+	int result;
+	start = metrics_now();
+	result = is_screened_cached(n);
+	hist_record(&metrics()->check,metrics_now() - start);
+	return result;
+}
+
+/*
+	metrics_check() of the integers of an OP_BATCH frame into the zeroed
+	bitmask, SCREEN_CHUNK at a time: prime_screen() settles what it can
+	and only the rest goes through the cache to Miller-Rabin, without
+	repeating the trial division. FAILURE
+	when cancel was set between two chunks.
+*/
+#define SCREEN_CHUNK 256
+
+int metrics_check_batch(const struct frame *f,unsigned char *bitmask,const int *cancel)
+{
+	uint64_t n[SCREEN_CHUNK];
+	unsigned char status[SCREEN_CHUNK];
+	uint32_t i,j,len;
+	for(i = 0;i < f->count;i = i + len)
+	{
+		if(NULL != cancel && __atomic_load_n(cancel,__ATOMIC_RELAXED))
+			return FAILURE;
+		len = f->count - i < SCREEN_CHUNK ? f->count - i : SCREEN_CHUNK;
+		for(j = 0;j < len;j++)
+			n[j] = frame_integer(f,i + j);
+		prime_screen(n,len,status);
+		for(j = 0;j < len;j++)
+			if(STATUS_PRIME == status[j] || (PRIME_UNKNOWN == status[j] && metrics_check_screened(n[j])))
+				bitmask[(i + j) / 8] |= 1 << ((i + j) % 8);
+	}
+	return SUCCESS;
+}
+
+void metrics_request(uint64_t start)
+{
+	struct metrics *m = metrics();
+	counter_add(&m->requests,1);
+	hist_record(&m->request,metrics_now() - start);
+}
+
+/* fills STAT_FIELDS values, sums over all threads */
+void metrics_collect(uint64_t *stats)
+{
+	struct metrics *m;
+	struct hist *check,*request;
+	uint64_t opened = 0,closed = 0;
+
+	check = calloc(2,sizeof(struct hist));
+	if(NULL == check)
+	{
+		memset(stats,0,STAT_FIELDS * sizeof(uint64_t));
+		return;
+	}
+	request = check + 1;
+	memset(stats,0,STAT_FIELDS * sizeof(uint64_t));
+	pthread_mutex_lock(&metrics_lock);
+	for(m = metrics_list;NULL != m;m = m->next)
+	{
+		stats[STAT_REQUESTS] += atomic_load_explicit(&m->requests,memory_order_relaxed);
+		stats[STAT_BYTES_IN] += atomic_load_explicit(&m->bytes_in,memory_order_relaxed);
+		stats[STAT_BYTES_OUT] += atomic_load_explicit(&m->bytes_out,memory_order_relaxed);
+		stats[STAT_ERRORS] += atomic_load_explicit(&m->errors,memory_order_relaxed);
+		stats[STAT_TIMEOUTS] += atomic_load_explicit(&m->timeouts,memory_order_relaxed);
+		stats[STAT_IDLE_CLOSED] += atomic_load_explicit(&m->idle_closed,memory_order_relaxed);
+		stats[STAT_UDP_IN] += atomic_load_explicit(&m->udp_in,memory_order_relaxed);
+		stats[STAT_UDP_BAD] += atomic_load_explicit(&m->udp_bad,memory_order_relaxed);
+		stats[STAT_UDP_DROPPED] += atomic_load_explicit(&m->udp_dropped,memory_order_relaxed);
+		opened += atomic_load_explicit(&m->opened,memory_order_relaxed);
+		closed += atomic_load_explicit(&m->closed,memory_order_relaxed);
+		hist_merge(check,&m->check);
+		hist_merge(request,&m->request);
+	}
+	pthread_mutex_unlock(&metrics_lock);
+	stats[STAT_ACTIVE] = opened > closed ? opened - closed : 0;
+	cache_stats(&stats[STAT_CACHE_HITS],&stats[STAT_CACHE_MISSES],&stats[STAT_COALESCED]);
+	stats[STAT_CHECK_P50] = hist_percentile(check,50);
+	stats[STAT_CHECK_P99] = hist_percentile(check,99);
+	stats[STAT_CHECK_P999] = hist_percentile(check,99.9);
+	stats[STAT_CHECK_MAX] = check->max;
+	stats[STAT_REQUEST_P50] = hist_percentile(request,50);
+	stats[STAT_REQUEST_P99] = hist_percentile(request,99);
+	stats[STAT_REQUEST_P999] = hist_percentile(request,99.9);
+	stats[STAT_REQUEST_MAX] = request->max;
+	free(check);
+}
+
+/* one name=value line, count may be short of STAT_FIELDS for an older server */
+void metrics_print(FILE *fp,const uint64_t *stats,uint32_t count)
+{
+	uint32_t i;
+	for(i = 0;i < count && i < STAT_FIELDS;i++)
+		fprintf(fp,"%s%s=%llu",i ? " " : "",stat_names[i],(unsigned long long)stats[i]);
+	fprintf(fp,"\n");
+	fflush(fp);
+}
+
+/* dump thread started by the server, seconds apart */
+void *metrics_dump(void *arg)
+{
+	int seconds = *(int *)arg;
+	uint64_t stats[STAT_FIELDS];
+	while(1)
+	{
+		sleep(seconds);
+		metrics_collect(stats);
+		metrics_print(stdout,stats,STAT_FIELDS);
+	}
+	return NULL;
+}
@@ -1,5 +1,133 @@
 #include"header.h"
 
+#define CLIENT_BATCH 1024	/* numbers sent per v2 frame in batch mode */
+
+/* check every number of the file, one v2 frame per CLIENT_BATCH numbers */
+static int run_batch(int socket_fd,const char *path)
+{
+	FILE *fp;
+	uint64_t integers[CLIENT_BATCH];
+	unsigned char results[CLIENT_BATCH];
+	unsigned long long value;
+	uint32_t count,i;
+	int done = 0;
+
+	fp = fopen(path,"r");
+	if(NULL == fp)
+	{
+		perror("\nUnable to open batch file");
+		return FAILURE;
+	}
+	while(!done)
+	{
+		for(count = 0;count < CLIENT_BATCH;count++)
+		{
+			if(1 != fscanf(fp,"%llu",&value))
+			{
+				done = 1;
+				break;
+			}
+			integers[count] = value;
+		}
+		if(0 == count)
+			break;
+		if(FAILURE == write_batch(socket_fd,integers,count) ||
+			FAILURE == read_batch_response(socket_fd,results,count))
+		{
+			fclose(fp);
+			return FAILURE;
+		}
+		for(i = 0;i < count;i++)
+			printf("%llu is %s\n",(unsigned long long)integers[i],results[i] ? "prime" : "not prime");
+	}
+	fclose(fp);
+	return SUCCESS;
+}
+
+/* one OP_STATS round trip, printed as name=value pairs */
+static int run_stats(int socket_fd)
+{
+	uint64_t stats[STAT_FIELDS];
+	uint32_t count = STAT_FIELDS;
+	if(FAILURE == write_stats(socket_fd) ||
+		FAILURE == read_stats_response(socket_fd,stats,&count))
+		return FAILURE;
+	metrics_print(stdout,stats,count);
+	return SUCCESS;
+}
+
+/* OP_RANGE_COUNT prints the count, OP_RANGE_BITMAP every prime in [a, b] */
+static int run_range(int socket_fd,uint32_t op,const char *from,const char *to)
+{
+	unsigned char *bitmap;
+	uint64_t a,b,count,i;
+	a = strtoull(from,NULL,10);
+	b = strtoull(to,NULL,10);
+	if(a > b || b - a >= MAX_RANGE_COUNT || (OP_RANGE_BITMAP == op && b - a >= MAX_RANGE_BITMAP))
+	{
+		printf("\nInvalid range\n");
+		return FAILURE;
+	}
+	if(FAILURE == write_range(socket_fd,op,a,b))
+		return FAILURE;
+	if(OP_RANGE_COUNT == op)
+	{
+		if(FAILURE == read_range_count(socket_fd,&count))
+			return FAILURE;
+		printf("%llu primes in [%llu, %llu]\n",(unsigned long long)count,(unsigned long long)a,(unsigned long long)b);
+		return SUCCESS;
+	}
+	bitmap = malloc((b - a + 8) / 8);
+	if(NULL == bitmap)
+	{
+		perror("\nmalloc error");
+		return FAILURE;
+	}
+	if(FAILURE == read_range_bitmap(socket_fd,bitmap,b - a + 1))
+	{
+		free(bitmap);
+		return FAILURE;
+	}
+	for(i = 0;i <= b - a;i++)
+		if(bitmap[i / 8] & (1 << (i % 8)))
+			printf("%llu\n",(unsigned long long)(a + i));
+	free(bitmap);
+	return SUCCESS;
+}
+
+/* OP_FACTOR for the numbers on the command line, n = p1 * p2 * ... */
+static int run_factor(int socket_fd,char **numbers,uint32_t count)
+{
+	uint64_t integers[CLIENT_BATCH];
+	uint64_t *factors;
+	unsigned char nfactors[CLIENT_BATCH];
+	uint32_t i,j;
+	if(CLIENT_BATCH < count)
+		count = CLIENT_BATCH;
+	for(i = 0;i < count;i++)
+		integers[i] = strtoull(numbers[i],NULL,10);
+	factors = malloc(count * MAX_FACTORS * sizeof(uint64_t));
+	if(NULL == factors)
+	{
+		perror("\nmalloc error");
+		return FAILURE;
+	}
+	if(FAILURE == write_frame(socket_fd,OP_FACTOR,integers,count) ||
+		FAILURE == read_factor_response(socket_fd,count,factors,nfactors))
+	{
+		free(factors);
+		return FAILURE;
+	}
+	for(i = 0;i < count;i++)
+	{
+		printf("%llu =",(unsigned long long)integers[i]);
+		for(j = 0;j < nfactors[i];j++)
+			printf("%s %llu",j ? " *" : "",(unsigned long long)factors[i * MAX_FACTORS + j]);
+		printf("%s\n",nfactors[i] ? "" : " no prime factors");
+	}
+	free(factors);
+	return SUCCESS;
+}
 
 int main(int argc,char *argv[])
 {
@@ -20,9 +148,19 @@ int main(int argc,char *argv[])
         struct sockaddr_in server;
         int ret_val;
 	int integer;
-	int integer1;
-	char prime[20];
+	unsigned long long integer1;
+	char number[32];
+	unsigned char status;
 
+	/* a path instead of an address is the server's AF_UNIX socket, the port is ignored */
+	if('/' == argv[1][0])
+	{
+		socket_fd = unix_connect(argv[1]);
+		if(ERR == socket_fd)
+			exit(EXIT_FAILURE);
+	}
+	else
+	{
         socket_fd = socket(AF_INET,SOCK_STREAM,0);
         if(ERR == socket_fd)
         {
@@ -39,29 +177,69 @@ int main(int argc,char *argv[])
                 perror("\nConnect error");
                 exit(EXIT_FAILURE);
         }
+	}
+
+	if(NULL != argv[3])
+	{
+		if(0 == strcmp(argv[3],"--stats"))
+			ret_val = run_stats(socket_fd);
+		else if(0 == strcmp(argv[3],"--batch") && NULL != argv[4])
+			ret_val = run_batch(socket_fd,argv[4]);
+		else if(0 == strcmp(argv[3],"--count") && NULL != argv[4] && NULL != argv[5])
+			ret_val = run_range(socket_fd,OP_RANGE_COUNT,argv[4],argv[5]);
+		else if(0 == strcmp(argv[3],"--primes") && NULL != argv[4] && NULL != argv[5])
+			ret_val = run_range(socket_fd,OP_RANGE_BITMAP,argv[4],argv[5]);
+		else if(0 == strcmp(argv[3],"--factor") && NULL != argv[4])
+			ret_val = run_factor(socket_fd,&argv[4],argc - 4);
+		else
+		{
+			printf("\nUsage : %s <server address | socket path> <port> [--batch <file> | --stats | --count a b | --primes a b |\n"
+				"\t--factor n ...]\n",argv[0]);
+			exit(EXIT_FAILURE);
+		}
+		if(FAILURE == ret_val)
+		{
+			printf("\nError");
+			exit(EXIT_FAILURE);
+		}
+		integer = 0;
+		write_request(socket_fd,&integer);
+		close(socket_fd);
+		return SUCCESS;
+	}
 	
 	while(1)
 	{
 		printf("Enter any number : \n");
-		scanf("%d",&integer1);
-		integer = integer1;
-		ret_val = write_request(socket_fd,&integer);
+		if(1 != scanf("%31s",number))
+			strcpy(number,"0");
+		integer1 = strtoull(number,NULL,10);
+		if('-' == number[0])
+		{
+			printf("%s is not prime\n",number);
+			continue;
+		}
+		if(0 == integer1)
+		{
+			integer = 0;
+			write_request(socket_fd,&integer);	/* v1 0 ends the session */
+			break;
+		}
+
+		ret_val = write_check(socket_fd,integer1);
 		if(FAILURE == ret_val)
 		{
 			printf("\nError");
 			exit(EXIT_FAILURE);
 		}
 
-		if(0 == integer)
-			break;
-
-		ret_val = read_response(socket_fd,prime);
+		ret_val = read_check_response(socket_fd,&status);
 		if(FAILURE == ret_val)
 		{
 			printf("\nError");
 			exit(EXIT_FAILURE);
 		}
-		printf("%s\n",prime);
+		printf("%llu is %s\n",integer1,STATUS_PRIME == status ? "prime" : "not prime");
 	}
 	close(socket_fd);
 	
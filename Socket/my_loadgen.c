@@ -0,0 +1,391 @@
+/*
+	Load generator for the prime server, speaking v2 OP_CHECK.
+	Every thread drives its share of the connections from its own epoll
+	loop and keeps up to --depth requests in flight on each of them.
+
+	closed loop (default) - a new request goes out as soon as an answer
+				comes back, latency is measured from the send
+	open loop (--rate R)  - requests are due at a fixed rate of R per
+				second in total; latency is measured from the
+				time a request was due, not from when it could
+				be sent, which corrects coordinated omission
+
+	Keys are uniform in [2, --max], Zipf distributed over --keys random
+	numbers above the sieve, or drawn from --keys large 64 bit primes.
+	The report has the throughput and an HDR style latency histogram.
+*/
+
+#include"header.h"
+#include<sys/epoll.h>
+#include<math.h>
+#include<time.h>
+
+#define MAX_DEPTH 1024
+
+enum dist
+{
+	DIST_UNIFORM,
+	DIST_ZIPF,
+	DIST_PRIMES
+};
+
+struct lconn
+{
+	int fd;
+	long long due[MAX_DEPTH];	/* FIFO of start times in flight */
+	int head;
+	int inflight;
+	long long next_due;		/* open loop schedule */
+	int skip;			/* rest of an OP_ERROR frame */
+};
+
+struct lthread
+{
+	pthread_t tid;
+	struct lconn *conns;
+	int nconn;
+	int first;			/* index of conns[0] over all threads */
+	uint64_t seed;
+	uint64_t requests;
+	uint64_t errors;
+	struct hist lat;
+};
+
+static struct sockaddr_in server;
+static int depth = 1;
+static double rate = 0;			/* 0 is closed loop */
+static enum dist dist = DIST_UNIFORM;
+static uint64_t max = 10000000;
+static uint64_t *keys;
+static double *cdf;
+static int nkeys = 100000;
+static double zipf_s = 0.99;
+static long long start_ns,end_ns;
+static long long interval_ns;		/* open loop, per connection */
+static int total_conns;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+static uint64_t next_key(uint64_t *seed)
+{
+	double u;
+	int lo,hi,mid;
+	switch(dist)
+	{
+	case DIST_ZIPF:
+		u = (xorshift(seed) >> 11) * (1.0 / 9007199254740992.0);
+		lo = 0;
+		hi = nkeys - 1;
+		while(lo < hi)
+		{
+			mid = (lo + hi) / 2;
+			if(cdf[mid] < u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return keys[lo];
+	case DIST_PRIMES:
+		return keys[xorshift(seed) % nkeys];
+	default:
+		return 2 + xorshift(seed) % (max - 1);
+	}
+}
+
+static void make_keys(void)
+{
+	uint64_t seed = 88172645463325252ULL;
+	double sum = 0;
+	int i;
+	keys = malloc(nkeys * sizeof(uint64_t));
+	cdf = malloc(nkeys * sizeof(double));
+	if(NULL == keys || NULL == cdf)
+	{
+		perror("\nmalloc error");
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0;i < nkeys;i++)
+	{
+		keys[i] = xorshift(&seed) | SIEVE_LIMIT | 1;
+		if(DIST_PRIMES == dist)
+			while(!is_prime(keys[i]))
+				keys[i] = keys[i] + 2;
+		sum += 1.0 / pow(i + 1,zipf_s);
+		cdf[i] = sum;
+	}
+	for(i = 0;i < nkeys;i++)
+		cdf[i] = cdf[i] / sum;
+}
+
+/* queue n OP_CHECK frames due at the given times in one send() */
+static int send_checks(struct lthread *t,struct lconn *c,const long long *due,int n)
+{
+	char frames[64 * (sizeof(struct frame_hdr) + sizeof(uint64_t))];
+	struct frame_hdr hdr;
+	uint64_t integer;
+	size_t len = 0;
+	int i;
+	hdr.word = htonl(PROTO_MAGIC | OP_CHECK);
+	hdr.count = htonl(1);
+	for(i = 0;i < n;i++)
+	{
+		integer = htobe64(next_key(&t->seed));
+		memcpy(frames + len,&hdr,sizeof(hdr));
+		memcpy(frames + len + sizeof(hdr),&integer,sizeof(integer));
+		len = len + sizeof(hdr) + sizeof(integer);
+		c->due[(c->head + c->inflight) % MAX_DEPTH] = due[i];
+		c->inflight++;
+	}
+	return write_full(c->fd,frames,len);
+}
+
+/* fill the pipeline, or for open loop send what is due by now */
+static int pump(struct lthread *t,struct lconn *c,long long now)
+{
+	long long due[64];
+	int n = 0;
+	while(c->inflight + n < depth && n < 64)
+	{
+		if(0 < rate)
+		{
+			if(c->next_due > now || c->next_due >= end_ns)
+				break;
+			due[n++] = c->next_due;
+			c->next_due = c->next_due + interval_ns;
+		}
+		else
+			due[n++] = now;
+	}
+	if(0 == n)
+		return SUCCESS;
+	if(FAILURE == send_checks(t,c,due,n))
+		return FAILURE;
+	if(n == 64)
+		return pump(t,c,now);
+	return SUCCESS;
+}
+
+static void *lthread_main(void *arg)
+{
+	struct lthread *t = arg;
+	struct epoll_event ev;
+	struct epoll_event events[MAX_EVENTS];
+	unsigned char answers[4096];
+	struct lconn *c;
+	long long now,next;
+	int epoll_fd;
+	int timeout;
+	int n_want;
+	int i,j,n;
+	ssize_t r;
+
+	epoll_fd = epoll_create1(0);
+	if(ERR == epoll_fd)
+	{
+		perror("\nepoll_create error");
+		exit(EXIT_FAILURE);
+	}
+	for(i = 0;i < t->nconn;i++)
+	{
+		c = &t->conns[i];
+		c->fd = socket(AF_INET,SOCK_STREAM,0);
+		if(ERR == c->fd || ERR == connect(c->fd,(struct sockaddr*)&server,sizeof(server)))
+		{
+			perror("\nConnect error");
+			exit(EXIT_FAILURE);
+		}
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		if(ERR == epoll_ctl(epoll_fd,EPOLL_CTL_ADD,c->fd,&ev))
+		{
+			perror("\nepoll_ctl error");
+			exit(EXIT_FAILURE);
+		}
+		/* spread the open loop schedule over the connections */
+		c->next_due = start_ns + interval_ns * (t->first + i) / total_conns;
+	}
+	while(now_ns() < start_ns)
+		;
+
+	while(1)
+	{
+		now = now_ns();
+		if(now >= end_ns)
+			break;
+		next = end_ns;
+		for(i = 0;i < t->nconn;i++)
+		{
+			c = &t->conns[i];
+			if(FAILURE == pump(t,c,now))
+				t->errors++;
+			if(0 < rate && c->inflight < depth && c->next_due < next)
+				next = c->next_due;
+		}
+		timeout = (next - now) / 1000000;
+		n = epoll_wait(epoll_fd,events,MAX_EVENTS,0 < rate ? timeout : 100);
+		now = now_ns();
+		for(i = 0;i < n;i++)
+		{
+			c = events[i].data.ptr;
+			n_want = c->inflight + c->skip;
+			r = recv(c->fd,answers,n_want < (int)sizeof(answers) ? n_want : (int)sizeof(answers),0);
+			if(0 >= r)
+			{
+				if(0 > r && EINTR == errno)
+					continue;
+				printf("\nServer closed the connection\n");
+				exit(EXIT_FAILURE);
+			}
+			for(j = 0;j < r;j++)
+			{
+				if(c->skip)
+				{
+					c->skip--;
+					continue;
+				}
+				if(PROTO_MAGIC >> 24 == answers[j])
+					c->skip = sizeof(struct frame_hdr) - 1;	/* timed out */
+				if(STATUS_PRIME != answers[j] && STATUS_NOT_PRIME != answers[j])
+					t->errors++;
+				hist_record(&t->lat,now - c->due[c->head]);
+				c->head = (c->head + 1) % MAX_DEPTH;
+				c->inflight--;
+				t->requests++;
+			}
+		}
+	}
+	for(i = 0;i < t->nconn;i++)
+		close(t->conns[i].fd);
+	close(epoll_fd);
+	return NULL;
+}
+
+static void usage(const char *name)
+{
+	printf("\nUsage : %s <server address> <port> [--threads N] [--connections N] [--depth N]\n"
+		"\t[--rate REQ_PER_SEC] [--duration SEC] [--dist uniform|zipf|primes]\n"
+		"\t[--max N] [--keys N] [--zipf S]\n",name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc,char *argv[])
+{
+	struct lthread *threads;
+	struct hist *all;
+	int nthreads = 1,nconn = 1,seconds = 5;
+	uint64_t requests = 0,errors = 0;
+	double elapsed;
+	int i,k;
+
+	if(3 > argc)
+		usage(argv[0]);
+	for(i = 3;i < argc;i++)
+	{
+		if(i + 1 >= argc)
+			usage(argv[0]);
+		if(0 == strcmp(argv[i],"--threads"))
+			nthreads = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--connections"))
+			nconn = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--depth"))
+			depth = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--rate"))
+			rate = atof(argv[++i]);
+		else if(0 == strcmp(argv[i],"--duration"))
+			seconds = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--max"))
+			max = strtoull(argv[++i],NULL,10);
+		else if(0 == strcmp(argv[i],"--keys"))
+			nkeys = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--zipf"))
+			zipf_s = atof(argv[++i]);
+		else if(0 == strcmp(argv[i],"--dist"))
+		{
+			i++;
+			if(0 == strcmp(argv[i],"uniform"))
+				dist = DIST_UNIFORM;
+			else if(0 == strcmp(argv[i],"zipf"))
+				dist = DIST_ZIPF;
+			else if(0 == strcmp(argv[i],"primes"))
+				dist = DIST_PRIMES;
+			else
+				usage(argv[0]);
+		}
+		else
+			usage(argv[0]);
+	}
+	if(0 >= nthreads || nconn < nthreads || 0 >= depth || MAX_DEPTH < depth ||
+		0 >= seconds || 0 > rate || 3 > max || 0 >= nkeys)
+		usage(argv[0]);
+
+	server.sin_family = AF_INET;
+	server.sin_port = htons(atoi(argv[2]));
+	server.sin_addr.s_addr = inet_addr(argv[1]);
+
+	if(DIST_UNIFORM != dist)
+		make_keys();
+	total_conns = nconn;
+	if(0 < rate)
+		interval_ns = (long long)(nconn * 1e9 / rate);
+
+	threads = calloc(nthreads,sizeof(struct lthread));
+	all = calloc(1,sizeof(struct hist));
+	if(NULL == threads || NULL == all)
+	{
+		perror("\ncalloc error");
+		exit(EXIT_FAILURE);
+	}
+	start_ns = now_ns() + 200000000LL;	/* time to connect */
+	end_ns = start_ns + seconds * 1000000000LL;
+	for(i = 0,k = 0;i < nthreads;i++)
+	{
+		threads[i].nconn = nconn / nthreads + (i < nconn % nthreads);
+		threads[i].conns = calloc(threads[i].nconn,sizeof(struct lconn));
+		threads[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+		if(NULL == threads[i].conns)
+		{
+			perror("\ncalloc error");
+			exit(EXIT_FAILURE);
+		}
+		threads[i].first = k;
+		k = k + threads[i].nconn;
+		pthread_create(&threads[i].tid,NULL,lthread_main,&threads[i]);
+	}
+	for(i = 0;i < nthreads;i++)
+	{
+		pthread_join(threads[i].tid,NULL);
+		hist_merge(all,&threads[i].lat);
+		requests += threads[i].requests;
+		errors += threads[i].errors;
+		free(threads[i].conns);
+	}
+	elapsed = (end_ns - start_ns) / 1e9;
+
+	printf("threads %d connections %d depth %d %s",nthreads,nconn,depth,0 < rate ? "open loop" : "closed loop");
+	if(0 < rate)
+		printf(" at %.0f req/s",rate);
+	printf("\nrequests    %llu  errors %llu\n",(unsigned long long)requests,(unsigned long long)errors);
+	printf("throughput  %.0f req/s\n",requests / elapsed);
+	printf("latency     p50 %.1f us  p90 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n",
+		hist_percentile(all,50) / 1e3,hist_percentile(all,90) / 1e3,hist_percentile(all,99) / 1e3,
+		hist_percentile(all,99.9) / 1e3,all->max / 1e3);
+
+	free(all);
+	free(threads);
+	free(keys);
+	free(cdf);
+	return SUCCESS;
+}
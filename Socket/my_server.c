@@ -1,40 +1,16 @@
 #include"header.h"
 
-int main() {
-	struct sockaddr_in server;
+/* one client at a time, the original request/response loop */
+static void run_blocking_server(int socket_fd1)
+{
 	struct sockaddr_in client;
-	int socket_fd1;
 	int socket_fd2;
 	int ret_val;
-	char prime[20];
+	char prime[RESPONSE_SIZE];
 	int integer;
 	int size_of_struct;
-	
-	socket_fd1 = socket(AF_INET,SOCK_STREAM,0);
-	if(ERR == socket_fd1)
-	{
-		perror("\nsocket error");
-		exit(EXIT_FAILURE);
-	}
-	
-	printf("Starting Server : \n");	
-	
-	server.sin_family = AF_INET;
-	server.sin_port = htons(PORT);
-	server.sin_addr.s_addr = htonl(INADDR_ANY);
+	uint64_t start;
 
-	ret_val = bind(socket_fd1,(struct sockaddr*)&server,sizeof(server));
-	if(ERR == ret_val) {
-		perror("\nBind error");
-		exit(EXIT_FAILURE);
-	}
-	
-	ret_val = listen(socket_fd1,5);
-	if(ERR == ret_val) {
-		perror("\nListen Error");
-		exit(EXIT_FAILURE);
-	}
-	
 	while(1) {
 		size_of_struct = sizeof(client);
 		socket_fd2 = accept(socket_fd1,(struct sockaddr*)&client,(socklen_t*)&size_of_struct);
@@ -45,27 +21,398 @@ int main() {
 		
 		while(1) {
 			ret_val = read_request(socket_fd2,&integer);
-			if(FAILURE == ret_val) {
-				perror("\nError");
-				exit(EXIT_FAILURE);
-			}
+			if(FAILURE == ret_val)
+				break;		/* client went away without sending 0 */
 			
 			if(0 == integer)
 				break;
 				
+			start = metrics_now();
 			ret_val = check_prime(integer,prime);
 	
-			printf("%s\n",prime);
 			ret_val = write_response(socket_fd2,prime);
 			if(FAILURE == ret_val) {
 				perror("\nError");
 				exit(EXIT_FAILURE);
 			}
+			metrics_request(start);
 		}
 		close(socket_fd2);
 	}
+}
+
+/*
+	listening socket on PORT; shared, it joins the SO_REUSEPORT group of
+	the workers, otherwise a port already in use fails the bind
+*/
+static int create_listener(int shared)
+{
+	struct sockaddr_in server;
+	int socket_fd1;
+	int ret_val;
+	int optval = 1;
+
+	socket_fd1 = socket(AF_INET,SOCK_STREAM,0);
+	if(ERR == socket_fd1)
+	{
+		perror("\nsocket error");
+		exit(EXIT_FAILURE);
+	}
 	
-	close(socket_fd1);
-	return SUCCESS;
+	ret_val = setsockopt(socket_fd1,SOL_SOCKET,SO_REUSEADDR,&optval,sizeof(optval));
+	if(ERR == ret_val) {
+		perror("\nsetsockopt error");
+		exit(EXIT_FAILURE);
+	}
+
+	ret_val = shared ? setsockopt(socket_fd1,SOL_SOCKET,SO_REUSEPORT,&optval,sizeof(optval)) : SUCCESS;
+	if(ERR == ret_val) {
+		perror("\nsetsockopt error");
+		exit(EXIT_FAILURE);
+	}
+
+	server.sin_family = AF_INET;
+	server.sin_port = htons(PORT);
+	server.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	ret_val = bind(socket_fd1,(struct sockaddr*)&server,sizeof(server));
+	if(ERR == ret_val) {
+		perror("\nBind error");
+		exit(EXIT_FAILURE);
+	}
+	
+	ret_val = listen(socket_fd1,LISTEN_BACKLOG);
+	if(ERR == ret_val) {
+		perror("\nListen Error");
+		exit(EXIT_FAILURE);
+	}
+	return socket_fd1;
+}
+
+/* datagram socket on PORT, one per worker, in an SO_REUSEPORT group when shared */
+static int create_udp_socket(int shared)
+{
+	struct sockaddr_in server;
+	int socket_fd1;
+	int ret_val;
+	int optval = 1;
+	int rcvbuf = UDP_RCVBUF;
+
+	socket_fd1 = socket(AF_INET,SOCK_DGRAM,0);
+	if(ERR == socket_fd1)
+	{
+		perror("\nsocket error");
+		exit(EXIT_FAILURE);
+	}
+
+	/* a burst past the receive buffer is lost, capped by net.core.rmem_max */
+	ret_val = setsockopt(socket_fd1,SOL_SOCKET,SO_RCVBUF,&rcvbuf,sizeof(rcvbuf));
+	if(ERR == ret_val) {
+		perror("\nsetsockopt error");
+		exit(EXIT_FAILURE);
+	}
+
+	ret_val = shared ? setsockopt(socket_fd1,SOL_SOCKET,SO_REUSEPORT,&optval,sizeof(optval)) : SUCCESS;
+	if(ERR == ret_val) {
+		perror("\nsetsockopt error");
+		exit(EXIT_FAILURE);
+	}
+
+	server.sin_family = AF_INET;
+	server.sin_port = htons(PORT);
+	server.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	ret_val = bind(socket_fd1,(struct sockaddr*)&server,sizeof(server));
+	if(ERR == ret_val) {
+		perror("\nBind error");
+		exit(EXIT_FAILURE);
+	}
+	return socket_fd1;
+}
+
+/*
+	AF_UNIX listener at path for clients on this host, one socket shared
+	by all the workers; a stale file from an earlier run is replaced, but
+	not the socket of a server still answering on it
+*/
+static int create_unix_listener(const char *path)
+{
+	struct sockaddr_un server;
+	int socket_fd1,probe_fd;
+	int ret_val;
+
+	if(strlen(path) >= sizeof(server.sun_path)) {
+		printf("\nSocket path too long\n");
+		exit(EXIT_FAILURE);
+	}
+	socket_fd1 = socket(AF_UNIX,SOCK_STREAM,0);
+	if(ERR == socket_fd1)
+	{
+		perror("\nsocket error");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&server,0,sizeof(server));
+	server.sun_family = AF_UNIX;
+	strcpy(server.sun_path,path);
+
+	/* only a file nobody accepts on is stale */
+	probe_fd = socket(AF_UNIX,SOCK_STREAM,0);
+	if(ERR == probe_fd)
+	{
+		perror("\nsocket error");
+		exit(EXIT_FAILURE);
+	}
+	ret_val = connect(probe_fd,(struct sockaddr*)&server,sizeof(server));
+	if(SUCCESS == ret_val) {
+		printf("\nA server is already listening on %s\n",path);
+		exit(EXIT_FAILURE);
+	}
+	if(ECONNREFUSED == errno)
+		unlink(path);
+	else if(ENOENT != errno) {
+		perror("\nConnect error");
+		exit(EXIT_FAILURE);
+	}
+	close(probe_fd);
+
+	ret_val = bind(socket_fd1,(struct sockaddr*)&server,sizeof(server));
+	if(ERR == ret_val) {
+		perror("\nBind error");
+		exit(EXIT_FAILURE);
+	}
+
+	ret_val = listen(socket_fd1,LISTEN_BACKLOG);
+	if(ERR == ret_val) {
+		perror("\nListen Error");
+		exit(EXIT_FAILURE);
+	}
+	return socket_fd1;
+}
+
+/* resident and shared (file backed) memory of the process, from /proc */
+static void print_rss(void)
+{
+	FILE *fp;
+	long size,resident,shared;
+	long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+	fp = fopen("/proc/self/statm","r");
+	if(NULL == fp)
+		return;
+	if(3 == fscanf(fp,"%ld %ld %ld",&size,&resident,&shared))
+		printf("RSS %ld kB, %ld kB of it shared\n",resident * page_kb,shared * page_kb);
+	fclose(fp);
+}
+
+struct worker
+{
+	pthread_t tid;
+	int id;
+	int pin;		/* pin to CPU id % online CPUs */
+	int listen_fd;
+	int unix_fd;		/* shared, ERR with --no-unix */
+	int udp_fd;		/* ERR with --no-udp */
+	int (*serve)(int,int,int);	/* event loop backend */
+};
+
+/*
+	Thread-per-core worker: owns its listening socket and event loop, the
+	kernel spreads new connections across the SO_REUSEPORT group so
+	nothing is shared between workers on the request path.
+*/
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	cpu_set_t set;
+	long ncpu;
+	int ret_val;
+
+	if(w->pin) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		CPU_ZERO(&set);
+		CPU_SET(w->id % (0 < ncpu ? ncpu : 1),&set);
+		ret_val = pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+		if(0 != ret_val)
+			fprintf(stderr,"worker %d : unable to pin : %s\n",w->id,strerror(ret_val));
+	}
+
+	if(FAILURE == w->serve(w->listen_fd,w->unix_fd,w->udp_fd)) {
+		perror("\nError");
+		exit(EXIT_FAILURE);
+	}
+	return NULL;
 }
 
+int main(int argc,char *argv[]) {
+	struct worker *workers;
+	pthread_t dump_tid;
+	int socket_fd1;
+	int unix_fd = ERR;
+	const char *unix_path = UNIX_PATH;
+	int blocking = 0;
+	int (*serve)(int,int,int) = run_epoll_server;
+	int udp = 1;
+	int udp_vlen = UDP_VLEN;
+	int threads = 1;
+	int pin = 0;
+	int cache_mb = CACHE_MB;
+	int stats_interval = 0;
+	int pool_threads = ERR;		/* one per online CPU */
+	unsigned long long sieve_limit = SIEVE_LIMIT;
+	const char *sieve_file = SIEVE_FILE;
+	int sieve_mapped = 0;
+	uint64_t start;
+	long long offload = POOL_MIN_COST;
+	long long idle = IDLE_TIMEOUT;
+	long long deadline = TASK_DEADLINE;
+	int ret_val;
+	int i;
+
+	for(i = 1;i < argc;i++) {
+		if(0 == strcmp(argv[i],"--blocking"))
+			blocking = 1;
+		else if(0 == strcmp(argv[i],"--epoll"))
+			serve = run_epoll_server;
+		else if(0 == strcmp(argv[i],"--uring"))
+			serve = run_uring_server;
+		else if(0 == strcmp(argv[i],"--unix") && i + 1 < argc)
+			unix_path = argv[++i];
+		else if(0 == strcmp(argv[i],"--no-unix"))
+			unix_path = NULL;
+		else if(0 == strcmp(argv[i],"--no-udp"))
+			udp = 0;
+		else if(0 == strcmp(argv[i],"--udp-batch") && i + 1 < argc)
+			udp_vlen = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--threads") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--pin"))
+			pin = 1;
+		else if(0 == strcmp(argv[i],"--cache-mb") && i + 1 < argc)
+			cache_mb = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--no-coalesce"))
+			cache_coalesce(0);
+		else if(0 == strcmp(argv[i],"--simd"))
+			prime_simd(1);
+		else if(0 == strcmp(argv[i],"--stats") && i + 1 < argc)
+			stats_interval = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--sieve-limit") && i + 1 < argc)
+			sieve_limit = strtoull(argv[++i],NULL,0);
+		else if(0 == strcmp(argv[i],"--sieve-file") && i + 1 < argc)
+			sieve_file = argv[++i];
+		else if(0 == strcmp(argv[i],"--no-sieve-file"))
+			sieve_file = NULL;
+		else if(0 == strcmp(argv[i],"--pool") && i + 1 < argc)
+			pool_threads = atoi(argv[++i]);
+		else if(0 == strcmp(argv[i],"--offload") && i + 1 < argc)
+			offload = atoll(argv[++i]);
+		else if(0 == strcmp(argv[i],"--idle") && i + 1 < argc)
+			idle = atoll(argv[++i]);
+		else if(0 == strcmp(argv[i],"--deadline") && i + 1 < argc)
+			deadline = atoll(argv[++i]);
+		else {
+			printf("\nUsage : %s [--epoll | --uring | --blocking] [--unix PATH | --no-unix]\n"
+				"\t[--no-udp] [--udp-batch N] [--threads N] [--pin] [--cache-mb MB] [--no-coalesce] [--simd]\n"
+				"\t[--sieve-limit N] [--sieve-file PATH | --no-sieve-file] [--stats SEC] [--pool N] [--offload COST]\n"
+				"\t[--idle SEC] [--deadline MS]\n",argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(0 >= threads || (blocking && 1 != threads)) {
+		printf("\nInvalid thread count\n");
+		exit(EXIT_FAILURE);
+	}
+	if(0 > cache_mb) {
+		printf("\nInvalid cache size\n");
+		exit(EXIT_FAILURE);
+	}
+	if(0 >= udp_vlen || UIO_MAXIOV < udp_vlen) {
+		printf("\nInvalid UDP batch\n");
+		exit(EXIT_FAILURE);
+	}
+	udp_batch(udp_vlen);
+	if(SIEVE_MAX < sieve_limit) {
+		printf("\nInvalid sieve limit\n");
+		exit(EXIT_FAILURE);
+	}
+	if(0 > stats_interval) {
+		printf("\nInvalid stats interval\n");
+		exit(EXIT_FAILURE);
+	}
+	if(ERR == pool_threads)
+		pool_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if(0 > pool_threads || 0 > offload) {
+		printf("\nInvalid pool settings\n");
+		exit(EXIT_FAILURE);
+	}
+	if(0 > idle || 0 > deadline) {
+		printf("\nInvalid timeout\n");
+		exit(EXIT_FAILURE);
+	}
+	conn_timeouts(idle * 1000,deadline);	/* 0 disables, deadlines apply to pool tasks */
+
+	printf("Starting Server : \n");	
+
+	/* from the sieve file when an earlier start left one */
+	start = metrics_now();
+	if(NULL == sieve_file ? FAILURE == prime_init(sieve_limit) :
+		FAILURE == prime_load(sieve_file,sieve_limit,&sieve_mapped))
+		exit(EXIT_FAILURE);
+	printf("Sieve below %llu %s in %.1f ms\n",sieve_limit,sieve_mapped ? "mapped" : "built",
+		(metrics_now() - start) / 1e6);
+
+	/*
+		range queries run on the calling thread plus threads - 1 helpers,
+		frames costing offload Miller-Rabin tests or more go to the pool
+	*/
+	if(FAILURE == factor_init() || FAILURE == cache_init(cache_mb) ||
+		FAILURE == range_init(threads - 1) || FAILURE == pool_init(blocking ? 0 : pool_threads,offload))
+		exit(EXIT_FAILURE);
+
+	/* periodic metrics line on stdout, the stats opcode works regardless */
+	if(stats_interval) {
+		ret_val = pthread_create(&dump_tid,NULL,metrics_dump,&stats_interval);
+		if(0 != ret_val) {
+			fprintf(stderr,"\nThread error : %s\n",strerror(ret_val));
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(dump_tid);
+	}
+	print_rss();
+
+	if(blocking) {
+		socket_fd1 = create_listener(0);
+		run_blocking_server(socket_fd1);
+		close(socket_fd1);
+		return SUCCESS;
+	}
+
+	if(NULL != unix_path)
+		unix_fd = create_unix_listener(unix_path);
+
+	workers = calloc(threads,sizeof(struct worker));
+	if(NULL == workers) {
+		perror("\ncalloc error");
+		exit(EXIT_FAILURE);
+	}
+	/* bind every socket before serving so no worker misses the group */
+	for(i = 0;i < threads;i++) {
+		workers[i].id = i;
+		workers[i].pin = pin;
+		workers[i].serve = serve;
+		workers[i].listen_fd = create_listener(1 < threads);
+		workers[i].unix_fd = unix_fd;
+		workers[i].udp_fd = udp ? create_udp_socket(1 < threads) : ERR;
+	}
+	for(i = 0;i < threads;i++) {
+		ret_val = pthread_create(&workers[i].tid,NULL,worker_main,&workers[i]);
+		if(0 != ret_val) {
+			fprintf(stderr,"\nThread error : %s\n",strerror(ret_val));
+			exit(EXIT_FAILURE);
+		}
+	}
+	for(i = 0;i < threads;i++)
+		pthread_join(workers[i].tid,NULL);
+
+	free(workers);
+	return SUCCESS;
+}
@@ -0,0 +1,628 @@
+/*
+	Client library for applications that check numbers against the
+	server, pipelined instead of one round trip per number.
+	pclient_open() connects a pool of connections and starts one I/O
+	thread that owns them. Any thread submits a number and gets back a
+	future to wait on, or has a callback run on the I/O thread.
+	Submissions pile up in a pending list and the I/O thread sends them
+	once the batching window after the first one has passed, or sooner
+	when enough are pending: one number goes out as OP_CHECK, several as
+	an OP_BATCH frame. Frames are spread over the connections, each
+	connection keeps any number of them in flight and the server answers
+	them in order.
+*/
+
+#include"header.h"
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<netinet/tcp.h>
+#include<time.h>
+
+#define PCLIENT_FLUSH 4096		/* pending numbers that end the window early */
+#define PCLIENT_FRAMES 64		/* initial frames in flight per connection */
+
+struct pfuture
+{
+	uint64_t n;
+	int status;			/* STATUS_* or ERR */
+	int done;			/* under the client lock */
+	void (*cb)(void *,uint64_t,int);	/* NULL for a future */
+	void *arg;
+	struct pfuture *next;
+};
+
+struct pconn
+{
+	int fd;				/* ERR while disconnected */
+	struct rbuf in;
+	char *out;			/* frames not yet taken by the socket */
+	size_t out_start;
+	size_t out_end;
+	size_t out_cap;
+	int want_out;			/* EPOLLOUT registered */
+	struct pfuture *head;		/* sent numbers, in order */
+	struct pfuture *tail;
+	uint32_t *frames;		/* count of each frame in flight, a ring */
+	uint32_t frame_head;
+	uint32_t nframes;
+	uint32_t frame_cap;
+	uint64_t inflight;		/* numbers */
+};
+
+struct pclient
+{
+	struct sockaddr_in server;
+	struct pconn *conns;
+	int nconns;
+	long long window_ns;
+	int epoll_fd;
+	int efd;			/* wakes the I/O thread */
+	pthread_t tid;
+	pthread_mutex_t lock;
+	pthread_cond_t landed;		/* some future completed */
+	struct pfuture *pending;	/* submitted, not sent, under lock */
+	struct pfuture *pending_tail;
+	uint32_t npending;
+	long long pending_since;
+	int stop;
+};
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void wake(struct pclient *pc)
+{
+	uint64_t one = 1;
+	if(sizeof(one) != write(pc->efd,&one,sizeof(one)))
+		perror("\neventfd write error");
+}
+
+/* runs callbacks and wakes waiters for the list of futures */
+static void complete(struct pclient *pc,struct pfuture *f)
+{
+	struct pfuture *next;
+	int waiters = 0;
+	for(;NULL != f;f = next)
+	{
+		next = f->next;
+		if(NULL != f->cb)
+		{
+			f->cb(f->arg,f->n,f->status);
+			free(f);
+			continue;
+		}
+		pthread_mutex_lock(&pc->lock);
+		f->done = 1;
+		pthread_mutex_unlock(&pc->lock);
+		waiters = 1;
+	}
+	if(waiters)
+	{
+		pthread_mutex_lock(&pc->lock);
+		pthread_cond_broadcast(&pc->landed);
+		pthread_mutex_unlock(&pc->lock);
+	}
+}
+
+static void fail_all(struct pclient *pc,struct pfuture *f)
+{
+	struct pfuture *g;
+	for(g = f;NULL != g;g = g->next)
+		g->status = ERR;
+	complete(pc,f);
+}
+
+/* drops the connection and fails what it had in flight, the next send reconnects */
+static void pconn_reset(struct pclient *pc,struct pconn *c)
+{
+	struct pfuture *f = c->head;
+	close(c->fd);
+	c->fd = ERR;
+	c->in.start = 0;
+	c->in.end = 0;
+	c->out_start = 0;
+	c->out_end = 0;
+	c->want_out = 0;
+	c->head = NULL;
+	c->tail = NULL;
+	c->nframes = 0;
+	c->inflight = 0;
+	fail_all(pc,f);
+}
+
+static int pconn_connect(struct pclient *pc,struct pconn *c)
+{
+	struct epoll_event ev;
+	int one = 1;
+	c->fd = socket(AF_INET,SOCK_STREAM | SOCK_CLOEXEC,0);
+	if(ERR == c->fd)
+	{
+		perror("\nSocket error");
+		return FAILURE;
+	}
+	if(ERR == connect(c->fd,(struct sockaddr*)&pc->server,sizeof(pc->server)))
+	{
+		perror("\nConnect error");
+		close(c->fd);
+		c->fd = ERR;
+		return FAILURE;
+	}
+	setsockopt(c->fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+	if(FAILURE == set_nonblocking(c->fd))
+	{
+		close(c->fd);
+		c->fd = ERR;
+		return FAILURE;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if(ERR == epoll_ctl(pc->epoll_fd,EPOLL_CTL_ADD,c->fd,&ev))
+	{
+		perror("\nepoll_ctl error");
+		close(c->fd);
+		c->fd = ERR;
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/* as much of the output as the socket takes, EPOLLOUT while some is left */
+static int pconn_flush(struct pclient *pc,struct pconn *c)
+{
+	struct epoll_event ev;
+	ssize_t n;
+	while(c->out_start < c->out_end)
+	{
+		n = send(c->fd,c->out + c->out_start,c->out_end - c->out_start,MSG_NOSIGNAL);
+		if(0 > n && EINTR == errno)
+			continue;
+		if(0 > n && EAGAIN != errno)
+			return FAILURE;
+		if(0 > n)
+			break;
+		c->out_start = c->out_start + n;
+	}
+	if(c->out_start == c->out_end)
+	{
+		c->out_start = 0;
+		c->out_end = 0;
+	}
+	if(c->want_out != (c->out_start < c->out_end))
+	{
+		c->want_out = !c->want_out;
+		ev.events = EPOLLIN | (c->want_out ? EPOLLOUT : 0);
+		ev.data.ptr = c;
+		if(ERR == epoll_ctl(pc->epoll_fd,EPOLL_CTL_MOD,c->fd,&ev))
+			return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/* queues count futures from f on as one frame, FAILURE when out of memory */
+static int pconn_frame(struct pconn *c,struct pfuture *f,uint32_t count)
+{
+	struct frame_hdr hdr;
+	uint64_t integer;
+	uint32_t *frames;
+	size_t need,cap;
+	char *out;
+	uint32_t i;
+
+	need = c->out_end + sizeof(hdr) + count * sizeof(uint64_t);
+	if(need > c->out_cap)
+	{
+		cap = c->out_cap;
+		while(cap < need)
+			cap = cap * 2;
+		out = realloc(c->out,cap);
+		if(NULL == out)
+			return FAILURE;
+		c->out = out;
+		c->out_cap = cap;
+	}
+	if(c->nframes == c->frame_cap)
+	{
+		frames = malloc(2 * c->frame_cap * sizeof(uint32_t));
+		if(NULL == frames)
+			return FAILURE;
+		for(i = 0;i < c->nframes;i++)
+			frames[i] = c->frames[(c->frame_head + i) % c->frame_cap];
+		free(c->frames);
+		c->frames = frames;
+		c->frame_head = 0;
+		c->frame_cap = 2 * c->frame_cap;
+	}
+
+	hdr.word = htonl(PROTO_MAGIC | (1 == count ? OP_CHECK : OP_BATCH));
+	hdr.count = htonl(count);
+	memcpy(c->out + c->out_end,&hdr,sizeof(hdr));
+	c->out_end = c->out_end + sizeof(hdr);
+	for(i = 0;i < count;i++,f = f->next)
+	{
+		integer = htobe64(f->n);
+		memcpy(c->out + c->out_end,&integer,sizeof(integer));
+		c->out_end = c->out_end + sizeof(integer);
+	}
+	c->frames[(c->frame_head + c->nframes) % c->frame_cap] = count;
+	c->nframes++;
+	c->inflight = c->inflight + count;
+	return SUCCESS;
+}
+
+/* takes the pending list and spreads it over the connections */
+static void dispatch(struct pclient *pc)
+{
+	struct pfuture *f,*last;
+	struct pconn *c;
+	uint32_t npending,chunk,i;
+	int k;
+
+	pthread_mutex_lock(&pc->lock);
+	f = pc->pending;
+	npending = pc->npending;
+	pc->pending = NULL;
+	pc->pending_tail = NULL;
+	pc->npending = 0;
+	pthread_mutex_unlock(&pc->lock);
+
+	chunk = (npending + pc->nconns - 1) / pc->nconns;
+	if(MAX_BATCH < chunk)
+		chunk = MAX_BATCH;
+	while(NULL != f)
+	{
+		/* the connection with the least in flight */
+		c = &pc->conns[0];
+		for(k = 1;k < pc->nconns;k++)
+			if(pc->conns[k].inflight < c->inflight)
+				c = &pc->conns[k];
+		for(last = f,i = 1;i < chunk && NULL != last->next;i++)
+			last = last->next;
+		if(ERR == c->fd && FAILURE == pconn_connect(pc,c))
+		{
+			fail_all(pc,f);
+			return;
+		}
+		if(FAILURE == pconn_frame(c,f,i))
+		{
+			fail_all(pc,f);
+			return;
+		}
+		if(NULL == c->head)
+			c->head = f;
+		else
+			c->tail->next = f;
+		c->tail = last;
+		f = last->next;
+		last->next = NULL;
+		if(FAILURE == pconn_flush(pc,c))
+			pconn_reset(pc,c);
+	}
+}
+
+/* answers of whole frames at the front of the input, FAILURE on a bad one */
+static int pconn_parse(struct pclient *pc,struct pconn *c,size_t *need)
+{
+	struct frame_hdr hdr;
+	struct pfuture *first,*f;
+	unsigned char *data;
+	size_t avail,len;
+	uint32_t count,i;
+	int error;
+
+	while(0 < c->nframes)
+	{
+		data = (unsigned char *)c->in.data + c->in.start;
+		avail = c->in.end - c->in.start;
+		count = c->frames[c->frame_head];
+		if(0 == avail)
+			break;
+		error = 0;
+		if(1 == count && PROTO_MAGIC >> 24 != data[0])
+			len = 1;		/* a status byte, not an OP_ERROR header */
+		else
+		{
+			if(avail < sizeof(hdr))
+			{
+				*need = sizeof(hdr);
+				break;
+			}
+			memcpy(&hdr,data,sizeof(hdr));
+			if(htonl(PROTO_MAGIC | OP_ERROR) == hdr.word)
+				error = 1;
+			else if(htonl(PROTO_MAGIC | OP_BATCH) != hdr.word || htonl(count) != hdr.count)
+				return FAILURE;
+			len = error ? sizeof(hdr) : sizeof(hdr) + (count + 7) / 8;
+		}
+		if(avail < len)
+		{
+			*need = len;
+			break;
+		}
+
+		first = c->head;
+		for(i = 0,f = first;i < count;i++,f = f->next)
+		{
+			if(error)
+				f->status = ERR;
+			else if(1 == count)
+				f->status = data[0];
+			else
+				f->status = (data[sizeof(hdr) + i / 8] >> (i % 8)) & 1;
+			if(i + 1 == count)
+			{
+				c->head = f->next;
+				f->next = NULL;
+			}
+		}
+		if(NULL == c->head)
+			c->tail = NULL;
+		c->in.start = c->in.start + len;
+		c->frame_head = (c->frame_head + 1) % c->frame_cap;
+		c->nframes--;
+		c->inflight = c->inflight - count;
+		complete(pc,first);
+	}
+	if(c->in.start == c->in.end)
+	{
+		c->in.start = 0;
+		c->in.end = 0;
+	}
+	return SUCCESS;
+}
+
+static void pconn_input(struct pclient *pc,struct pconn *c)
+{
+	size_t need = 0;
+	ssize_t n;
+	while(1)
+	{
+		n = rbuf_fill(&c->in,c->fd,need);
+		if(0 > n && EAGAIN == errno)
+			return;
+		if(0 >= n || 0 == c->nframes || FAILURE == pconn_parse(pc,c,&need))
+		{
+			pconn_reset(pc,c);
+			return;
+		}
+	}
+}
+
+static void *pclient_main(void *arg)
+{
+	struct pclient *pc = arg;
+	struct epoll_event events[MAX_EVENTS];
+	struct pconn *c;
+	struct timespec ts,*timeout;
+	long long since,left;
+	uint64_t count;
+	uint32_t npending;
+	int stop;
+	int i,n;
+
+	while(1)
+	{
+		pthread_mutex_lock(&pc->lock);
+		npending = pc->npending;
+		since = pc->pending_since;
+		stop = pc->stop;
+		pthread_mutex_unlock(&pc->lock);
+		if(stop)
+			break;
+		timeout = NULL;
+		if(0 < npending)
+		{
+			left = since + pc->window_ns - now_ns();
+			if(0 >= left || PCLIENT_FLUSH <= npending)
+			{
+				dispatch(pc);
+				continue;
+			}
+			ts.tv_sec = left / 1000000000;
+			ts.tv_nsec = left % 1000000000;
+			timeout = &ts;
+		}
+		/* windows are microseconds, epoll_wait() would round them up to a millisecond */
+		n = epoll_pwait2(pc->epoll_fd,events,MAX_EVENTS,timeout,NULL);
+		if(ERR == n && EINTR != errno)
+		{
+			perror("\nepoll_pwait2 error");
+			break;
+		}
+		for(i = 0;i < n;i++)
+		{
+			if(NULL == events[i].data.ptr)
+			{
+				if(sizeof(count) != read(pc->efd,&count,sizeof(count)) && EAGAIN != errno)
+					perror("\neventfd read error");
+				continue;
+			}
+			c = events[i].data.ptr;
+			if(ERR == c->fd)
+				continue;
+			if((events[i].events & EPOLLOUT) && FAILURE == pconn_flush(pc,c))
+			{
+				pconn_reset(pc,c);
+				continue;
+			}
+			if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				pconn_input(pc,c);
+		}
+	}
+	return NULL;
+}
+
+static struct pfuture *pclient_submit(struct pclient *pc,uint64_t n,void (*cb)(void *,uint64_t,int),void *arg)
+{
+	struct pfuture *f;
+	uint32_t npending;
+	f = malloc(sizeof(struct pfuture));
+	if(NULL == f)
+		return NULL;
+	f->n = n;
+	f->status = ERR;
+	f->done = 0;
+	f->cb = cb;
+	f->arg = arg;
+	f->next = NULL;
+	pthread_mutex_lock(&pc->lock);
+	if(pc->stop)
+	{
+		pthread_mutex_unlock(&pc->lock);
+		free(f);
+		return NULL;
+	}
+	if(0 == pc->npending)
+	{
+		pc->pending = f;
+		pc->pending_since = now_ns();
+	}
+	else
+		pc->pending_tail->next = f;
+	pc->pending_tail = f;
+	npending = ++pc->npending;
+	pthread_mutex_unlock(&pc->lock);
+	/* the I/O thread sleeps until the window of the first one ends */
+	if(1 == npending || PCLIENT_FLUSH == npending)
+		wake(pc);
+	return f;
+}
+
+/*
+	conns connections to address:port, numbers submitted within window_us
+	of the first pending one go out together, 0 sends whatever piled up
+	while the I/O thread was busy
+*/
+struct pclient *pclient_open(const char *address,int port,int conns,int window_us)
+{
+	struct pclient *pc;
+	struct epoll_event ev;
+	int i;
+
+	if(0 >= conns || 0 > window_us)
+		return NULL;
+	pc = calloc(1,sizeof(struct pclient));
+	if(NULL == pc)
+		return NULL;
+	pc->conns = calloc(conns,sizeof(struct pconn));
+	if(NULL == pc->conns)
+	{
+		free(pc);
+		return NULL;
+	}
+	pc->nconns = conns;
+	pc->window_ns = window_us * 1000LL;
+	pc->server.sin_family = AF_INET;
+	pc->server.sin_port = htons(port);
+	pc->server.sin_addr.s_addr = inet_addr(address);
+	pthread_mutex_init(&pc->lock,NULL);
+	pthread_cond_init(&pc->landed,NULL);
+	for(i = 0;i < conns;i++)
+		pc->conns[i].fd = ERR;
+	pc->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	pc->efd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+	if(ERR == pc->epoll_fd || ERR == pc->efd)
+	{
+		perror("\npclient error");
+		goto fail;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if(ERR == epoll_ctl(pc->epoll_fd,EPOLL_CTL_ADD,pc->efd,&ev))
+	{
+		perror("\nepoll_ctl error");
+		goto fail;
+	}
+	for(i = 0;i < conns;i++)
+	{
+		pc->conns[i].out_cap = 4096;
+		pc->conns[i].out = malloc(pc->conns[i].out_cap);
+		pc->conns[i].frame_cap = PCLIENT_FRAMES;
+		pc->conns[i].frames = malloc(PCLIENT_FRAMES * sizeof(uint32_t));
+		if(NULL == pc->conns[i].out || NULL == pc->conns[i].frames ||
+			FAILURE == rbuf_init(&pc->conns[i].in,4096))
+			goto fail;
+		if(FAILURE == pconn_connect(pc,&pc->conns[i]))
+			goto fail;
+	}
+	if(0 != pthread_create(&pc->tid,NULL,pclient_main,pc))
+		goto fail;
+	return pc;
+
+fail:
+	for(i = 0;i < conns;i++)
+	{
+		if(ERR != pc->conns[i].fd)
+			close(pc->conns[i].fd);
+		free(pc->conns[i].out);
+		free(pc->conns[i].frames);
+		rbuf_free(&pc->conns[i].in);
+	}
+	if(ERR != pc->epoll_fd)
+		close(pc->epoll_fd);
+	if(ERR != pc->efd)
+		close(pc->efd);
+	free(pc->conns);
+	free(pc);
+	return NULL;
+}
+
+/* NULL when out of memory or closed */
+struct pfuture *pclient_check(struct pclient *pc,uint64_t n)
+{
+	return pclient_submit(pc,n,NULL,NULL);
+}
+
+/* cb(arg, n, status) runs on the I/O thread, it must not block */
+int pclient_check_cb(struct pclient *pc,uint64_t n,void (*cb)(void *,uint64_t,int),void *arg)
+{
+	return NULL == pclient_submit(pc,n,cb,arg) ? FAILURE : SUCCESS;
+}
+
+/* STATUS_PRIME, STATUS_NOT_PRIME or ERR, the future is freed */
+int pfuture_wait(struct pclient *pc,struct pfuture *f)
+{
+	int status;
+	pthread_mutex_lock(&pc->lock);
+	while(!f->done)
+		pthread_cond_wait(&pc->landed,&pc->lock);
+	pthread_mutex_unlock(&pc->lock);
+	status = f->status;
+	free(f);
+	return status;
+}
+
+/*
+	stops the I/O thread, whatever is still pending or in flight fails;
+	no thread may be in pfuture_wait() or submitting by then
+*/
+void pclient_close(struct pclient *pc)
+{
+	struct pfuture *f;
+	int i;
+	pthread_mutex_lock(&pc->lock);
+	pc->stop = 1;
+	pthread_mutex_unlock(&pc->lock);
+	wake(pc);
+	pthread_join(pc->tid,NULL);
+
+	f = pc->pending;
+	pc->pending = NULL;
+	pc->npending = 0;
+	fail_all(pc,f);
+	for(i = 0;i < pc->nconns;i++)
+	{
+		if(ERR != pc->conns[i].fd)
+			pconn_reset(pc,&pc->conns[i]);
+		free(pc->conns[i].out);
+		free(pc->conns[i].frames);
+		rbuf_free(&pc->conns[i].in);
+	}
+	close(pc->epoll_fd);
+	close(pc->efd);
+	free(pc->conns);
+	free(pc);
+}
@@ -0,0 +1,181 @@
+/*
+	Worker pool for the expensive requests, so a large batch or range
+	does not stall every other connection of the I/O thread.
+	Each pool thread has a bounded deque. The I/O threads spread tasks
+	over the deques, a pool thread takes the oldest task of its own deque
+	and when that is empty steals the newest one of another deque.
+	A finished task goes back on the completion list of the I/O thread
+	that owns its connection, and an eventfd wakes that thread up.
+*/
+
+#include"header.h"
+#include<sys/eventfd.h>
+
+#define POOL_DEQUE 256		/* tasks queued per pool thread */
+
+struct deque
+{
+	pthread_mutex_t lock;
+	struct task *slot[POOL_DEQUE];
+	unsigned head;		/* oldest task */
+	unsigned tail;
+} __attribute__((aligned(64)));
+
+static struct deque *deques;
+static int nthreads;
+static uint64_t threshold;
+
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t queued;		/* tasks in all deques, under idle_lock */
+static int idle;
+
+static __thread unsigned next_deque;
+
+static struct task *deque_take(struct deque *d,int steal)
+{
+	struct task *t = NULL;
+	pthread_mutex_lock(&d->lock);
+	if(d->head != d->tail)
+	{
+		if(steal)
+			t = d->slot[--d->tail % POOL_DEQUE];
+		else
+			t = d->slot[d->head++ % POOL_DEQUE];
+	}
+	pthread_mutex_unlock(&d->lock);
+	return t;
+}
+
+static void completions_push(struct task *t)
+{
+	struct completions *cq = t->c->cq;
+	uint64_t one = 1;
+	pthread_mutex_lock(&cq->lock);
+	t->next_done = cq->head;
+	cq->head = t;
+	pthread_mutex_unlock(&cq->lock);
+	if(sizeof(one) != write(cq->efd,&one,sizeof(one)))
+		perror("\neventfd write error");
+}
+
+static void *pool_main(void *arg)
+{
+	struct deque *own = arg;
+	struct task *t;
+	int i,start;
+
+	start = own - deques;
+	while(1)
+	{
+		/* one task is ours once queued is taken down, find where it is */
+		pthread_mutex_lock(&idle_lock);
+		while(0 == queued)
+		{
+			idle++;
+			pthread_cond_wait(&idle_cond,&idle_lock);
+			idle--;
+		}
+		queued--;
+		pthread_mutex_unlock(&idle_lock);
+
+		t = NULL;
+		while(NULL == t)
+		{
+			t = deque_take(own,0);
+			for(i = 1;i < nthreads && NULL == t;i++)
+				t = deque_take(&deques[(start + i) % nthreads],1);
+		}
+		conn_run_task(t);
+		completions_push(t);
+	}
+	return NULL;
+}
+
+/* threads 0 disables the pool, every request is then answered inline */
+int pool_init(int threads,uint64_t min_cost)
+{
+	pthread_t tid;
+	int i,ret_val;
+
+	threshold = min_cost;
+	if(0 >= threads)
+		return SUCCESS;
+	deques = aligned_alloc(64,threads * sizeof(struct deque));
+	if(NULL == deques)
+	{
+		perror("pool allocation error\n");
+		return FAILURE;
+	}
+	memset(deques,0,threads * sizeof(struct deque));
+	for(i = 0;i < threads;i++)
+		pthread_mutex_init(&deques[i].lock,NULL);
+	nthreads = threads;
+	for(i = 0;i < threads;i++)
+	{
+		ret_val = pthread_create(&tid,NULL,pool_main,&deques[i]);
+		if(0 != ret_val)
+		{
+			fprintf(stderr,"pool thread : %s\n",strerror(ret_val));
+			return FAILURE;
+		}
+		pthread_detach(tid);
+	}
+	return SUCCESS;
+}
+
+/* worth a trip through the pool, cost in Miller-Rabin tests */
+int pool_wanted(uint64_t cost)
+{
+	return 0 < nthreads && cost >= threshold;
+}
+
+/* FAILURE when every deque is full, the caller answers inline then */
+int pool_submit(struct task *t)
+{
+	struct deque *d;
+	int i,ok = 0;
+	for(i = 0;i < nthreads && !ok;i++)
+	{
+		d = &deques[next_deque++ % nthreads];
+		pthread_mutex_lock(&d->lock);
+		if(d->tail - d->head < POOL_DEQUE)
+		{
+			d->slot[d->tail++ % POOL_DEQUE] = t;
+			ok = 1;
+		}
+		pthread_mutex_unlock(&d->lock);
+	}
+	if(!ok)
+		return FAILURE;
+	pthread_mutex_lock(&idle_lock);
+	queued++;
+	if(idle)
+		pthread_cond_signal(&idle_cond);
+	pthread_mutex_unlock(&idle_lock);
+	return SUCCESS;
+}
+
+int completions_init(struct completions *cq)
+{
+	pthread_mutex_init(&cq->lock,NULL);
+	cq->head = NULL;
+	cq->efd = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+	if(ERR == cq->efd)
+	{
+		perror("\neventfd error");
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/* every task finished since the last call, in no particular order */
+struct task *completions_take(struct completions *cq)
+{
+	struct task *t;
+	pthread_mutex_lock(&cq->lock);
+	t = cq->head;
+	cq->head = NULL;
+	pthread_mutex_unlock(&cq->lock);
+	return t;
+}
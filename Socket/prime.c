@@ -0,0 +1,439 @@
+/*
+	Primality engine used by check_prime().
+	- bitset sieve of the odd numbers below the sieve limit
+	- trial division by a small prime table, stops at the first divisor
+	- deterministic Miller-Rabin for everything else up to 2^64
+	prime_screen() does the first two for a whole batch, the trial
+	division as a multiply by the inverse of each prime, four numbers at
+	a time in AVX2 lanes when the CPU has them.
+	The sieve can be kept in a file, see prime_load(): built once, then
+	mapped read-only by every later start, so server processes on the
+	host share one copy through the page cache.
+*/
+
+#include"header.h"
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<immintrin.h>
+
+static const uint32_t small_primes[] = {
+	2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+	59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+	137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+	227, 229, 233, 239, 241, 251
+};
+#define NSMALL_PRIMES (sizeof(small_primes) / sizeof(small_primes[0]))
+#define SMALL_SQUARE (251ULL * 251)	/* below it a number with no small factor is prime */
+
+/* n % p == 0 iff n * inverse <= limit, for the odd small primes */
+static uint64_t screen_inverse[NSMALL_PRIMES - 1];
+static uint64_t screen_limit[NSMALL_PRIMES - 1];
+static pthread_once_t screen_once = PTHREAD_ONCE_INIT;
+static int screen_avx2;
+
+/* bit i set when 2*i+1 is composite */
+static uint64_t *sieve_bits;
+static uint64_t sieve_limit;
+static size_t sieve_mapped;		/* bytes mapped from the file, 0 when on the heap */
+
+#define SIEVE_MAGIC 0x53564550u		/* "PEVS", the other byte order reads "SVEP" */
+#define SIEVE_VERSION 1			/* bump whenever the bit layout changes */
+
+/* file layout, the header and then the words of the bitset */
+struct sieve_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t limit;
+	uint64_t words;
+	uint64_t checksum;		/* sieve_checksum() of the words */
+	char pad[32];			/* the words start 64 bytes in */
+};
+
+static void sieve_release(void)
+{
+	if(sieve_mapped)
+		munmap((char *)sieve_bits - sizeof(struct sieve_header),sieve_mapped);
+	else
+		free(sieve_bits);
+	sieve_bits = NULL;
+	sieve_mapped = 0;
+}
+
+/* 64 bit FNV-1a over whole words, enough to catch a torn or stale file */
+static uint64_t sieve_checksum(const uint64_t *words,uint64_t n)
+{
+	uint64_t h = 0xCBF29CE484222325ULL;
+	uint64_t i;
+	for(i = 0;i < n;i++)
+		h = (h ^ words[i]) * 0x100000001B3ULL;
+	return h;
+}
+
+int prime_init(uint64_t limit)
+{
+	uint64_t i,j,nbits;
+	uint64_t *bits;
+
+	if(limit < 3)
+		return SUCCESS;
+	nbits = limit / 2;
+	bits = calloc(nbits / 64 + 1,sizeof(uint64_t));
+	if(NULL == bits)
+	{
+		perror("sieve allocation error\n");
+		return FAILURE;
+	}
+	bits[0] = 1;		/* 1 is not prime */
+	for(i = 3;i * i < limit;i = i + 2)
+	{
+		if(bits[i / 128] & (1ULL << ((i / 2) % 64)))
+			continue;
+		for(j = i * i;j < limit;j = j + 2 * i)
+			bits[j / 128] |= 1ULL << ((j / 2) % 64);
+	}
+	sieve_release();
+	sieve_bits = bits;
+	sieve_limit = limit;
+	return SUCCESS;
+}
+
+/*
+	FAILURE when the file is missing, for another limit or damaged. The
+	default path is in /tmp, so a file another user could have put there
+	or could still write is not trusted: it must be a regular file of
+	ours, not a symlink, and writable by nobody else.
+*/
+static int sieve_map(const char *path,uint64_t limit)
+{
+	struct sieve_header hdr;
+	struct stat st;
+	uint64_t words = limit / 2 / 64 + 1;
+	char *map;
+	int fd;
+
+	fd = open(path,O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if(ERR == fd)
+		return FAILURE;
+	if(ERR == fstat(fd,&st))
+	{
+		close(fd);
+		return FAILURE;
+	}
+	if(!S_ISREG(st.st_mode) || geteuid() != st.st_uid || (st.st_mode & (S_IWGRP | S_IWOTH)))
+	{
+		fprintf(stderr,"sieve file %s is not ours alone, ignoring it\n",path);
+		close(fd);
+		return FAILURE;
+	}
+	if(sizeof(hdr) != pread(fd,&hdr,sizeof(hdr),0) ||
+		SIEVE_MAGIC != hdr.magic || SIEVE_VERSION != hdr.version || limit != hdr.limit ||
+		words != hdr.words || (uint64_t)st.st_size != sizeof(hdr) + words * sizeof(uint64_t))
+	{
+		close(fd);
+		return FAILURE;
+	}
+	map = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+	if(MAP_FAILED == map)
+	{
+		perror("sieve mmap error\n");
+		return FAILURE;
+	}
+	if(hdr.checksum != sieve_checksum((const uint64_t *)(map + sizeof(hdr)),words))
+	{
+		fprintf(stderr,"sieve file %s is damaged, rebuilding it\n",path);
+		munmap(map,st.st_size);
+		return FAILURE;
+	}
+	sieve_release();
+	sieve_bits = (uint64_t *)(map + sizeof(hdr));
+	sieve_mapped = st.st_size;
+	sieve_limit = limit;
+	return SUCCESS;
+}
+
+/*
+	the sieve in memory to path, through a temporary file renamed over it;
+	mkstemp() so the name cannot be guessed and planted as a symlink
+*/
+static int sieve_save(const char *path)
+{
+	struct sieve_header hdr;
+	char tmp[4096];
+	FILE *fp;
+	int fd,ret_val;
+
+	memset(&hdr,0,sizeof(hdr));
+	hdr.magic = SIEVE_MAGIC;
+	hdr.version = SIEVE_VERSION;
+	hdr.limit = sieve_limit;
+	hdr.words = sieve_limit / 2 / 64 + 1;
+	hdr.checksum = sieve_checksum(sieve_bits,hdr.words);
+	if((int)sizeof(tmp) <= snprintf(tmp,sizeof(tmp),"%s.XXXXXX",path))
+		return FAILURE;
+	fd = mkstemp(tmp);
+	if(ERR == fd)
+		return FAILURE;
+	fp = fdopen(fd,"w");
+	if(NULL == fp)
+	{
+		close(fd);
+		unlink(tmp);
+		return FAILURE;
+	}
+	ret_val = 1 == fwrite(&hdr,sizeof(hdr),1,fp) && hdr.words == fwrite(sieve_bits,sizeof(uint64_t),hdr.words,fp) &&
+		0 == fflush(fp) && 0 == fsync(fileno(fp));
+	if(0 != fclose(fp) || !ret_val || ERR == rename(tmp,path))
+	{
+		unlink(tmp);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+
+/*
+	prime_init() from the sieve file at path: mapped when it holds this
+	limit and checks out, otherwise built and written for the next start.
+	*mapped tells which one happened. A file that cannot be written only
+	costs the sharing, the sieve stays on the heap.
+*/
+int prime_load(const char *path,uint64_t limit,int *mapped)
+{
+	*mapped = 1;
+	if(limit >= 3 && SUCCESS == sieve_map(path,limit))
+		return SUCCESS;
+	*mapped = 0;
+	if(FAILURE == prime_init(limit))
+		return FAILURE;
+	if(limit < 3 || FAILURE == sieve_save(path))
+	{
+		if(limit >= 3)
+			perror("sieve file not written");
+		return SUCCESS;
+	}
+	sieve_map(path,limit);		/* drop the private copy for the shared one */
+	return SUCCESS;
+}
+
+static uint64_t mulmod(uint64_t a,uint64_t b,uint64_t m)
+{
+	return (unsigned __int128)a * b % m;
+}
+
+static uint64_t powmod(uint64_t a,uint64_t e,uint64_t m)
+{
+	uint64_t r = 1;
+	while(e)
+	{
+		if(e & 1)
+			r = mulmod(r,a,m);
+		a = mulmod(a,a,m);
+		e = e >> 1;
+	}
+	return r;
+}
+
+/* n odd, n > 3 : one Miller-Rabin round with base a */
+static int mr_witness(uint64_t n,uint64_t d,int s,uint64_t a)
+{
+	uint64_t x;
+	int i;
+	x = powmod(a % n,d,n);
+	if(1 == x || n - 1 == x || 0 == x)
+		return 0;
+	for(i = 1;i < s;i++)
+	{
+		x = mulmod(x,x,n);
+		if(n - 1 == x)
+			return 0;
+	}
+	return 1;
+}
+
+/* the primes to 37 are a proven deterministic test below about 3.18 * 10^23, all of uint64_t */
+static int miller_rabin(uint64_t n)
+{
+	static const uint64_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37 };
+	uint64_t d = n - 1;
+	int s = 0;
+	unsigned int i;
+	while(0 == (d & 1))
+	{
+		d = d >> 1;
+		s++;
+	}
+	for(i = 0;i < sizeof(bases) / sizeof(bases[0]);i++)
+		if(mr_witness(n,d,s,bases[i]))
+			return 0;
+	return 1;
+}
+
+/* n odd : n^-1 mod 2^64, Newton doubles the correct bits from 3 */
+uint64_t inverse64(uint64_t n)
+{
+	uint64_t x = n;
+	int i;
+	for(i = 0;i < 5;i++)
+		x = x * (2 - n * x);
+	return x;
+}
+
+static void screen_init(void)
+{
+	unsigned int i;
+	for(i = 1;i < NSMALL_PRIMES;i++)
+	{
+		screen_inverse[i - 1] = inverse64(small_primes[i]);
+		screen_limit[i - 1] = UINT64_MAX / small_primes[i];
+	}
+	/* AVX2 stays off until prime_simd(1), built without -O the lanes lose */
+}
+
+/* AVX2 for prime_screen() when on and the CPU has it, returns whether it is used */
+int prime_simd(int on)
+{
+	pthread_once(&screen_once,screen_init);
+	screen_avx2 = on && __builtin_cpu_supports("avx2");
+	return screen_avx2;
+}
+
+/* n odd and past the small primes : what trial division by them says */
+static unsigned char screen_one(uint64_t n)
+{
+	unsigned int i;
+	for(i = 0;i < NSMALL_PRIMES - 1;i++)
+		if(n * screen_inverse[i] <= screen_limit[i])
+			return 0;
+	return n < SMALL_SQUARE ? 1 : PRIME_UNKNOWN;
+}
+
+/* 3, 5 and 7 take out over half the odd numbers, the lanes only get the rest */
+#define SCREEN_LEAD 3
+
+static int screen_lead(uint64_t n)
+{
+	int i;
+	for(i = 0;i < SCREEN_LEAD;i++)
+		if(n * screen_inverse[i] <= screen_limit[i])
+			return 1;
+	return 0;
+}
+
+/*
+	four lanes of screen_one() past the SCREEN_LEAD primes. AVX2 has no 64 bit low multiply, it is
+	put together from three 32 x 32 -> 64 ones, and no unsigned compare,
+	both sides get the sign bit flipped for the signed one.
+*/
+__attribute__((target("avx2")))
+static void screen_four(const uint64_t *n,unsigned char *status)
+{
+	__m256i v,vhi,inv,prod,cross,bias,lim;
+	__m256i alive = _mm256_set1_epi64x(-1);
+	uint64_t lanes[4];
+	unsigned int i;
+	int k;
+	v = _mm256_loadu_si256((const __m256i *)n);
+	vhi = _mm256_srli_epi64(v,32);
+	bias = _mm256_set1_epi64x(INT64_MIN);
+	for(i = SCREEN_LEAD;i < NSMALL_PRIMES - 1;i++)
+	{
+		inv = _mm256_set1_epi64x(screen_inverse[i]);
+		cross = _mm256_add_epi64(_mm256_mul_epu32(vhi,inv),_mm256_mul_epu32(v,_mm256_srli_epi64(inv,32)));
+		prod = _mm256_add_epi64(_mm256_mul_epu32(v,inv),_mm256_slli_epi64(cross,32));
+		lim = _mm256_set1_epi64x(screen_limit[i] ^ (uint64_t)INT64_MIN);
+		/* lanes with prod > limit are not divisible by this prime */
+		alive = _mm256_and_si256(alive,_mm256_cmpgt_epi64(_mm256_xor_si256(prod,bias),lim));
+		if(_mm256_testz_si256(alive,alive))
+			break;
+	}
+	_mm256_storeu_si256((__m256i *)lanes,alive);
+	for(k = 0;k < 4;k++)
+		status[k] = 0 == lanes[k] ? 0 : n[k] < SMALL_SQUARE ? 1 : PRIME_UNKNOWN;
+}
+
+/*
+	status[i] of n[i], as is_prime() would find it: 0 or 1 when the sieve
+	or trial division by the small primes settles it, PRIME_UNKNOWN when
+	it is left to Miller-Rabin
+*/
+void prime_screen(const uint64_t *n,size_t count,unsigned char *status)
+{
+	uint64_t odd[4];
+	unsigned char lanes[4];
+	size_t at[4];
+	size_t i;
+	int k,m = 0;
+	pthread_once(&screen_once,screen_init);
+	for(i = 0;i < count;i++)
+	{
+		if(n[i] < sieve_limit || n[i] <= small_primes[NSMALL_PRIMES - 1])
+			status[i] = is_prime(n[i]);
+		else if(0 == (n[i] & 1))
+			status[i] = 0;
+		else if(!screen_avx2)
+			status[i] = screen_one(n[i]);
+		else if(screen_lead(n[i]))
+			status[i] = 0;
+		else
+		{
+			/* four odd ones to the lanes, the answers back to their slots */
+			odd[m] = n[i];
+			at[m++] = i;
+			if(4 > m)
+				continue;
+			screen_four(odd,lanes);
+			for(k = 0;k < 4;k++)
+				status[at[k]] = lanes[k];
+			m = 0;
+		}
+	}
+	for(k = 0;k < m;k++)
+		status[at[k]] = screen_one(odd[k]);
+}
+
+/* is_prime() of every n[i] into results[i] */
+void is_prime_batch(const uint64_t *n,size_t count,unsigned char *results)
+{
+	size_t i;
+	prime_screen(n,count,results);
+	for(i = 0;i < count;i++)
+		if(PRIME_UNKNOWN == results[i])
+			results[i] = miller_rabin(n[i]);
+}
+
+/* answered by a sieve lookup, not worth caching */
+int is_sieved(uint64_t n)
+{
+	return n < sieve_limit;
+}
+
+int is_prime(uint64_t n)
+{
+	unsigned int i;
+	uint64_t p;
+
+	if(n < 2)
+		return 0;
+	if(n < sieve_limit)
+		return 2 == n || ((n & 1) && !(sieve_bits[n / 128] & (1ULL << ((n / 2) % 64))));
+
+	for(i = 0;i < NSMALL_PRIMES;i++)
+	{
+		p = small_primes[i];
+		if(n == p)
+			return 1;
+		if(0 == n % p)
+			return 0;
+	}
+	p = small_primes[NSMALL_PRIMES - 1];
+	if(n < p * p)
+		return 1;
+	return miller_rabin(n);
+}
+
+/* is_prime() of an n prime_screen() left PRIME_UNKNOWN, the trial division is done */
+int is_prime_screened(uint64_t n)
+{
+	return miller_rabin(n);
+}
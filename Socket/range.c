@@ -0,0 +1,236 @@
+/*
+	Prime range queries, OP_RANGE_COUNT and OP_RANGE_BITMAP.
+	Segmented sieve of the odd numbers: [a, b] is cut into segments whose
+	bitset fits the L1 cache, each one is crossed off by the base primes
+	up to its square root, which stay in L2, then counted or copied into
+	the answer bitmap. Segments are independent, the calling thread and
+	the range helpers take them off a shared counter until none is left.
+*/
+
+#include"header.h"
+#include<stdatomic.h>
+
+#define SEGMENT_BYTES 32768				/* L1 data cache */
+#define SEGMENT_SPAN ((uint64_t)SEGMENT_BYTES * 16)	/* numbers per segment, 8 per byte, odd only */
+
+struct range_job
+{
+	uint64_t a;
+	uint64_t b;
+	unsigned char *bitmap;		/* NULL to count only */
+	const int *cancel;		/* stop between segments once set */
+	uint64_t nsegments;
+	_Atomic uint64_t next;		/* next segment to sieve */
+	_Atomic uint64_t count;
+	int helpers;			/* helpers still on the job, under job_lock */
+};
+
+/*
+	Base primes come from the sieve and stop at BASE_LIMIT, so ranges reach
+	below about min(sieve limit, BASE_LIMIT)^2: 2^48 at the default sieve
+	of 2^24. A --sieve-limit past 2^26 does not reach further than 2^52,
+	less than its square, the cap keeps range_init() from collecting
+	hundreds of millions of base primes.
+*/
+#define BASE_LIMIT (1ULL << 26)
+
+static uint32_t *base_primes;		/* odd primes below the sieve limit and BASE_LIMIT */
+static size_t nbase;
+static uint64_t range_limit;
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_posted = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t job_done = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t job_owner = PTHREAD_MUTEX_INITIALIZER;	/* one parallel job at a time */
+static struct range_job *job;
+static uint64_t job_gen;
+static int nhelpers;
+
+/* segment k of the job, bits is SEGMENT_BYTES of scratch */
+static void sieve_segment(struct range_job *j,uint64_t k,uint64_t *bits)
+{
+	uint64_t lo,hi,first,nbits,start,m,p,n,count = 0;
+	uint64_t i,w;
+	size_t pi;
+
+	lo = j->a + k * SEGMENT_SPAN;
+	hi = j->b - lo < SEGMENT_SPAN - 1 ? j->b : lo + SEGMENT_SPAN - 1;
+	if(lo <= 2 && 2 <= hi)
+	{
+		count++;
+		if(j->bitmap)
+			j->bitmap[(2 - j->a) / 8] |= 1 << ((2 - j->a) % 8);
+	}
+	first = lo | 1;
+	if(first > hi)
+	{
+		atomic_fetch_add_explicit(&j->count,count,memory_order_relaxed);
+		return;
+	}
+	nbits = (hi - first) / 2 + 1;
+	memset(bits,0,(nbits + 63) / 64 * sizeof(uint64_t));
+	if(1 == first)
+		bits[0] = 1;			/* 1 is not prime */
+	for(pi = 0;pi < nbase;pi++)
+	{
+		p = base_primes[pi];
+		if(p * p > hi)
+			break;
+		start = p * p;
+		if(start < first)
+		{
+			start = (first + p - 1) / p * p;
+			if(0 == (start & 1))
+				start = start + p;
+		}
+		for(m = start;m <= hi;m = m + 2 * p)
+			bits[(m - first) / 128] |= 1ULL << (((m - first) / 2) % 64);
+	}
+	for(i = 0;i < nbits;i = i + 64)
+	{
+		w = ~bits[i / 64];
+		if(nbits - i < 64)
+			w = w & ((1ULL << (nbits - i)) - 1);
+		count = count + __builtin_popcountll(w);
+		if(NULL == j->bitmap)
+			continue;
+		while(w)
+		{
+			n = first + 2 * (i + __builtin_ctzll(w)) - j->a;
+			j->bitmap[n / 8] |= 1 << (n % 8);
+			w = w & (w - 1);
+		}
+	}
+	atomic_fetch_add_explicit(&j->count,count,memory_order_relaxed);
+}
+
+static void range_work(struct range_job *j)
+{
+	uint64_t bits[SEGMENT_BYTES / sizeof(uint64_t)];
+	uint64_t k;
+	while(1)
+	{
+		if(NULL != j->cancel && __atomic_load_n(j->cancel,__ATOMIC_RELAXED))
+			break;
+		k = atomic_fetch_add_explicit(&j->next,1,memory_order_relaxed);
+		if(k >= j->nsegments)
+			break;
+		sieve_segment(j,k,bits);
+	}
+}
+
+static void *range_helper(void *arg)
+{
+	struct range_job *j;
+	uint64_t gen = 0;
+	(void)arg;
+	pthread_mutex_lock(&job_lock);
+	while(1)
+	{
+		while(gen == job_gen)
+			pthread_cond_wait(&job_posted,&job_lock);
+		gen = job_gen;
+		j = job;
+		if(NULL == j)
+			continue;	/* already finished by the others */
+		j->helpers++;
+		pthread_mutex_unlock(&job_lock);
+		range_work(j);
+		pthread_mutex_lock(&job_lock);
+		if(0 == --j->helpers)
+			pthread_cond_signal(&job_done);
+	}
+	return NULL;
+}
+
+/* base primes from the prime_init() sieve, helpers run range jobs next to the caller */
+int range_init(int helpers)
+{
+	pthread_t tid;
+	uint64_t n;
+	size_t cap = 1024;
+	int i,ret_val;
+
+	base_primes = malloc(cap * sizeof(uint32_t));
+	if(NULL == base_primes)
+	{
+		perror("range allocation error\n");
+		return FAILURE;
+	}
+	for(n = 3;is_sieved(n) && n < BASE_LIMIT;n = n + 2)
+	{
+		if(!is_prime(n))
+			continue;
+		if(nbase == cap)
+		{
+			cap = cap * 2;
+			base_primes = realloc(base_primes,cap * sizeof(uint32_t));
+			if(NULL == base_primes)
+			{
+				perror("range allocation error\n");
+				return FAILURE;
+			}
+		}
+		base_primes[nbase++] = n;
+	}
+	range_limit = n * n;		/* every composite below has a base prime factor */
+
+	for(i = 0;i < helpers;i++)
+	{
+		ret_val = pthread_create(&tid,NULL,range_helper,NULL);
+		if(0 != ret_val)
+		{
+			fprintf(stderr,"range helper : %s\n",strerror(ret_val));
+			return FAILURE;
+		}
+		pthread_detach(tid);
+		nhelpers++;
+	}
+	return SUCCESS;
+}
+
+/* a <= b and every number in range of the base primes */
+int range_valid(uint64_t a,uint64_t b)
+{
+	return a <= b && b < range_limit;
+}
+
+/*
+	number of primes in [a, b], bitmap gets bit i of byte i / 8 set when
+	a + i is prime and must come zeroed, NULL to only count; a set cancel
+	flag ends the query early with a partial answer
+*/
+uint64_t range_query(uint64_t a,uint64_t b,unsigned char *bitmap,const int *cancel)
+{
+	struct range_job j;
+	j.a = a;
+	j.b = b;
+	j.bitmap = bitmap;
+	j.cancel = cancel;
+	j.nsegments = (b - a) / SEGMENT_SPAN + 1;
+	atomic_init(&j.next,0);
+	atomic_init(&j.count,0);
+	j.helpers = 0;
+
+	/* short ranges, or another parallel job running, stay on this thread */
+	if(1 == j.nsegments || 0 == nhelpers || 0 != pthread_mutex_trylock(&job_owner))
+	{
+		range_work(&j);
+		return atomic_load(&j.count);
+	}
+	pthread_mutex_lock(&job_lock);
+	job = &j;
+	job_gen++;
+	pthread_cond_broadcast(&job_posted);
+	pthread_mutex_unlock(&job_lock);
+
+	range_work(&j);
+
+	pthread_mutex_lock(&job_lock);
+	job = NULL;
+	while(0 != j.helpers)
+		pthread_cond_wait(&job_done,&job_lock);
+	pthread_mutex_unlock(&job_lock);
+	pthread_mutex_unlock(&job_owner);
+	return atomic_load(&j.count);
+}
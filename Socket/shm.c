@@ -0,0 +1,412 @@
+/*
+	Shared memory transport for clients on the same host.
+	A client connected over the AF_UNIX socket sends OP_SHM, the server
+	answers with a memfd passed as SCM_RIGHTS holding two byte rings, one
+	per direction, and the same v2 byte stream flows through them instead
+	of the socket. Each ring has one producer and one consumer, head and
+	tail are free running counters on their own cache lines.
+	Nobody spins for long. A side that finds nothing to do sets the
+	waiting flag of its ring and sleeps: the client in a futex on the
+	flag, the server in epoll_wait(). The other side checks the flag
+	after every transfer and wakes the sleeper, with FUTEX_WAKE for the
+	client and a one byte doorbell on the socket for the server. The
+	socket also tells either side when the other one is gone.
+*/
+
+#include"header.h"
+#include<stdatomic.h>
+#include<sys/mman.h>
+#include<sys/syscall.h>
+#include<linux/futex.h>
+#include<time.h>
+
+#define SHM_MAGIC 0x53484D31u		/* "SHM1" */
+#define SHM_SPIN 2000			/* polls before a client sleeps, with a CPU to spare */
+#define SHM_BAD UINT32_MAX		/* the peer left the ring indices inconsistent */
+
+struct shm_ring
+{
+	_Atomic uint32_t head;			/* written by the producer */
+	char pad1[60];
+	_Atomic uint32_t tail;			/* written by the consumer */
+	char pad2[60];
+	_Atomic uint32_t reader_waiting;	/* consumer asleep, ring empty */
+	_Atomic uint32_t writer_waiting;	/* producer asleep, ring full */
+	char pad3[56];
+	char data[SHM_RING_BYTES];
+};
+
+struct shm_region
+{
+	uint32_t magic;
+	uint32_t ring_bytes;
+	char pad[56];
+	struct shm_ring req;			/* client to server */
+	struct shm_ring resp;			/* server to client */
+};
+
+struct shm_client
+{
+	int fd;				/* the AF_UNIX connection */
+	struct shm_region *region;
+	int spin;			/* 0 on one CPU, the server needs it */
+};
+
+/*
+	The indices live in memory the peer can write, so each side reads them
+	once and checks them before they size a copy: a ring never holds more
+	than SHM_RING_BYTES, a tail past the head wraps to more than that.
+*/
+static uint32_t ring_read(struct shm_ring *r,char *buffer,uint32_t len)
+{
+	uint32_t head,tail,n,off,first;
+	tail = atomic_load_explicit(&r->tail,memory_order_relaxed);
+	head = atomic_load_explicit(&r->head,memory_order_acquire);
+	if(SHM_RING_BYTES < head - tail)
+		return SHM_BAD;
+	n = head - tail < len ? head - tail : len;
+	off = tail % SHM_RING_BYTES;
+	first = SHM_RING_BYTES - off < n ? SHM_RING_BYTES - off : n;
+	memcpy(buffer,r->data + off,first);
+	memcpy(buffer + first,r->data,n - first);
+	atomic_store_explicit(&r->tail,tail + n,memory_order_release);
+	return n;
+}
+
+static uint32_t ring_write(struct shm_ring *r,const char *buffer,uint32_t len)
+{
+	uint32_t head,tail,n,off,first;
+	head = atomic_load_explicit(&r->head,memory_order_relaxed);
+	tail = atomic_load_explicit(&r->tail,memory_order_acquire);
+	if(SHM_RING_BYTES < head - tail)
+		return SHM_BAD;
+	n = SHM_RING_BYTES - (head - tail) < len ? SHM_RING_BYTES - (head - tail) : len;
+	off = head % SHM_RING_BYTES;
+	first = SHM_RING_BYTES - off < n ? SHM_RING_BYTES - off : n;
+	memcpy(r->data + off,buffer,first);
+	memcpy(r->data,buffer + first,n - first);
+	atomic_store_explicit(&r->head,head + n,memory_order_release);
+	return n;
+}
+
+static uint32_t ring_used(struct shm_ring *r)
+{
+	return atomic_load_explicit(&r->head,memory_order_acquire) - atomic_load_explicit(&r->tail,memory_order_acquire);
+}
+
+static void futex_wake(_Atomic uint32_t *word)
+{
+	syscall(SYS_futex,word,FUTEX_WAKE,1,NULL,NULL,0);
+}
+
+/* sleeps while *word is 1, at most 100 ms so a dead server is noticed */
+static void futex_wait(_Atomic uint32_t *word)
+{
+	struct timespec ts = { 0,100000000 };
+	syscall(SYS_futex,word,FUTEX_WAIT,1,&ts,NULL,0);
+}
+
+/* the peer slept on flag, wake it; called after a transfer */
+static int wakes(_Atomic uint32_t *flag)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+	if(0 == atomic_load_explicit(flag,memory_order_relaxed))
+		return 0;
+	return 1 == atomic_exchange(flag,0);
+}
+
+/* server side, OP_SHM on an AF_UNIX connection: map the rings, pass the memfd */
+int shm_offer(struct conn *c)
+{
+	struct shm_region *region;
+	struct frame_hdr hdr;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char control[CMSG_SPACE(sizeof(int))];
+	int memfd;
+	ssize_t n;
+
+	memfd = memfd_create("prime-shm",MFD_CLOEXEC);
+	if(ERR == memfd)
+	{
+		perror("\nmemfd_create error");
+		return FAILURE;
+	}
+	if(ERR == ftruncate(memfd,sizeof(struct shm_region)))
+	{
+		perror("\nftruncate error");
+		close(memfd);
+		return FAILURE;
+	}
+	region = mmap(NULL,sizeof(struct shm_region),PROT_READ | PROT_WRITE,MAP_SHARED,memfd,0);
+	if(MAP_FAILED == region)
+	{
+		perror("\nmmap error");
+		close(memfd);
+		return FAILURE;
+	}
+	region->magic = SHM_MAGIC;
+	region->ring_bytes = SHM_RING_BYTES;
+
+	hdr.word = htonl(PROTO_MAGIC | OP_SHM);
+	hdr.count = htonl(sizeof(struct shm_region));
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr);
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg),&memfd,sizeof(int));
+	/* 8 bytes on a fresh connection with nothing queued, they fit */
+	n = sendmsg(c->fd,&msg,MSG_NOSIGNAL);
+	close(memfd);
+	if(sizeof(hdr) != n)
+	{
+		munmap(region,sizeof(struct shm_region));
+		return FAILURE;
+	}
+	c->shm = region;
+	return SUCCESS;
+}
+
+void shm_release(struct conn *c)
+{
+	munmap(c->shm,sizeof(struct shm_region));
+	c->shm = NULL;
+}
+
+/*
+	server side, what the client queued goes into the input buffer;
+	returns the bytes taken, ERR when out of memory or the client broke
+	the ring
+*/
+ssize_t shm_pull(struct conn *c)
+{
+	struct shm_ring *r = &c->shm->req;
+	uint32_t head,tail,off,n,first;
+	tail = atomic_load_explicit(&r->tail,memory_order_relaxed);
+	head = atomic_load_explicit(&r->head,memory_order_acquire);
+	n = head - tail;
+	if(0 == n)
+		return 0;
+	if(SHM_RING_BYTES < n)
+		return ERR;		/* protocol error, the connection is closed */
+	off = tail % SHM_RING_BYTES;
+	first = SHM_RING_BYTES - off < n ? SHM_RING_BYTES - off : n;
+	if(FAILURE == rbuf_append(&c->in,r->data + off,first) ||
+		FAILURE == rbuf_append(&c->in,r->data,n - first))
+		return ERR;
+	atomic_store_explicit(&r->tail,head,memory_order_release);
+	if(wakes(&r->writer_waiting))
+		futex_wake(&r->writer_waiting);
+	return n;
+}
+
+/*
+	server side, as much output as the response ring takes; the rest waits
+	for the doorbell the client rings once it has made room
+*/
+int shm_push(struct conn *c)
+{
+	struct shm_ring *r = &c->shm->resp;
+	uint32_t n;
+	int armed = 0,asked = 0;
+	while(c->out_off < c->out_len)
+	{
+		n = ring_write(r,c->out + c->out_off,c->out_len - c->out_off);
+		if(SHM_BAD == n)
+			return FAILURE;	/* protocol error, the connection is closed */
+		c->out_off = c->out_off + n;
+		if(0 < n)
+		{
+			armed = 0;
+			continue;
+		}
+		/* full: ask for the doorbell, then look once more before giving up */
+		if(armed)
+			break;
+		atomic_store(&r->writer_waiting,1);
+		armed = 1;
+		asked = 1;
+	}
+	if(asked && !armed)
+		atomic_store(&r->writer_waiting,0);
+	if(c->out_off == c->out_len)
+	{
+		c->out_off = 0;
+		c->out_len = 0;
+	}
+	if(wakes(&r->reader_waiting))
+		futex_wake(&r->reader_waiting);
+	return SUCCESS;
+}
+
+/* server side, about to wait for events: 1 when requests came in meanwhile */
+int shm_sleep(struct conn *c)
+{
+	struct shm_ring *r = &c->shm->req;
+	atomic_store(&r->reader_waiting,1);
+	if(0 == ring_used(r))
+		return 0;
+	atomic_store(&r->reader_waiting,0);
+	return 1;
+}
+
+static int doorbell(struct shm_client *sc)
+{
+	char bell = 0;
+	if(1 != send(sc->fd,&bell,1,MSG_NOSIGNAL | MSG_DONTWAIT) && EAGAIN != errno)
+		return FAILURE;		/* EAGAIN, earlier bells are still unread */
+	return SUCCESS;
+}
+
+/* the server closed the connection */
+static int server_gone(struct shm_client *sc)
+{
+	char bell;
+	return 0 == recv(sc->fd,&bell,1,MSG_PEEK | MSG_DONTWAIT);
+}
+
+/* client side, OP_SHM over the AF_UNIX socket at path, NULL when refused */
+struct shm_client *shm_connect(const char *path)
+{
+	struct shm_client *sc;
+	struct frame_hdr hdr;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char control[CMSG_SPACE(sizeof(int))];
+	int memfd = ERR;
+	ssize_t n;
+
+	sc = malloc(sizeof(struct shm_client));
+	if(NULL == sc)
+		return NULL;
+	sc->fd = unix_connect(path);
+	if(ERR == sc->fd)
+	{
+		free(sc);
+		return NULL;
+	}
+	hdr.word = htonl(PROTO_MAGIC | OP_SHM);
+	hdr.count = 0;
+	if(FAILURE == write_full(sc->fd,&hdr,sizeof(hdr)))
+		goto fail;
+
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr);
+	memset(&msg,0,sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	n = recvmsg(sc->fd,&msg,MSG_CMSG_CLOEXEC | MSG_WAITALL);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if(NULL != cmsg && SOL_SOCKET == cmsg->cmsg_level && SCM_RIGHTS == cmsg->cmsg_type)
+		memcpy(&memfd,CMSG_DATA(cmsg),sizeof(int));
+	if(sizeof(hdr) != n || ERR == memfd || htonl(PROTO_MAGIC | OP_SHM) != hdr.word ||
+		htonl(sizeof(struct shm_region)) != hdr.count)
+	{
+		printf("\nShared memory refused\n");
+		if(ERR != memfd)
+			close(memfd);
+		goto fail;
+	}
+	sc->region = mmap(NULL,sizeof(struct shm_region),PROT_READ | PROT_WRITE,MAP_SHARED,memfd,0);
+	close(memfd);
+	if(MAP_FAILED == sc->region)
+	{
+		perror("\nmmap error");
+		goto fail;
+	}
+	if(SHM_MAGIC != sc->region->magic || SHM_RING_BYTES != sc->region->ring_bytes)
+	{
+		printf("\nShared memory version mismatch\n");
+		munmap(sc->region,sizeof(struct shm_region));
+		goto fail;
+	}
+	sc->spin = 1 < sysconf(_SC_NPROCESSORS_ONLN) ? SHM_SPIN : 0;
+	return sc;
+
+fail:
+	close(sc->fd);
+	free(sc);
+	return NULL;
+}
+
+/* client side, all of buffer into the request ring */
+int shm_write(struct shm_client *sc,const void *buffer,size_t len)
+{
+	struct shm_ring *r = &sc->region->req;
+	size_t done = 0;
+	int spin = 0;
+	uint32_t n;
+	while(done < len)
+	{
+		n = ring_write(r,(const char *)buffer + done,len - done);
+		if(SHM_BAD == n)
+			return FAILURE;
+		done = done + n;
+		if(wakes(&r->reader_waiting) && FAILURE == doorbell(sc))
+			return FAILURE;
+		if(done == len)
+			break;
+		if(sc->spin > spin++)
+			continue;
+		atomic_store(&r->writer_waiting,1);
+		if(SHM_RING_BYTES == ring_used(r))
+		{
+			futex_wait(&r->writer_waiting);
+			if(server_gone(sc))
+				return FAILURE;
+		}
+		atomic_store(&r->writer_waiting,0);
+		spin = 0;
+	}
+	return SUCCESS;
+}
+
+/* client side, exactly len bytes of answers */
+int shm_read(struct shm_client *sc,void *buffer,size_t len)
+{
+	struct shm_ring *r = &sc->region->resp;
+	size_t done = 0;
+	int spin = 0;
+	uint32_t n;
+	while(done < len)
+	{
+		n = ring_read(r,(char *)buffer + done,len - done);
+		if(SHM_BAD == n)
+			return FAILURE;
+		done = done + n;
+		if(0 < n && wakes(&r->writer_waiting) && FAILURE == doorbell(sc))
+			return FAILURE;
+		if(done == len || 0 < n)
+			continue;
+		if(sc->spin > spin++)
+			continue;
+		atomic_store(&r->reader_waiting,1);
+		if(0 == ring_used(r))
+		{
+			futex_wait(&r->reader_waiting);
+			if(0 == ring_used(r) && server_gone(sc))
+				return FAILURE;
+		}
+		atomic_store(&r->reader_waiting,0);
+		spin = 0;
+	}
+	return SUCCESS;
+}
+
+void shm_close(struct shm_client *sc)
+{
+	munmap(sc->region,sizeof(struct shm_region));
+	close(sc->fd);
+	free(sc);
+}
@@ -0,0 +1,134 @@
+/*
+	Hierarchical timer wheel, one per I/O thread and only touched by it.
+	WHEEL_LEVELS wheels of WHEEL_SLOTS lists, a tick is a millisecond.
+	Level 0 holds the timers due in the next 64 ticks, one slot per tick,
+	level n the ones due within 64^(n+1) ticks, one slot per 64^n ticks.
+	Each time level n wraps, the next slot of level n + 1 is cascaded
+	down. Arming and cancelling are a list insert and unlink.
+*/
+
+#include"header.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+static void list_add(struct timer *head,struct timer *t)
+{
+	t->next = head->next;
+	t->prev = head;
+	head->next->prev = t;
+	head->next = t;
+}
+
+static void timer_place(struct wheel *w,struct timer *t)
+{
+	uint64_t delta;
+	int level;
+	if(t->expires < w->tick)
+		t->expires = w->tick;
+	delta = t->expires - w->tick;
+	for(level = 0;level < WHEEL_LEVELS - 1;level++)
+		if(delta < (1ULL << (WHEEL_BITS * (level + 1))))
+			break;
+	if(delta >= (1ULL << (WHEEL_BITS * WHEEL_LEVELS)))
+		t->expires = w->tick + (1ULL << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+	list_add(&w->slot[level][(t->expires >> (WHEEL_BITS * level)) & WHEEL_MASK],t);
+}
+
+void wheel_init(struct wheel *w,uint64_t now)
+{
+	int i,j;
+	w->tick = now;
+	w->armed = 0;
+	for(i = 0;i < WHEEL_LEVELS;i++)
+		for(j = 0;j < WHEEL_SLOTS;j++)
+		{
+			w->slot[i][j].next = &w->slot[i][j];
+			w->slot[i][j].prev = &w->slot[i][j];
+		}
+}
+
+void timer_cancel(struct timer *t)
+{
+	if(NULL == t->prev)
+		return;
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = NULL;
+	t->prev = NULL;
+	t->wheel->armed--;
+}
+
+/*
+	(re)arm t to fire ms from now, not from the tick, which stays where
+	the last wheel_advance() left it while the thread waits for events
+*/
+void timer_arm(struct wheel *w,struct timer *t,uint64_t ms)
+{
+	timer_cancel(t);
+	t->wheel = w;
+	t->expires = wheel_now() + ms;
+	timer_place(w,t);
+	w->armed++;
+}
+
+/* move the timers of one higher level slot down to where they belong now */
+static void cascade(struct wheel *w,int level,unsigned idx)
+{
+	struct timer *head = &w->slot[level][idx];
+	struct timer *t;
+	while(head->next != head)
+	{
+		t = head->next;
+		t->prev->next = t->next;
+		t->next->prev = t->prev;
+		timer_place(w,t);
+	}
+}
+
+/* the timers due by now, linked through next and no longer armed */
+struct timer *wheel_advance(struct wheel *w,uint64_t now)
+{
+	struct timer *expired = NULL;
+	struct timer *head,*t;
+	unsigned idx;
+	int level;
+
+	if(0 == w->armed && now > w->tick)
+		w->tick = now;
+	while(w->tick <= now)
+	{
+		idx = w->tick & WHEEL_MASK;
+		for(level = 1;0 == idx && level < WHEEL_LEVELS;level++)
+		{
+			idx = (w->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+			cascade(w,level,idx);
+		}
+		head = &w->slot[0][w->tick & WHEEL_MASK];
+		while(head->next != head)
+		{
+			t = head->next;
+			timer_cancel(t);
+			t->next = expired;
+			expired = t;
+		}
+		w->tick++;
+	}
+	return expired;
+}
+
+/* ms until a timer may be due, -1 with none armed, for epoll_wait() */
+int wheel_timeout(const struct wheel *w)
+{
+	unsigned i;
+	if(0 == w->armed)
+		return ERR;
+	for(i = w->tick & WHEEL_MASK;i < WHEEL_SLOTS;i++)
+		if(w->slot[0][i].next != &w->slot[0][i])
+			break;
+	return i - (w->tick & WHEEL_MASK);	/* or the next cascade */
+}
+
+uint64_t wheel_now(void)
+{
+	return metrics_now() / 1000000;
+}
@@ -0,0 +1,188 @@
+/*
+	UDP datagram mode, one socket per worker in the SO_REUSEPORT group
+	of PORT. Each datagram is a whole request, see the protocol comment
+	in header.h; it is answered on the spot, there is no per-client state.
+	recvmmsg() fetches up to vlen datagrams and one sendmmsg() sends all
+	their replies, so a busy socket costs two system calls per vlen
+	datagrams. The socket is level-triggered in the event loop and one
+	pass reads at most UDP_ROUNDS batches, a flood cannot starve TCP.
+*/
+
+#include"header.h"
+
+#define UDP_REPLY (sizeof(uint32_t) + sizeof(struct frame_hdr) + (UDP_MAX_BATCH + 7) / 8)
+#define UDP_ROUNDS 16
+
+struct udp
+{
+	int fd;
+	struct mmsghdr *in;
+	struct mmsghdr *out;
+	struct iovec *iov_in;
+	struct iovec *iov_out;
+	struct sockaddr_storage *addr;
+	char *buf_in;			/* vlen * UDP_DATAGRAM */
+	char *buf_out;			/* vlen * UDP_REPLY */
+};
+
+static int vlen = UDP_VLEN;
+
+/* datagrams per system call, 1 turns batching off */
+void udp_batch(int n)
+{
+	vlen = n;
+}
+
+/* per event loop thread, its buffers stay wired into the message headers */
+struct udp *udp_open(int socket_fd)
+{
+	struct udp *u;
+	int i;
+	u = calloc(1,sizeof(struct udp));
+	if(NULL == u)
+		return NULL;
+	u->fd = socket_fd;
+	u->in = calloc(vlen,sizeof(struct mmsghdr));
+	u->out = calloc(vlen,sizeof(struct mmsghdr));
+	u->iov_in = calloc(vlen,sizeof(struct iovec));
+	u->iov_out = calloc(vlen,sizeof(struct iovec));
+	u->addr = calloc(vlen,sizeof(struct sockaddr_storage));
+	u->buf_in = malloc((size_t)vlen * UDP_DATAGRAM);
+	u->buf_out = malloc((size_t)vlen * UDP_REPLY);
+	if(NULL == u->in || NULL == u->out || NULL == u->iov_in || NULL == u->iov_out ||
+		NULL == u->addr || NULL == u->buf_in || NULL == u->buf_out)
+	{
+		perror("udp allocation error\n");
+		free(u->in);
+		free(u->out);
+		free(u->iov_in);
+		free(u->iov_out);
+		free(u->addr);
+		free(u->buf_in);
+		free(u->buf_out);
+		free(u);
+		return NULL;
+	}
+	for(i = 0;i < vlen;i++)
+	{
+		u->iov_in[i].iov_base = u->buf_in + (size_t)i * UDP_DATAGRAM;
+		u->iov_in[i].iov_len = UDP_DATAGRAM;
+		u->in[i].msg_hdr.msg_iov = &u->iov_in[i];
+		u->in[i].msg_hdr.msg_iovlen = 1;
+		u->in[i].msg_hdr.msg_name = &u->addr[i];
+		u->out[i].msg_hdr.msg_iov = &u->iov_out[i];
+		u->out[i].msg_hdr.msg_iovlen = 1;
+	}
+	return u;
+}
+
+/*
+	the reply to one datagram in reply, returns its length, 0 for none;
+	*good is set when it answered a request rather than an error
+*/
+static size_t udp_answer(const char *data,size_t len,int truncated,char *reply,int *good)
+{
+	struct frame_hdr hdr;
+	struct frame f;
+	unsigned char *results;
+	size_t need;
+	ssize_t n;
+
+	*good = 0;
+	if(len < sizeof(uint32_t))
+		return 0;
+	memcpy(reply,data,sizeof(uint32_t));		/* the id */
+	n = parse_frame(data + sizeof(uint32_t),len - sizeof(uint32_t),&f,&need);
+	if(truncated || ERR == n || (size_t)n != len - sizeof(uint32_t) ||
+		(OP_BATCH != f.op && OP_CHECK != f.op) || UDP_MAX_BATCH < f.count)
+	{
+		hdr.word = htonl(PROTO_MAGIC | OP_ERROR);
+		hdr.count = htonl(ERROR_BAD_DATAGRAM);
+		memcpy(reply + sizeof(uint32_t),&hdr,sizeof(hdr));
+		return sizeof(uint32_t) + sizeof(hdr);
+	}
+	*good = 1;
+	if(OP_CHECK == f.op)
+	{
+		reply[sizeof(uint32_t)] = metrics_check(frame_integer(&f,0)) ? STATUS_PRIME : STATUS_NOT_PRIME;
+		return sizeof(uint32_t) + 1;
+	}
+	hdr.word = htonl(PROTO_MAGIC | OP_BATCH);
+	hdr.count = htonl(f.count);
+	memcpy(reply + sizeof(uint32_t),&hdr,sizeof(hdr));
+	results = (unsigned char *)reply + sizeof(uint32_t) + sizeof(hdr);
+	memset(results,0,(f.count + 7) / 8);
+	metrics_check_batch(&f,results,NULL);
+	return sizeof(uint32_t) + sizeof(hdr) + (f.count + 7) / 8;
+}
+
+/*
+	read, answer and reply until the socket is drained or UDP_ROUNDS
+	batches are done. A reply the socket buffer has no room for is
+	dropped like any lost datagram and counted in STAT_UDP_DROPPED.
+*/
+void udp_readable(struct udp *u)
+{
+	struct mmsghdr *in;
+	uint64_t start,bytes_in,bytes_out;
+	size_t len;
+	int rounds,n,m,i,k,sent,good;
+
+	for(rounds = 0;rounds < UDP_ROUNDS;rounds++)
+	{
+		for(i = 0;i < vlen;i++)
+			u->in[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		n = recvmmsg(u->fd,u->in,vlen,MSG_DONTWAIT,NULL);
+		if(ERR == n)
+		{
+			if(EINTR == errno)
+				continue;
+			if(EAGAIN != errno && EWOULDBLOCK != errno)
+				perror("\nrecvmmsg error");
+			return;
+		}
+		start = metrics_now();
+		bytes_in = 0;
+		bytes_out = 0;
+		for(i = 0,m = 0;i < n;i++)
+		{
+			in = &u->in[i];
+			bytes_in = bytes_in + in->msg_len;
+			len = udp_answer(u->iov_in[i].iov_base,in->msg_len,in->msg_hdr.msg_flags & MSG_TRUNC,
+				u->buf_out + (size_t)m * UDP_REPLY,&good);
+			if(good)
+				metrics_request(start);
+			else
+				metrics_add(STAT_UDP_BAD,1);
+			if(0 == len)
+				continue;
+			u->iov_out[m].iov_base = u->buf_out + (size_t)m * UDP_REPLY;
+			u->iov_out[m].iov_len = len;
+			u->out[m].msg_hdr.msg_name = in->msg_hdr.msg_name;
+			u->out[m].msg_hdr.msg_namelen = in->msg_hdr.msg_namelen;
+			bytes_out = bytes_out + len;
+			m++;
+		}
+		for(sent = 0;sent < m;sent = sent + k)
+		{
+			k = sendmmsg(u->fd,u->out + sent,m - sent,MSG_DONTWAIT);
+			if(ERR == k && EINTR == errno)
+			{
+				k = 0;
+				continue;
+			}
+			if(ERR == k)
+			{
+				for(i = sent;i < m;i++)
+					bytes_out = bytes_out - u->iov_out[i].iov_len;
+				metrics_add(STAT_UDP_DROPPED,m - sent);
+				break;
+			}
+		}
+		metrics_add(STAT_UDP_IN,n);
+		metrics_add(STAT_BYTES_IN,bytes_in);
+		metrics_add(STAT_BYTES_OUT,bytes_out);
+		if(n < vlen)
+			return;
+	}
+}
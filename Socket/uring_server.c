@@ -0,0 +1,680 @@
+/*
+	io_uring backend for the prime server, on the raw system calls so
+	liburing is not needed.
+	- one multishot accept keeps delivering new connections, a second
+	  one those of the AF_UNIX listener; OP_SHM is not served here, the
+	  shared memory rings need the epoll loop
+	- a one-shot poll rearmed after every pass watches the UDP socket,
+	  udp.c reads it with recvmmsg()
+	- each connection has one multishot recv that takes its buffers from
+	  a provided buffer ring, the bytes are appended to the connection's
+	  rbuf and the buffer goes straight back to the ring
+	- at most one send per connection is in flight and it owns the output
+	  it sends, new answers collect in a fresh buffer meanwhile; the last
+	  send of a session is linked to the close of the socket
+	- tasks back from the worker pool are announced by a read of the
+	  completion eventfd, the wait in io_uring_enter() is bounded by the
+	  next timer of the wheel
+	Submissions and completions share one io_uring_enter() per loop pass.
+	Without a usable io_uring the epoll loop serves instead.
+*/
+
+#include"header.h"
+#include<linux/io_uring.h>
+#include<sys/syscall.h>
+#include<sys/mman.h>
+#include<poll.h>
+
+#define URING_ENTRIES 1024
+#define URING_CQ_ENTRIES 16384
+#define PBUF_COUNT 1024		/* provided buffers, a power of two */
+#define PBUF_SIZE 4096
+#define PBUF_GROUP 0
+
+/* low bits of user_data say what completed, the rest is the connection */
+#define TAG_ACCEPT 0
+#define TAG_RECV 1
+#define TAG_SEND 2
+#define TAG_CLOSE 3
+#define TAG_CANCEL 4
+#define TAG_EVENT 5
+#define TAG_ACCEPT_UNIX 6
+#define TAG_UDP 7
+#define TAG_MASK 7ULL
+
+struct uconn
+{
+	struct conn c;
+	char *send_buf;		/* output owned by the send in flight */
+	size_t send_len;
+	size_t send_off;
+	int recv_armed;
+	int send_inflight;
+	int close_inflight;
+	int cancel_sent;
+	int dead;		/* no more input, close once output is sent */
+	int drop;		/* failed, answers still to come are not sent */
+	int closed;
+};
+
+struct uring
+{
+	int fd;
+	void *sq_ring;		/* SQ and CQ rings, one mapping */
+	size_t sq_ring_size;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	unsigned pending;	/* SQEs queued since the last enter */
+	struct io_uring_buf_ring *br;
+	unsigned short br_tail;
+	char *bufs;
+	int listen_fd;
+	int unix_fd;		/* ERR without the AF_UNIX listener */
+	struct udp *udp;	/* NULL without UDP */
+	int udp_fd;
+	struct completions cq;
+	uint64_t efd_count;	/* target of the eventfd read */
+	struct wheel wheel;
+};
+
+/* everything uring_setup() got, safe on a partly set up ring */
+static void uring_free(struct uring *r)
+{
+	if(NULL != r->br)
+		munmap(r->br,PBUF_COUNT * sizeof(struct io_uring_buf));
+	free(r->bufs);
+	if(NULL != r->sqes)
+		munmap(r->sqes,r->sq_entries * sizeof(struct io_uring_sqe));
+	if(NULL != r->sq_ring)
+		munmap(r->sq_ring,r->sq_ring_size);
+	if(0 < r->fd)
+		close(r->fd);
+	r->br = NULL;
+	r->bufs = NULL;
+	r->sqes = NULL;
+	r->sq_ring = NULL;
+	r->fd = ERR;
+}
+
+/* the operations the loop submits, as IORING_REGISTER_PROBE reports them */
+static int uring_ops_ok(struct uring *r)
+{
+	static const int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_CLOSE,
+		IORING_OP_ASYNC_CANCEL, IORING_OP_READ, IORING_OP_POLL_ADD };
+	struct io_uring_probe *probe;
+	unsigned i;
+	int ok = 1;
+	probe = calloc(1,sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+	if(NULL == probe)
+		return 0;
+	if(ERR == syscall(__NR_io_uring_register,r->fd,IORING_REGISTER_PROBE,probe,256))
+		ok = 0;
+	for(i = 0;ok && i < sizeof(ops) / sizeof(ops[0]);i++)
+		ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+	return ok;
+}
+
+static int uring_setup(struct uring *r)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	size_t sq_size,cq_size;
+	char *sq_ptr;
+	void *map;
+	unsigned i;
+
+	memset(&p,0,sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = URING_CQ_ENTRIES;
+	r->fd = syscall(__NR_io_uring_setup,URING_ENTRIES,&p);
+	if(ERR == r->fd)
+		return FAILURE;
+	if(!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG) || !uring_ops_ok(r))
+		goto fail;
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sq_ring_size = sq_size > cq_size ? sq_size : cq_size;
+	map = mmap(NULL,r->sq_ring_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,r->fd,IORING_OFF_SQ_RING);
+	if(MAP_FAILED == map)
+		goto fail;
+	r->sq_ring = map;
+	sq_ptr = map;
+	r->sq_entries = p.sq_entries;
+	map = mmap(NULL,p.sq_entries * sizeof(struct io_uring_sqe),PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE,r->fd,IORING_OFF_SQES);
+	if(MAP_FAILED == map)
+		goto fail;
+	r->sqes = map;
+
+	r->sq_head = (unsigned *)(sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned *)(sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned *)(sq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)(sq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(sq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(sq_ptr + p.cq_off.cqes);
+
+	map = mmap(NULL,PBUF_COUNT * sizeof(struct io_uring_buf),PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+	if(MAP_FAILED == map)
+		goto fail;
+	r->br = map;
+	r->bufs = malloc(PBUF_COUNT * PBUF_SIZE);
+	if(NULL == r->bufs)
+		goto fail;
+	/* provided buffer rings came with multishot accept in 5.19 */
+	memset(&reg,0,sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)r->br;
+	reg.ring_entries = PBUF_COUNT;
+	reg.bgid = PBUF_GROUP;
+	if(ERR == syscall(__NR_io_uring_register,r->fd,IORING_REGISTER_PBUF_RING,&reg,1))
+		goto fail;
+	for(i = 0;i < PBUF_COUNT;i++)
+	{
+		r->br->bufs[i].addr = (uint64_t)(uintptr_t)(r->bufs + i * PBUF_SIZE);
+		r->br->bufs[i].len = PBUF_SIZE;
+		r->br->bufs[i].bid = i;
+	}
+	r->br_tail = PBUF_COUNT;
+	__atomic_store_n(&r->br->tail,r->br_tail,__ATOMIC_RELEASE);
+	return SUCCESS;
+fail:
+	uring_free(r);
+	return FAILURE;
+}
+
+static void pbuf_recycle(struct uring *r,unsigned short bid)
+{
+	struct io_uring_buf *b;
+	b = &r->br->bufs[r->br_tail & (PBUF_COUNT - 1)];
+	b->addr = (uint64_t)(uintptr_t)(r->bufs + bid * PBUF_SIZE);
+	b->len = PBUF_SIZE;
+	b->bid = bid;
+	r->br_tail++;
+	__atomic_store_n(&r->br->tail,r->br_tail,__ATOMIC_RELEASE);
+}
+
+/* waits for wait completions, at most timeout ms unless it is negative */
+static int uring_enter(struct uring *r,unsigned wait,int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	int n;
+	if(wait && 0 <= timeout)
+	{
+		memset(&arg,0,sizeof(arg));
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000LL;
+		arg.ts = (uint64_t)(uintptr_t)&ts;
+		n = syscall(__NR_io_uring_enter,r->fd,r->pending,wait,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,&arg,sizeof(arg));
+	}
+	else
+		n = syscall(__NR_io_uring_enter,r->fd,r->pending,wait,wait ? IORING_ENTER_GETEVENTS : 0,NULL,0);
+	if(0 > n)
+	{
+		if(EINTR == errno || EBUSY == errno || EAGAIN == errno || ETIME == errno)
+			return SUCCESS;	/* reap completions and try again */
+		perror("\nio_uring_enter error");
+		return FAILURE;
+	}
+	r->pending = r->pending - n;
+	return SUCCESS;
+}
+
+/* the kernel only reads the SQ ring inside io_uring_enter(), no SQPOLL */
+static struct io_uring_sqe *uring_sqe(struct uring *r,uint64_t user_data)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail = *r->sq_tail;
+	unsigned idx;
+	if(tail - __atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE) >= r->sq_entries)
+	{
+		uring_enter(r,0,ERR);
+		if(tail - __atomic_load_n(r->sq_head,__ATOMIC_ACQUIRE) >= r->sq_entries)
+			return NULL;
+	}
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe,0,sizeof(struct io_uring_sqe));
+	sqe->user_data = user_data;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail,tail + 1,__ATOMIC_RELEASE);
+	r->pending++;
+	return sqe;
+}
+
+static uint64_t tag(struct uconn *u,uint64_t what)
+{
+	return (uint64_t)(uintptr_t)u | what;
+}
+
+/* the next completion into *cqe, FAILURE when none comes within a second */
+static int uring_wait_cqe(struct uring *r,struct io_uring_cqe *cqe)
+{
+	unsigned head = *r->cq_head;
+	if(head == __atomic_load_n(r->cq_tail,__ATOMIC_ACQUIRE) &&
+		(FAILURE == uring_enter(r,1,1000) || head == __atomic_load_n(r->cq_tail,__ATOMIC_ACQUIRE)))
+		return FAILURE;
+	*cqe = r->cqes[head & *r->cq_mask];
+	__atomic_store_n(r->cq_head,head + 1,__ATOMIC_RELEASE);
+	return SUCCESS;
+}
+
+/*
+	multishot recv came with 6.0, an older kernel fails it with EINVAL:
+	one on a socketpair gets a byte with IORING_CQE_F_MORE where it works,
+	closing the other end then finishes it before the loop starts
+*/
+static int uring_recv_ok(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe cqe;
+	int sv[2];
+	int ok = 0,more = 1;
+	if(ERR == socketpair(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0,sv))
+		return 0;
+	sqe = uring_sqe(r,TAG_RECV);
+	if(NULL == sqe || 1 != write(sv[1],"p",1))
+		more = 0;
+	else
+	{
+		sqe->opcode = IORING_OP_RECV;
+		sqe->fd = sv[0];
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = PBUF_GROUP;
+	}
+	while(more && SUCCESS == uring_wait_cqe(r,&cqe))
+	{
+		if(cqe.flags & IORING_CQE_F_BUFFER)
+			pbuf_recycle(r,cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+		more = cqe.flags & IORING_CQE_F_MORE;
+		if(1 == cqe.res && more)
+		{
+			ok = 1;
+			close(sv[1]);
+			sv[1] = ERR;
+		}
+	}
+	if(more)
+		ok = 0;		/* still armed on a socket about to close */
+	close(sv[0]);
+	if(ERR != sv[1])
+		close(sv[1]);
+	return ok;
+}
+
+/* what is TAG_ACCEPT or TAG_ACCEPT_UNIX */
+static int prep_accept(struct uring *r,uint64_t what)
+{
+	struct io_uring_sqe *sqe;
+	sqe = uring_sqe(r,what);
+	if(NULL == sqe)
+		return FAILURE;
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = TAG_ACCEPT == what ? r->listen_fd : r->unix_fd;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	return SUCCESS;
+}
+
+static int prep_recv(struct uring *r,struct uconn *u)
+{
+	struct io_uring_sqe *sqe;
+	sqe = uring_sqe(r,tag(u,TAG_RECV));
+	if(NULL == sqe)
+		return FAILURE;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = u->c.fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = PBUF_GROUP;
+	u->recv_armed = 1;
+	return SUCCESS;
+}
+
+static int prep_send(struct uring *r,struct uconn *u,int link_close)
+{
+	struct io_uring_sqe *sqe;
+	sqe = uring_sqe(r,tag(u,TAG_SEND));
+	if(NULL == sqe)
+		return FAILURE;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = u->c.fd;
+	sqe->addr = (uint64_t)(uintptr_t)(u->send_buf + u->send_off);
+	sqe->len = u->send_len - u->send_off;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	if(link_close)
+		sqe->flags = IOSQE_IO_LINK;
+	u->send_inflight = 1;
+	return SUCCESS;
+}
+
+static int prep_close(struct uring *r,struct uconn *u)
+{
+	struct io_uring_sqe *sqe;
+	sqe = uring_sqe(r,tag(u,TAG_CLOSE));
+	if(NULL == sqe)
+		return FAILURE;
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->fd = u->c.fd;
+	u->close_inflight = 1;
+	return SUCCESS;
+}
+
+static int prep_cancel_recv(struct uring *r,struct uconn *u)
+{
+	struct io_uring_sqe *sqe;
+	sqe = uring_sqe(r,TAG_CANCEL);
+	if(NULL == sqe)
+		return FAILURE;
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = tag(u,TAG_RECV);
+	u->cancel_sent = 1;
+	return SUCCESS;
+}
+
+static int prep_event(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+	sqe = uring_sqe(r,TAG_EVENT);
+	if(NULL == sqe)
+		return FAILURE;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = r->cq.efd;
+	sqe->addr = (uint64_t)(uintptr_t)&r->efd_count;
+	sqe->len = sizeof(r->efd_count);
+	return SUCCESS;
+}
+
+/* level-triggered, fires at once when datagrams are left over */
+static int prep_udp(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+	sqe = uring_sqe(r,TAG_UDP);
+	if(NULL == sqe)
+		return FAILURE;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = r->udp_fd;
+	sqe->poll32_events = POLLIN;
+	return SUCCESS;
+}
+
+/* stop reading, pending output and answers are still sent when keep_output is set */
+static void uconn_kill(struct uconn *u,int keep_output)
+{
+	u->dead = 1;
+	if(!keep_output)
+	{
+		u->c.out_len = 0;
+		u->drop = 1;
+	}
+}
+
+/* start the next send or the close, whatever the connection is ready for */
+static void uconn_progress(struct uring *r,struct uconn *u)
+{
+	int last;
+	if(u->dead && u->recv_armed && !u->cancel_sent && FAILURE == prep_cancel_recv(r,u))
+		u->recv_armed = 0;	/* cannot happen with a sane ring size */
+	if(u->send_inflight || u->close_inflight || u->closed)
+		return;
+	last = u->dead && (u->drop || NULL == u->c.tasks);	/* nothing more to answer */
+	if(0 < u->c.out_len)
+	{
+		u->send_buf = u->c.out;		/* the send owns it from here */
+		u->send_len = u->c.out_len;
+		u->send_off = 0;
+		u->c.out = NULL;
+		u->c.out_len = 0;
+		u->c.out_cap = 0;
+		if(FAILURE == prep_send(r,u,last))
+		{
+			uconn_kill(u,0);
+			last = 1;
+			u->send_len = 0;
+		}
+		else if(!last)
+			return;
+	}
+	if(last && FAILURE == prep_close(r,u))
+	{
+		close(u->c.fd);
+		u->closed = 1;
+	}
+}
+
+static void uconn_maybe_free(struct uconn *u)
+{
+	if(!u->closed || u->recv_armed || u->send_inflight || u->close_inflight || u->c.inflight)
+		return;
+	conn_destroy(&u->c);
+	free(u->send_buf);
+	free(u);
+}
+
+static void on_accept(struct uring *r,struct io_uring_cqe *cqe)
+{
+	struct uconn *u;
+	if(!(cqe->flags & IORING_CQE_F_MORE) && FAILURE == prep_accept(r,cqe->user_data & TAG_MASK))
+		perror("\nAccept rearm error");
+	if(0 > cqe->res)
+		return;
+	u = malloc(sizeof(struct uconn));
+	if(NULL == u)
+	{
+		close(cqe->res);
+		return;
+	}
+	memset(u,0,sizeof(struct uconn));
+	if(FAILURE == conn_init(&u->c,cqe->res))
+	{
+		close(cqe->res);
+		free(u);
+		return;
+	}
+	conn_attach(&u->c,&r->cq,&r->wheel);
+	if(FAILURE == prep_recv(r,u))
+	{
+		close(u->c.fd);
+		conn_destroy(&u->c);
+		free(u);
+	}
+}
+
+static void on_recv(struct uring *r,struct uconn *u,struct io_uring_cqe *cqe)
+{
+	unsigned short bid;
+	if(!(cqe->flags & IORING_CQE_F_MORE))
+		u->recv_armed = 0;
+	if(cqe->flags & IORING_CQE_F_BUFFER)
+	{
+		bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		if(0 < cqe->res && !u->dead &&
+			FAILURE == rbuf_append(&u->c.in,r->bufs + bid * PBUF_SIZE,cqe->res))
+			uconn_kill(u,0);
+		pbuf_recycle(r,bid);
+	}
+	if(0 < cqe->res)
+	{
+		if(!u->dead && FAILURE == conn_parse(&u->c))
+			uconn_kill(u,0);
+		if(u->c.closing)
+			uconn_kill(u,1);
+		if(!u->dead && !u->recv_armed && FAILURE == prep_recv(r,u))
+			uconn_kill(u,0);
+	}
+	else if(-ENOBUFS == cqe->res && !u->dead)
+	{
+		if(!u->recv_armed && FAILURE == prep_recv(r,u))	/* ring ran dry, rearm */
+			uconn_kill(u,0);
+	}
+	else if(0 == cqe->res && !u->dead)
+		uconn_kill(u,1);	/* peer shut its side, it may still read the answers */
+	else if(!u->dead)
+		uconn_kill(u,0);
+	uconn_progress(r,u);
+	uconn_maybe_free(u);
+}
+
+static void on_send(struct uring *r,struct uconn *u,struct io_uring_cqe *cqe)
+{
+	u->send_inflight = 0;
+	if(0 > cqe->res)
+		uconn_kill(u,0);
+	else if(u->send_off + cqe->res < u->send_len && !u->close_inflight)
+	{
+		u->send_off = u->send_off + cqe->res;	/* short send, send the rest */
+		if(FAILURE == prep_send(r,u,0))
+			uconn_kill(u,0);
+		return;
+	}
+	free(u->send_buf);
+	u->send_buf = NULL;
+	uconn_progress(r,u);
+	uconn_maybe_free(u);
+}
+
+static void on_close(struct uconn *u,struct io_uring_cqe *cqe)
+{
+	u->close_inflight = 0;
+	u->closed = 1;
+	if(-ECANCELED == cqe->res)
+		close(u->c.fd);		/* the linked send failed */
+	uconn_maybe_free(u);
+}
+
+/* answers of the tasks back from the pool, then read the eventfd again */
+static void on_event(struct uring *r)
+{
+	struct task *t,*next;
+	struct uconn *u;
+	if(FAILURE == prep_event(r))
+		perror("\nEventfd rearm error");
+	for(t = completions_take(&r->cq);NULL != t;t = next)
+	{
+		next = t->next_done;
+		u = (struct uconn *)t->c;	/* c is the first member */
+		conn_task_done(t);
+		if(!u->drop && FAILURE == conn_collect(&u->c))
+			uconn_kill(u,0);
+		uconn_progress(r,u);
+		uconn_maybe_free(u);
+	}
+}
+
+/* reap idle connections, answer the tasks past their deadline */
+static void timers_expired(struct uring *r)
+{
+	struct timer *tm,*next;
+	struct task *t;
+	struct uconn *u;
+	for(tm = wheel_advance(&r->wheel,wheel_now());NULL != tm;tm = next)
+	{
+		next = tm->next;
+		if(TIMER_IDLE == tm->kind)
+		{
+			u = tm->owner;
+			if(u->dead || FAILURE == conn_idle(&u->c))
+				continue;
+			uconn_kill(u,0);
+		}
+		else
+		{
+			t = tm->owner;
+			u = (struct uconn *)t->c;
+			conn_task_expired(t);
+			if(!u->drop && FAILURE == conn_collect(&u->c))
+				uconn_kill(u,0);
+		}
+		uconn_progress(r,u);
+		uconn_maybe_free(u);
+	}
+}
+
+int run_uring_server(int listen_fd,int unix_fd,int udp_fd)
+{
+	struct uring r;
+	struct io_uring_cqe *cqe;
+	struct uconn *u;
+	unsigned head,tail;
+
+	memset(&r,0,sizeof(r));
+	r.listen_fd = listen_fd;
+	r.unix_fd = unix_fd;
+	r.udp_fd = udp_fd;
+	if(FAILURE == uring_setup(&r) || !uring_recv_ok(&r))
+	{
+		fprintf(stderr,"io_uring not available, serving with epoll\n");
+		uring_free(&r);
+		return run_epoll_server(listen_fd,unix_fd,udp_fd);
+	}
+	if(FAILURE == completions_init(&r.cq) || FAILURE == prep_accept(&r,TAG_ACCEPT) || FAILURE == prep_event(&r) ||
+		(ERR != unix_fd && FAILURE == prep_accept(&r,TAG_ACCEPT_UNIX)))
+	{
+		uring_free(&r);
+		return FAILURE;
+	}
+	if(ERR != udp_fd)
+	{
+		r.udp = udp_open(udp_fd);
+		if(NULL == r.udp || FAILURE == prep_udp(&r))
+		{
+			uring_free(&r);
+			return FAILURE;
+		}
+	}
+	wheel_init(&r.wheel,wheel_now());
+
+	while(1)
+	{
+		if(FAILURE == uring_enter(&r,1,wheel_timeout(&r.wheel)))
+			break;
+		head = *r.cq_head;
+		tail = __atomic_load_n(r.cq_tail,__ATOMIC_ACQUIRE);
+		for(;head != tail;head++)
+		{
+			cqe = &r.cqes[head & *r.cq_mask];
+			u = (struct uconn *)(uintptr_t)(cqe->user_data & ~TAG_MASK);
+			switch(cqe->user_data & TAG_MASK)
+			{
+			case TAG_ACCEPT:
+			case TAG_ACCEPT_UNIX:
+				on_accept(&r,cqe);
+				break;
+			case TAG_RECV:
+				on_recv(&r,u,cqe);
+				break;
+			case TAG_SEND:
+				on_send(&r,u,cqe);
+				break;
+			case TAG_CLOSE:
+				on_close(u,cqe);
+				break;
+			case TAG_EVENT:
+				on_event(&r);
+				break;
+			case TAG_UDP:
+				udp_readable(r.udp);
+				if(FAILURE == prep_udp(&r))
+					perror("\nUDP poll rearm error");
+				break;
+			}
+		}
+		__atomic_store_n(r.cq_head,head,__ATOMIC_RELEASE);
+		timers_expired(&r);
+	}
+	uring_free(&r);
+	return FAILURE;
+}